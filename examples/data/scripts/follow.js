@@ -18,6 +18,10 @@ uzbl.follow = (function () {
 var uzblDivId = 'uzbl_link_hints';
 var uzblMatchClass = 'uzbl-follow-text-match';
 var uzblNewWindowClass = 'new-window';
+// Set on elements collected by 'hint collect' in the web extension.
+var uzblHintAttribute = 'data-uzbl-hint';
+// The hints from the last 'hint collect'.
+var collectedHints = [];
 // This is duplicated in uzbl.formfiller.
 var textInputTypes = [
         'color',
@@ -148,6 +152,10 @@ var removeHints = function (doc) {
     matches.forEach(function (match) {
         match.classList.remove(uzblMatchClass);
     });
+
+    slice.apply(doc.querySelectorAll('[' + uzblHintAttribute + ']')).forEach(function (el) {
+        delete el.uzblHintPosition;
+    });
 };
 
 // Generate a hint for an element with the given label.
@@ -247,11 +255,34 @@ var getInterestingElements = function () {
     return elems.filter(elementInViewport);
 };
 
+// Look up the elements for hints collected by the web extension. Each hint is
+// [id, x, y, width, height, href]; positions are kept on the element so that
+// they need not be calculated again.
+var getCollectedElements = function (hints) {
+    var byId = {};
+
+    query('[' + uzblHintAttribute + ']').forEach(function (el) {
+        byId[el.getAttribute(uzblHintAttribute)] = el;
+    });
+
+    return hints.map(function (hint) {
+        var el = byId[hint[0]];
+        if (el) {
+            el.uzblHintPosition = [hint[2], hint[1], hint[3], hint[4]];
+        }
+        return el;
+    }).filter(function (el) {
+        return el;
+    });
+};
+
 // Draw all hints for all elements passed.
 var reDrawHints = function (elems, len) {
     // We have to calculate element positions before we modify the DOM
     // otherwise the elementPosition call slows way down.
-    var positions = elems.map(elementPosition);
+    var positions = elems.map(function (el) {
+        return el.uzblHintPosition || elementPosition(el);
+    });
 
     documents().forEach(function (doc) {
         removeHints(doc);
@@ -382,6 +413,30 @@ return {
         }
     },
 
+    // Same as followLinks, but with the elements collected natively by the
+    // 'hint collect' command rather than by walking the DOM here. The hints
+    // are kept for later keys, for which 'hint collect' returns null.
+    followHints: function (charset, str, action, hints) {
+        setMode(action);
+        setCharset(charset);
+
+        if (hints) {
+            collectedHints = hints;
+        } else {
+            hints = collectedHints;
+        }
+
+        var elems   = getCollectedElements(hints);
+        var matches = findMatchingHintId(elems, str);
+
+        if (matches.length === 1) {
+            return followElement(matches[0]);
+        } else {
+            var len = labelLength(elems.length) - str.length;
+            reDrawHints(matches, len);
+        }
+    },
+
     followTextContent: function (str, action) {
         setMode(action);
 
@@ -16,29 +16,5 @@ readonly url="$( print "$entry" | cut -d "	" -f 1 )"
 readonly title="$( print "$entry" | cut -d "	" -f 2 )"
 readonly new_tags="$( print "$entry" | cut -d "	" -f 3 )"
 
-# Escape the url and title for sed
-readonly eurl="$( print "$url" | sed -e 's!\\!\\\\!g
-                                         s![][^$*./]!\\&!g
-                                         s!#.*!!' )"
-
-# See if the url is in the file already
-readonly cur="$( sed -n -e "\<^$eurl<{p;q}" "$UZBL_BOOKMARKS_FILE" )"
-if [ -n "$cur" ]; then
-    readonly cur_url="$( print "$cur" | cut -d "	" -f 1 )"
-    readonly cur_tags="$( print "$cur" | cut -d "	" -f 3 )"
-
-    # Remove the current entry from the bookmarks file
-    sed_i "$UZBL_BOOKMARKS_FILE" -e "\<^$eurl\t<d"
-
-    # Append the exiting tags
-    tags="$new_tags $cur_tags"
-else
-    tags="$new_tags"
-fi
-readonly tags
-
-# Remove duplicate tags (also sorts)
-readonly sorted_uniq_tags="$( print "$tags" | tr ' ' '\n' | sort -u | tr '\n' ' ' )"
-
-# Put the tags in the file
-print "$url	$title	$sorted_uniq_tags\n" >> "$UZBL_BOOKMARKS_FILE"
+# uzbl merges the tags with those of an existing bookmark for the url
+uzbl_control "bookmark add $( print_quoted "$url" | uzbl_escape ) $( print_quoted "$title" | uzbl_escape ) $( print "$new_tags" | uzbl_escape )\n"
@@ -12,17 +12,7 @@ else
 fi
 readonly cookie_file
 
-awk -F \\t '
-BEGIN {
-    scheme["TRUE"] = "https";
-    scheme["FALSE"] = "http";
-}
-$0 ~ /^#HttpOnly_/ {
-    gsub(/@/, "\\@")
-    printf("cookie add \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"\n", substr($1,length("#HttpOnly_")+1,length($1)), $3, $6, $7, scheme[$4], $5)
-}
-$0 !~ /^#/ {
-    gsub(/@/, "\\@")
-    printf("cookie add \"%s\" \"%s\" \"%s\" \"%s\" \"%s\" \"%s\"\n", $1, $3, $6, $7, scheme[$4], $5)
-}
-' "$cookie_file"
+# WebKit2 cannot add cookies one at a time; import the whole file at once.
+[ -f "$cookie_file" ] || exit 0
+
+printf 'cookie import "%s"\n' "$(printf '%s' "$cookie_file" | sed -e 's/[\\"@]/\\&/g')"
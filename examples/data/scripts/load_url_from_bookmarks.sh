@@ -1,7 +1,5 @@
 #!/bin/sh
 
-#NOTE: it's the job of the script that inserts bookmarks to make sure there are no dupes.
-
 readonly DMENU_SCHEME="bookmarks"
 readonly DMENU_OPTIONS="xmms vertical resize"
 
@@ -9,14 +7,18 @@ readonly DMENU_OPTIONS="xmms vertical resize"
 . "$UZBL_UTIL_DIR/uzbl-dir.sh"
 . "$UZBL_UTIL_DIR/uzbl-util.sh"
 
-[ -r "$UZBL_BOOKMARKS_FILE" ] || exit 1
+# uzbl keeps the current bookmarks in memory, so ask it rather than replaying
+# the changes appended to bookmarks_file.
+current_bookmarks () {
+    uzbl_control "bookmark prefix ''\n" | sed -e '/^$/d'
+}
 
 if $DMENU_HAS_VERTICAL; then
-    # show tags as well
-    goto="$( $DMENU < "$UZBL_BOOKMARKS_FILE" | cut -d "	" -f 1 )"
+    # show titles and tags as well
+    goto="$( current_bookmarks | $DMENU | cut -d "	" -f 1 )"
 else
     # because they are all after each other, just show the url, not their tags.
-    goto="$( cut -d "	" -f 1 < "$UZBL_BOOKMARKS_FILE" | $DMENU )"
+    goto="$( current_bookmarks | cut -d "	" -f 1 | $DMENU )"
 fi
 readonly goto
 
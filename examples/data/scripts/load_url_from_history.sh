@@ -7,20 +7,20 @@ readonly DMENU_OPTIONS="xmms vertical resize"
 . "$UZBL_UTIL_DIR/uzbl-dir.sh"
 . "$UZBL_UTIL_DIR/uzbl-util.sh"
 
-[ -r "$UZBL_HISTORY_FILE" ] || exit 1
+# How many of the most frecent pages to offer (set UZBL_HISTORY_COUNT to
+# change it); 0 offers all of them.
+readonly HISTORY_COUNT="${UZBL_HISTORY_COUNT:-0}"
 
-# choose from all entries, sorted and uniqued
-if $DMENU_HAS_VERTICAL; then
-    # choose an item in reverse order, showing also the date and page titles
+# uzbl keeps an index of history_file, so ask it rather than reading the file.
+current_history () {
+    uzbl_control "history_query $HISTORY_COUNT\n" | sed -e '/^$/d'
+}
 
-    # tac: output history in reverse, awk: remove duplicate URLs, $DMENU: present to dmenu,
-    # cut: get the first three fields, awk: pick the last field
-    # As opposed to just getting the third field directly, the combination of cut+awk allows
-    # to enter a completely new URL (which would be field number 1 or $NF, but not 3).
-    goto="$( tac "$UZBL_HISTORY_FILE" | awk '!a[$3]++' | $DMENU | cut -d ' ' -f -3  | awk '{ print $NF }' )"
+if $DMENU_HAS_VERTICAL; then
+    # show the page titles as well
+    goto="$( current_history | $DMENU | cut -d ' ' -f 1 )"
 else
-    readonly current="$( tail -n 1 "$UZBL_HISTORY_FILE" | cut -d ' ' -f 3 )"
-    goto="$( ( print "$current\n"; cut -d ' ' -f 3 < "$UZBL_HISTORY_FILE" | grep -v -e "^$current\$" | sort -u ) | $DMENU )"
+    goto="$( current_history | cut -d ' ' -f 1 | $DMENU )"
 fi
 readonly goto
 
@@ -0,0 +1,668 @@
+#include "binds.h"
+
+#include "commands.h"
+#include "events.h"
+#include "setup.h"
+#include "util.h"
+#include "uzbl-core.h"
+#include "variables.h"
+
+#include <string.h>
+
+typedef struct {
+    /* Set if the bind has been removed from the mode (e.g., "-insert"). */
+    gboolean  removed;
+    /* The keys of a bind the core runs itself. For other binds, the keys
+     * which may be typed before the event manager has to see the keycmd. */
+    gchar    *keys;
+    /* The command of a bind the core runs itself. */
+    gchar    *command;
+} UzblBind;
+
+typedef struct _UzblBindNode UzblBindNode;
+
+struct _UzblBindNode {
+    /* Child nodes by the next key. */
+    GHashTable  *children;
+    /* The command of the bind which ends here, if the core runs it. */
+    const gchar *command;
+    /* Set if the keys so far may lead to a bind of the event manager. */
+    gboolean     defer;
+};
+
+struct _UzblBinds {
+    /* Binds by glob, by mode. */
+    GHashTable *modes;
+    /* Compiled binds by mode; rebuilt after binds change. */
+    GHashTable *tries;
+    /* Globs of ignored modifiers. */
+    GPtrArray  *ignored;
+
+    /* Keys held back for a bind and their modifiers. */
+    GPtrArray  *pending_keys;
+    GPtrArray  *pending_modifiers;
+
+    /* The event manager has been sent keys for its keycmd; keys go to it
+     * until it has cleared the keycmd. */
+    gboolean    deferred;
+    gboolean    keycmd_set;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+static void
+free_bind_table (gpointer data);
+static void
+free_node (gpointer data);
+
+void
+uzbl_binds_init ()
+{
+    uzbl.binds = g_malloc0 (sizeof (UzblBinds));
+
+    uzbl.binds->modes = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, free_bind_table);
+    uzbl.binds->tries = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, free_node);
+    uzbl.binds->ignored = g_ptr_array_new_with_free_func (g_free);
+    uzbl.binds->pending_keys = g_ptr_array_new_with_free_func (g_free);
+    uzbl.binds->pending_modifiers = g_ptr_array_new_with_free_func (g_free);
+}
+
+void
+uzbl_binds_free ()
+{
+    g_ptr_array_free (uzbl.binds->pending_modifiers, TRUE);
+    g_ptr_array_free (uzbl.binds->pending_keys, TRUE);
+    g_ptr_array_free (uzbl.binds->ignored, TRUE);
+    g_hash_table_destroy (uzbl.binds->tries);
+    g_hash_table_destroy (uzbl.binds->modes);
+
+    g_free (uzbl.binds);
+    uzbl.binds = NULL;
+}
+
+static void
+declare_binds (const gchar *args);
+
+void
+uzbl_binds_event (const gchar *name, const gchar *args)
+{
+    if (!g_strcmp0 (name, "MODE_BIND")) {
+        declare_binds (args);
+    } else if (!g_strcmp0 (name, "BIND")) {
+        gchar *mode_args = g_strconcat ("global ", args, NULL);
+
+        declare_binds (mode_args);
+
+        g_free (mode_args);
+    } else if (!g_strcmp0 (name, "IGNORE_KEY")) {
+        gchar *glob = g_strstrip (g_strdup (args));
+        gchar *key = g_strdup_printf ("<%s>", g_strstrip (g_strdelimit (glob, "<>", ' ')));
+
+        g_ptr_array_add (uzbl.binds->ignored, key);
+
+        g_free (glob);
+    }
+}
+
+static gboolean
+keycmd_bindable ();
+static gboolean
+modifiers_ignored (const gchar *modifiers);
+static const UzblBindNode *
+current_trie ();
+static void
+run_bind (const gchar *command);
+static void
+defer_keys ();
+
+gboolean
+uzbl_binds_key_press (const gchar *modifiers, const gchar *key)
+{
+    UzblBinds *binds = uzbl.binds;
+
+    if (!keycmd_bindable () || !modifiers_ignored (modifiers)) {
+        defer_keys ();
+        return FALSE;
+    }
+
+    const UzblBindNode *node = current_trie ();
+    guint i;
+
+    if (node->defer) {
+        node = NULL;
+    }
+
+    /* Follow the held back keys and then this one. */
+    for (i = 0; node && (i <= binds->pending_keys->len); ++i) {
+        const gchar *next = (i < binds->pending_keys->len) ?
+            g_ptr_array_index (binds->pending_keys, i) : key;
+
+        node = g_hash_table_lookup (node->children, next);
+        if (node && node->defer) {
+            node = NULL;
+        }
+    }
+
+    if (!node) {
+        defer_keys ();
+        return FALSE;
+    }
+
+    if (node->command) {
+        gchar *command = g_strdup (node->command);
+
+        g_ptr_array_set_size (binds->pending_keys, 0);
+        g_ptr_array_set_size (binds->pending_modifiers, 0);
+
+        run_bind (command);
+
+        g_free (command);
+    } else {
+        g_ptr_array_add (binds->pending_keys, g_strdup (key));
+        g_ptr_array_add (binds->pending_modifiers, g_strdup (modifiers));
+    }
+
+    return TRUE;
+}
+
+void
+uzbl_binds_flush ()
+{
+    UzblBinds *binds = uzbl.binds;
+    guint i;
+
+    if (!binds->pending_keys->len) {
+        return;
+    }
+
+    for (i = 0; i < binds->pending_keys->len; ++i) {
+        uzbl_events_send (KEY_PRESS, NULL,
+            TYPE_STR, g_ptr_array_index (binds->pending_modifiers, i),
+            TYPE_STR, g_ptr_array_index (binds->pending_keys, i),
+            NULL);
+    }
+
+    g_ptr_array_set_size (binds->pending_keys, 0);
+    g_ptr_array_set_size (binds->pending_modifiers, 0);
+
+    binds->deferred = TRUE;
+    binds->keycmd_set = FALSE;
+}
+
+void
+uzbl_binds_variable_set (const gchar *name)
+{
+    if (!uzbl.binds) {
+        return;
+    }
+
+    if (!g_strcmp0 (name, "keycmd")) {
+        uzbl.binds->keycmd_set = TRUE;
+    } else if (!g_strcmp0 (name, "mode")) {
+        /* The event manager would have had these keys in its keycmd. */
+        uzbl_binds_flush ();
+    }
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+void
+free_bind_table (gpointer data)
+{
+    g_hash_table_destroy ((GHashTable *)data);
+}
+
+void
+free_node (gpointer data)
+{
+    UzblBindNode *node = (UzblBindNode *)data;
+
+    g_hash_table_destroy (node->children);
+
+    g_free (node);
+}
+
+static GPtrArray *
+split_args (const gchar *args, GArray *ends);
+static gboolean
+valid_mode (const gchar *mode);
+static gboolean
+is_modkey_bind (const gchar *glob);
+static UzblBind *
+bind_new (const gchar *glob, const gchar *command);
+static void
+free_bind (gpointer data);
+
+void
+declare_binds (const gchar *args)
+{
+    /* "<MODE>[,<MODE>...] <GLOB...> = <COMMAND>", split like the event
+     * manager does. */
+    GArray *ends = g_array_new (FALSE, FALSE, sizeof (gsize));
+    GPtrArray *argv = split_args (args, ends);
+    guint eq;
+
+    for (eq = 1; eq < argv->len; ++eq) {
+        if (!g_strcmp0 (g_ptr_array_index (argv, eq), "=")) {
+            break;
+        }
+    }
+
+    if ((argv->len < 2) || (eq == argv->len)) {
+        g_ptr_array_free (argv, TRUE);
+        g_array_free (ends, TRUE);
+        return;
+    }
+
+    GString *glob = g_string_new ("");
+    guint i;
+
+    for (i = 1; i < eq; ++i) {
+        if (1 < i) {
+            g_string_append_c (glob, ' ');
+        }
+        g_string_append (glob, g_ptr_array_index (argv, i));
+    }
+
+    gchar *command = g_strstrip (g_strdup (args + g_array_index (ends, gsize, eq)));
+    gchar **modes = g_strsplit (g_ptr_array_index (argv, 0), ",", -1);
+    gboolean valid = TRUE;
+    gchar **mode;
+
+    for (mode = modes; *mode; ++mode) {
+        g_strstrip (*mode);
+        if (**mode && !valid_mode (*mode)) {
+            valid = FALSE;
+        }
+    }
+
+    /* Modkey binds never match the keycmd. */
+    if (valid && glob->len && !is_modkey_bind (glob->str)) {
+        gboolean removed = !*command;
+
+        for (mode = modes; *mode; ++mode) {
+            const gchar *name = *mode;
+
+            if (!*name) {
+                continue;
+            }
+
+            /* As in the event manager, the bind is removed from this mode
+             * and any which follow it. */
+            if (*name == '-') {
+                ++name;
+                removed = TRUE;
+            }
+
+            GHashTable *table = g_hash_table_lookup (uzbl.binds->modes, name);
+
+            if (!table) {
+                table = g_hash_table_new_full (g_str_hash, g_str_equal,
+                    g_free, free_bind);
+                g_hash_table_insert (uzbl.binds->modes, g_strdup (name), table);
+            }
+
+            UzblBind *bind = removed ? g_malloc0 (sizeof (UzblBind)) : bind_new (glob->str, command);
+
+            bind->removed = removed;
+            g_hash_table_replace (table, g_strdup (glob->str), bind);
+        }
+
+        g_hash_table_remove_all (uzbl.binds->tries);
+    }
+
+    g_strfreev (modes);
+    g_free (command);
+    g_string_free (glob, TRUE);
+    g_ptr_array_free (argv, TRUE);
+    g_array_free (ends, TRUE);
+}
+
+GPtrArray *
+split_args (const gchar *args, GArray *ends)
+{
+    GPtrArray *argv = g_ptr_array_new_with_free_func (g_free);
+    const gchar *p = args;
+
+    for (;;) {
+        while (g_ascii_isspace (*p)) {
+            ++p;
+        }
+
+        if (!*p) {
+            break;
+        }
+
+        GString *arg = g_string_new ("");
+        gchar quote = '\0';
+
+        for (; *p && (quote || !g_ascii_isspace (*p)); ++p) {
+            if ((*p == '\\') && p[1]) {
+                g_string_append_c (arg, *++p);
+            } else if (quote && (*p == quote)) {
+                quote = '\0';
+            } else if (!quote && ((*p == '\'') || (*p == '"'))) {
+                quote = *p;
+            } else {
+                g_string_append_c (arg, *p);
+            }
+        }
+
+        gsize end = p - args;
+
+        g_ptr_array_add (argv, g_string_free (arg, FALSE));
+        g_array_append_val (ends, end);
+    }
+
+    return argv;
+}
+
+gboolean
+valid_mode (const gchar *mode)
+{
+    if (*mode == '-') {
+        ++mode;
+    }
+
+    if (!g_ascii_isalnum (*mode)) {
+        return FALSE;
+    }
+
+    for (++mode; *mode; ++mode) {
+        if (!g_ascii_isalnum (*mode) && (*mode != '_')) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+gboolean
+is_modkey_bind (const gchar *glob)
+{
+    /* "<Mod>..." */
+    if ((glob[0] != '<') || !g_ascii_isupper (glob[1])) {
+        return FALSE;
+    }
+
+    const gchar *p;
+
+    for (p = glob + 2; g_ascii_isalnum (*p) || (*p == '-') || (*p == '_'); ++p) {
+    }
+
+    return (*p == '>');
+}
+
+static const gchar *
+find_prompt (const gchar *glob);
+
+UzblBind *
+bind_new (const gchar *glob, const gchar *command)
+{
+    UzblBind *bind = g_malloc0 (sizeof (UzblBind));
+    const gchar *prompt = find_prompt (glob);
+    gsize len = prompt ? (gsize)(prompt - glob) : strlen (glob);
+    gboolean special = len && strchr ("*_!", glob[len - 1]);
+
+    /* Binds taking arguments or run on exec, prompts and commands which need
+     * the event manager's expansions are left to it. */
+    gboolean core = !prompt && !special && !strchr (glob, ' ') &&
+                    *command && !strpbrk (command, "@%\\");
+
+    if (core) {
+        bind->keys = g_strdup (glob);
+        bind->command = g_strdup (command);
+    } else {
+        bind->keys = g_strndup (glob, (!prompt && special) ? len - 1 : len);
+    }
+
+    return bind;
+}
+
+const gchar *
+find_prompt (const gchar *glob)
+{
+    /* "<PROMPT:SET>" or "<PROMPT!COMMAND>" */
+    const gchar *open;
+
+    for (open = strchr (glob, '<'); open; open = strchr (open + 1, '<')) {
+        const gchar *close = strchr (open, '>');
+
+        if (!close) {
+            break;
+        }
+
+        const gchar *p;
+
+        for (p = open + 1; p < close; ++p) {
+            if ((*p == ':') || (*p == '!')) {
+                return open;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+void
+free_bind (gpointer data)
+{
+    UzblBind *bind = (UzblBind *)data;
+
+    g_free (bind->keys);
+    g_free (bind->command);
+
+    g_free (bind);
+}
+
+gboolean
+keycmd_bindable ()
+{
+    UzblBinds *binds = uzbl.binds;
+
+    if (!uzbl_variables_get_int ("core_binds")) {
+        return FALSE;
+    }
+
+    gchar *mode = uzbl_variables_get_string ("mode");
+    gchar *events = uzbl_variables_get_string ("keycmd_events");
+    gchar *keycmd = uzbl_variables_get_string ("keycmd");
+    gchar *prompt = uzbl_variables_get_string ("keycmd_prompt");
+
+    /* Stack binds are the event manager's, as is a keycmd it is building
+     * or prompting for. */
+    gboolean bindable = g_strcmp0 (mode, "stack") &&
+                        (!events || !*events || !g_strcmp0 (events, "1")) &&
+                        (!prompt || !*prompt);
+
+    if (bindable && binds->deferred) {
+        binds->deferred = !binds->keycmd_set || (keycmd && *keycmd);
+    }
+
+    g_free (prompt);
+    g_free (keycmd);
+    g_free (events);
+    g_free (mode);
+
+    return bindable && !binds->deferred;
+}
+
+gboolean
+modifiers_ignored (const gchar *modifiers)
+{
+    gchar **names = g_strsplit (modifiers ? modifiers : "", "|", -1);
+    gboolean ignored = TRUE;
+    gchar **name;
+
+    for (name = names; ignored && *name; ++name) {
+        if (!**name) {
+            continue;
+        }
+
+        gchar *key = g_strdup_printf ("<%s>", *name);
+        guint i;
+
+        ignored = FALSE;
+        for (i = 0; !ignored && (i < uzbl.binds->ignored->len); ++i) {
+            ignored = g_pattern_match_simple (g_ptr_array_index (uzbl.binds->ignored, i), key);
+        }
+
+        g_free (key);
+    }
+
+    g_strfreev (names);
+
+    return ignored;
+}
+
+static UzblBindNode *
+node_new ();
+static UzblBindNode *
+node_child (UzblBindNode *node, const gchar *keys, gboolean defer);
+
+const UzblBindNode *
+current_trie ()
+{
+    gchar *mode = uzbl_variables_get_string ("mode");
+
+    if (!mode || !*mode) {
+        g_free (mode);
+        mode = g_strdup ("global");
+    }
+
+    UzblBindNode *root = g_hash_table_lookup (uzbl.binds->tries, mode);
+
+    if (root) {
+        g_free (mode);
+        return root;
+    }
+
+    /* The binds of a mode override the global ones with the same glob. */
+    GHashTable *global = g_hash_table_lookup (uzbl.binds->modes, "global");
+    GHashTable *table = g_hash_table_lookup (uzbl.binds->modes, mode);
+    GHashTable *tables[] = { table, global };
+    guint t;
+
+    root = node_new ();
+
+    for (t = 0; t < G_N_ELEMENTS (tables); ++t) {
+        GHashTableIter iter;
+        gpointer key;
+        gpointer value;
+
+        if (!tables[t] || (t && (tables[t] == table))) {
+            continue;
+        }
+
+        g_hash_table_iter_init (&iter, tables[t]);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+            const UzblBind *bind = (const UzblBind *)value;
+
+            if (t && table && g_hash_table_contains (table, key)) {
+                continue;
+            }
+
+            if (bind->removed) {
+                continue;
+            }
+
+            if (bind->command) {
+                UzblBindNode *node = node_child (root, bind->keys, FALSE);
+
+                node->command = bind->command;
+            } else if (!*bind->keys) {
+                /* The event manager wants every key. */
+                root->defer = TRUE;
+            } else {
+                node_child (root, bind->keys, TRUE);
+            }
+        }
+    }
+
+    g_hash_table_insert (uzbl.binds->tries, mode, root);
+
+    return root;
+}
+
+UzblBindNode *
+node_new ()
+{
+    UzblBindNode *node = g_malloc0 (sizeof (UzblBindNode));
+
+    node->children = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, free_node);
+
+    return node;
+}
+
+UzblBindNode *
+node_child (UzblBindNode *node, const gchar *keys, gboolean defer)
+{
+    const gchar *p;
+
+    /* One node per (UTF-8) character. */
+    for (p = keys; *p; p = g_utf8_next_char (p)) {
+        gchar *key = g_strndup (p, g_utf8_next_char (p) - p);
+        UzblBindNode *child = g_hash_table_lookup (node->children, key);
+
+        if (!child) {
+            child = node_new ();
+            g_hash_table_insert (node->children, key, child);
+        } else {
+            g_free (key);
+        }
+
+        if (defer) {
+            child->defer = TRUE;
+        }
+
+        node = child;
+    }
+
+    return node;
+}
+
+static void
+bind_done (GObject *source, GAsyncResult *res, gpointer data);
+
+void
+run_bind (const gchar *command)
+{
+    /* The command is expanded asynchronously, so it has to stay around. */
+    gchar *copy = g_strdup (command);
+
+    uzbl_commands_run_string_async (copy, FALSE, bind_done, copy);
+}
+
+void
+bind_done (GObject *source, GAsyncResult *res, gpointer data)
+{
+    g_free (data);
+
+    GError *err = NULL;
+    GString *result = uzbl_commands_run_finish (source, res, &err);
+
+    if (err) {
+        uzbl_debug ("Failed to run bind: %s\n", err->message);
+        g_error_free (err);
+    }
+
+    if (result) {
+        g_string_free (result, TRUE);
+    }
+}
+
+void
+defer_keys ()
+{
+    UzblBinds *binds = uzbl.binds;
+
+    uzbl_binds_flush ();
+
+    /* The key goes to the event manager's keycmd, so the keys after it are
+     * its too until it clears the keycmd. */
+    binds->deferred = TRUE;
+    binds->keycmd_set = FALSE;
+}
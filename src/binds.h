@@ -0,0 +1,26 @@
+#ifndef UZBL_BINDS_H
+#define UZBL_BINDS_H
+
+#include <glib.h>
+
+/* Compiles the binds declared with MODE_BIND and BIND events and notes the
+ * keys ignored with IGNORE_KEY. The events are still sent so the event
+ * manager keeps every bind. */
+void
+uzbl_binds_event (const gchar *name, const gchar *args);
+
+/* Matches a key typed into the keycmd against the binds of the current mode.
+ * Returns TRUE if the key is held back for or runs a bind which the core can
+ * run itself; otherwise the key is for the event manager. */
+gboolean
+uzbl_binds_key_press (const gchar *modifiers, const gchar *key);
+/* Sends the keys held back for a bind on to the event manager. Called before
+ * any other key event so that it sees keys in order. */
+void
+uzbl_binds_flush ();
+
+/* Follows the mode and keycmd variables. */
+void
+uzbl_binds_variable_set (const gchar *name);
+
+#endif
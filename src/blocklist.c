@@ -0,0 +1,725 @@
+#include "blocklist.h"
+
+#include <string.h>
+
+/* Matches the end of a URL or a character which may not appear in a host
+ * name or path component (the '^' placeholder). */
+#define SEPARATOR_REGEX "(?:[^a-z0-9_.%-]|$)"
+/* Matches the scheme and any subdomains (the '||' anchor). */
+#define DOMAIN_ANCHOR_REGEX "^[a-z][a-z0-9+.-]*://(?:[^/?#]*\\.)?"
+/* Regular expression rules are joined into alternations of at most this
+ * many rules so a single huge pattern can't exceed PCRE's limits. */
+#define REGEX_CHUNK_SIZE 256
+
+typedef struct _DomainNode DomainNode;
+
+/* Host names are stored label by label from the top-level domain down so
+ * that a rule for "example.com" also matches "ads.example.com". */
+struct _DomainNode {
+    GHashTable *children;
+    gboolean    terminal;
+};
+
+typedef struct {
+    guint8 byte;
+    guint  next;
+} AcEdge;
+
+/* A state in the Aho-Corasick automaton. State 0 is the root and is never
+ * the target of an edge, so 0 doubles as "no transition". */
+typedef struct {
+    GArray   *edges;
+    guint     fail;
+    gboolean  output;
+} AcNode;
+
+typedef struct {
+    /* Rule sources, kept so the matchers can be rebuilt. */
+    GPtrArray *domains;
+    GPtrArray *substrings;
+    GPtrArray *regexes;
+
+    /* Compiled matchers. */
+    DomainNode *domain_root;
+    GArray     *ac_nodes;
+    guint       ac_root[256];
+    GPtrArray  *compiled_regexes;
+} RuleSet;
+
+struct _UzblBlocklist {
+    RuleSet  block;
+    /* Exception ("@@") rules, which override the block rules. */
+    RuleSet  allow;
+    guint    rule_count;
+    gboolean dirty;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+static void
+rule_set_init (RuleSet *set);
+
+UzblBlocklist *
+uzbl_blocklist_new ()
+{
+    UzblBlocklist *blocklist = g_malloc0 (sizeof (UzblBlocklist));
+
+    rule_set_init (&blocklist->block);
+    rule_set_init (&blocklist->allow);
+
+    return blocklist;
+}
+
+static void
+rule_set_free (RuleSet *set);
+
+void
+uzbl_blocklist_free (UzblBlocklist *blocklist)
+{
+    if (!blocklist) {
+        return;
+    }
+
+    rule_set_free (&blocklist->block);
+    rule_set_free (&blocklist->allow);
+
+    g_free (blocklist);
+}
+
+static gboolean
+parse_rule (UzblBlocklist *blocklist, const gchar *rule);
+static void
+rule_set_clear (RuleSet *set);
+
+gboolean
+uzbl_blocklist_add_rule (UzblBlocklist *blocklist, const gchar *rule)
+{
+    gchar *line = g_strstrip (g_strdup (rule));
+    gboolean added = parse_rule (blocklist, line);
+
+    g_free (line);
+
+    if (added) {
+        ++blocklist->rule_count;
+        blocklist->dirty = TRUE;
+    }
+
+    return added;
+}
+
+gboolean
+uzbl_blocklist_load_file (UzblBlocklist *blocklist, const gchar *path, GError **error)
+{
+    gchar *contents;
+
+    if (!g_file_get_contents (path, &contents, NULL, error)) {
+        return FALSE;
+    }
+
+    gchar **lines = g_strsplit (contents, "\n", 0);
+    gchar **line;
+
+    for (line = lines; *line; ++line) {
+        uzbl_blocklist_add_rule (blocklist, *line);
+    }
+
+    g_strfreev (lines);
+    g_free (contents);
+
+    return TRUE;
+}
+
+void
+uzbl_blocklist_clear (UzblBlocklist *blocklist)
+{
+    rule_set_clear (&blocklist->block);
+    rule_set_clear (&blocklist->allow);
+    blocklist->rule_count = 0;
+    blocklist->dirty = TRUE;
+}
+
+guint
+uzbl_blocklist_size (UzblBlocklist *blocklist)
+{
+    return blocklist->rule_count;
+}
+
+static void
+rule_set_compile (RuleSet *set);
+static gboolean
+rule_set_match (RuleSet *set, const gchar *uri);
+
+gboolean
+uzbl_blocklist_match (UzblBlocklist *blocklist, const gchar *uri)
+{
+    if (!blocklist->rule_count || !uri) {
+        return FALSE;
+    }
+
+    if (blocklist->dirty) {
+        rule_set_compile (&blocklist->block);
+        rule_set_compile (&blocklist->allow);
+        blocklist->dirty = FALSE;
+    }
+
+    /* Most requests match no block rule, so only consult the exceptions
+     * once one does. */
+    if (!rule_set_match (&blocklist->block, uri)) {
+        return FALSE;
+    }
+
+    return !rule_set_match (&blocklist->allow, uri);
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+static gboolean
+is_host_name (const gchar *str);
+static gchar *
+pattern_to_regex (const gchar *pattern);
+static gboolean
+add_regex (RuleSet *set, gchar *regex);
+
+gboolean
+parse_rule (UzblBlocklist *blocklist, const gchar *rule)
+{
+    RuleSet *set = &blocklist->block;
+    gsize len = strlen (rule);
+
+    /* Comments and list headers. */
+    if (!len || (*rule == '!') || (*rule == '[')) {
+        return FALSE;
+    }
+
+    /* Element hiding rules apply to page content, not requests. */
+    if (strstr (rule, "##") || strstr (rule, "#@#") || strstr (rule, "#?#")) {
+        return FALSE;
+    }
+
+    /* Exceptions use the same syntax as block rules. */
+    if (g_str_has_prefix (rule, "@@")) {
+        set = &blocklist->allow;
+        rule += 2;
+        len -= 2;
+    }
+
+    /* Literal regular expressions. */
+    if ((len > 2) && (rule[0] == '/') && (rule[len - 1] == '/')) {
+        return add_regex (set, g_strndup (rule + 1, len - 2));
+    }
+
+    /* Options (request types, domains, ...) can't be honoured. Skipping a
+     * block rule errs on the side of not blocking, but skipping an exception
+     * errs on the side of blocking. */
+    if (!len || strchr (rule, '$')) {
+        g_debug ("skipping unsupported block rule: %s", rule);
+        return FALSE;
+    }
+
+    if (g_str_has_prefix (rule, "||")) {
+        gchar *host = g_ascii_strdown (rule + 2, -1);
+        gsize host_len = strlen (host);
+
+        if (host_len && ((host[host_len - 1] == '^') || (host[host_len - 1] == '/'))) {
+            host[host_len - 1] = '\0';
+        }
+
+        if (is_host_name (host)) {
+            g_ptr_array_add (set->domains, host);
+            return TRUE;
+        }
+
+        g_free (host);
+    } else {
+        /* Leading and trailing wildcards don't change what matches. */
+        const gchar *start = rule;
+        const gchar *end = rule + len;
+
+        while ((start < end) && (*start == '*')) {
+            ++start;
+        }
+        while ((end > start) && (end[-1] == '*')) {
+            --end;
+        }
+
+        if ((start < end) && !strpbrk (start, "*^|")) {
+            g_ptr_array_add (set->substrings, g_ascii_strdown (start, end - start));
+            return TRUE;
+        }
+    }
+
+    return add_regex (set, pattern_to_regex (rule));
+}
+
+gboolean
+is_host_name (const gchar *str)
+{
+    if (!*str) {
+        return FALSE;
+    }
+
+    for (; *str; ++str) {
+        if (!g_ascii_isalnum (*str) && (*str != '.') && (*str != '-')) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+gchar *
+pattern_to_regex (const gchar *pattern)
+{
+    GString *regex = g_string_new ("");
+    const gchar *p = pattern;
+    const gchar *end = pattern + strlen (pattern);
+
+    if (g_str_has_prefix (p, "||")) {
+        g_string_append (regex, DOMAIN_ANCHOR_REGEX);
+        p += 2;
+    } else if (*p == '|') {
+        g_string_append_c (regex, '^');
+        ++p;
+    }
+
+    gboolean anchor_end = ((end > p) && (end[-1] == '|'));
+    if (anchor_end) {
+        --end;
+    }
+
+    for (; p < end; ++p) {
+        switch (*p) {
+        case '*':
+            g_string_append (regex, ".*");
+            break;
+        case '^':
+            g_string_append (regex, SEPARATOR_REGEX);
+            break;
+        default:
+            /* Escaping any other ASCII punctuation is always safe. */
+            if (!g_ascii_isalnum (*p) && !((guchar)*p & 0x80)) {
+                g_string_append_c (regex, '\\');
+            }
+            g_string_append_c (regex, *p);
+            break;
+        }
+    }
+
+    if (anchor_end) {
+        g_string_append_c (regex, '$');
+    }
+
+    return g_string_free (regex, FALSE);
+}
+
+gboolean
+add_regex (RuleSet *set, gchar *regex)
+{
+    GError *err = NULL;
+    GRegex *compiled = g_regex_new (regex, G_REGEX_CASELESS, 0, &err);
+
+    if (!compiled) {
+        g_warning ("invalid block rule regex '%s': %s", regex, err->message);
+        g_error_free (err);
+        g_free (regex);
+        return FALSE;
+    }
+
+    g_regex_unref (compiled);
+    g_ptr_array_add (set->regexes, regex);
+
+    return TRUE;
+}
+
+void
+rule_set_init (RuleSet *set)
+{
+    set->domains = g_ptr_array_new_with_free_func (g_free);
+    set->substrings = g_ptr_array_new_with_free_func (g_free);
+    set->regexes = g_ptr_array_new_with_free_func (g_free);
+}
+
+static void
+free_compiled (RuleSet *set);
+
+void
+rule_set_free (RuleSet *set)
+{
+    free_compiled (set);
+
+    g_ptr_array_unref (set->domains);
+    g_ptr_array_unref (set->substrings);
+    g_ptr_array_unref (set->regexes);
+}
+
+void
+rule_set_clear (RuleSet *set)
+{
+    g_ptr_array_set_size (set->domains, 0);
+    g_ptr_array_set_size (set->substrings, 0);
+    g_ptr_array_set_size (set->regexes, 0);
+}
+
+static DomainNode *
+domain_node_new ();
+static void
+domain_node_free (gpointer data);
+static void
+domain_insert (DomainNode *root, const gchar *host);
+static void
+ac_build (RuleSet *set);
+static void
+compile_regexes (RuleSet *set, guint first, guint count);
+
+void
+rule_set_compile (RuleSet *set)
+{
+    guint i;
+
+    free_compiled (set);
+
+    if (set->domains->len) {
+        set->domain_root = domain_node_new ();
+        for (i = 0; i < set->domains->len; ++i) {
+            domain_insert (set->domain_root, g_ptr_array_index (set->domains, i));
+        }
+    }
+
+    if (set->substrings->len) {
+        ac_build (set);
+    }
+
+    if (set->regexes->len) {
+        set->compiled_regexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_regex_unref);
+
+        /* One alternation is much faster than trying each in turn. */
+        for (i = 0; i < set->regexes->len; i += REGEX_CHUNK_SIZE) {
+            compile_regexes (set, i, MIN (REGEX_CHUNK_SIZE, set->regexes->len - i));
+        }
+    }
+}
+
+static gboolean
+domain_match (DomainNode *root, const gchar *uri);
+static gboolean
+ac_match (RuleSet *set, const gchar *uri);
+
+gboolean
+rule_set_match (RuleSet *set, const gchar *uri)
+{
+    /* Cheapest first. */
+    if (set->domain_root && domain_match (set->domain_root, uri)) {
+        return TRUE;
+    }
+
+    if (set->ac_nodes && ac_match (set, uri)) {
+        return TRUE;
+    }
+
+    if (set->compiled_regexes) {
+        guint i;
+        for (i = 0; i < set->compiled_regexes->len; ++i) {
+            if (g_regex_match (g_ptr_array_index (set->compiled_regexes, i), uri, 0, NULL)) {
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+void
+compile_regexes (RuleSet *set, guint first, guint count)
+{
+    GString *combined = g_string_new ("");
+    GError *err = NULL;
+    GRegex *regex;
+    guint i;
+
+    for (i = 0; i < count; ++i) {
+        g_string_append_printf (combined, "%s(?:%s)",
+                                i ? "|" : "",
+                                (const gchar *)g_ptr_array_index (set->regexes, first + i));
+    }
+
+    regex = g_regex_new (combined->str, G_REGEX_CASELESS | G_REGEX_OPTIMIZE, 0, &err);
+    g_string_free (combined, TRUE);
+
+    if (regex) {
+        g_ptr_array_add (set->compiled_regexes, regex);
+        return;
+    }
+
+    /* Each rule compiled on its own when it was added, so only the
+     * combination is at fault; fall back to matching them one by one. */
+    g_debug ("failed to combine block rules: %s", err->message);
+    g_clear_error (&err);
+
+    for (i = 0; i < count; ++i) {
+        const gchar *rule = g_ptr_array_index (set->regexes, first + i);
+
+        if ((regex = g_regex_new (rule, G_REGEX_CASELESS, 0, &err))) {
+            g_ptr_array_add (set->compiled_regexes, regex);
+        } else {
+            g_warning ("failed to compile block rule '%s': %s", rule, err->message);
+            g_clear_error (&err);
+        }
+    }
+}
+
+void
+free_compiled (RuleSet *set)
+{
+    if (set->domain_root) {
+        domain_node_free (set->domain_root);
+        set->domain_root = NULL;
+    }
+
+    if (set->ac_nodes) {
+        guint i;
+        for (i = 0; i < set->ac_nodes->len; ++i) {
+            g_array_free (g_array_index (set->ac_nodes, AcNode, i).edges, TRUE);
+        }
+        g_array_free (set->ac_nodes, TRUE);
+        set->ac_nodes = NULL;
+    }
+
+    if (set->compiled_regexes) {
+        g_ptr_array_unref (set->compiled_regexes);
+        set->compiled_regexes = NULL;
+    }
+}
+
+DomainNode *
+domain_node_new ()
+{
+    DomainNode *node = g_slice_new (DomainNode);
+
+    node->children = NULL;
+    node->terminal = FALSE;
+
+    return node;
+}
+
+void
+domain_node_free (gpointer data)
+{
+    DomainNode *node = (DomainNode *)data;
+
+    if (node->children) {
+        g_hash_table_destroy (node->children);
+    }
+
+    g_slice_free (DomainNode, node);
+}
+
+void
+domain_insert (DomainNode *root, const gchar *host)
+{
+    gchar **labels = g_strsplit (host, ".", 0);
+    guint count = g_strv_length (labels);
+    DomainNode *node = root;
+
+    while (count--) {
+        const gchar *label = labels[count];
+        DomainNode *child;
+
+        if (!*label) {
+            continue;
+        }
+
+        if (!node->children) {
+            node->children = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, domain_node_free);
+        }
+
+        if (!(child = g_hash_table_lookup (node->children, label))) {
+            child = domain_node_new ();
+            g_hash_table_insert (node->children, g_strdup (label), child);
+        }
+
+        node = child;
+    }
+
+    if (node != root) {
+        node->terminal = TRUE;
+    }
+
+    g_strfreev (labels);
+}
+
+gboolean
+domain_match (DomainNode *root, const gchar *uri)
+{
+    const gchar *start = strstr (uri, "://");
+
+    if (!start) {
+        return FALSE;
+    }
+    start += 3;
+
+    const gchar *end = start + strcspn (start, "/?#");
+    const gchar *at = memchr (start, '@', end - start);
+
+    if (at) {
+        start = at + 1;
+    }
+
+    /* IPv6 literals are left to the other matchers. */
+    if (*start == '[') {
+        return FALSE;
+    }
+
+    const gchar *colon = memchr (start, ':', end - start);
+    if (colon) {
+        end = colon;
+    }
+
+    gchar *host = g_ascii_strdown (start, end - start);
+    gchar *label_end = host + strlen (host);
+    DomainNode *node = root;
+    gboolean matched = FALSE;
+
+    /* Walk the labels from the right, cutting the host up as we go. */
+    while (node->children && (label_end > host)) {
+        gchar *label = label_end;
+
+        while ((label > host) && (label[-1] != '.')) {
+            --label;
+        }
+
+        *label_end = '\0';
+        if (!(node = g_hash_table_lookup (node->children, label))) {
+            break;
+        }
+
+        if (node->terminal) {
+            matched = TRUE;
+            break;
+        }
+
+        label_end = (label > host) ? label - 1 : host;
+    }
+
+    g_free (host);
+
+    return matched;
+}
+
+static guint
+ac_goto (RuleSet *set, guint state, guint8 byte);
+
+void
+ac_build (RuleSet *set)
+{
+    GArray *nodes = g_array_new (FALSE, TRUE, sizeof (AcNode));
+    AcNode root = { g_array_new (FALSE, FALSE, sizeof (AcEdge)), 0, FALSE };
+    guint i;
+
+    g_array_append_val (nodes, root);
+    set->ac_nodes = nodes;
+    memset (set->ac_root, 0, sizeof (set->ac_root));
+
+    /* Build the trie of patterns. */
+    for (i = 0; i < set->substrings->len; ++i) {
+        const guint8 *p = g_ptr_array_index (set->substrings, i);
+        guint state = 0;
+
+        for (; *p; ++p) {
+            guint next = ac_goto (set, state, *p);
+
+            if (!next) {
+                AcNode node = { g_array_new (FALSE, FALSE, sizeof (AcEdge)), 0, FALSE };
+                AcEdge edge = { *p, nodes->len };
+
+                next = nodes->len;
+                g_array_append_val (nodes, node);
+
+                if (state) {
+                    g_array_append_val (g_array_index (nodes, AcNode, state).edges, edge);
+                } else {
+                    set->ac_root[*p] = next;
+                }
+            }
+
+            state = next;
+        }
+
+        g_array_index (nodes, AcNode, state).output = TRUE;
+    }
+
+    /* Fill in failure links breadth first. */
+    GQueue queue = G_QUEUE_INIT;
+
+    for (i = 0; i < G_N_ELEMENTS (set->ac_root); ++i) {
+        if (set->ac_root[i]) {
+            g_queue_push_tail (&queue, GUINT_TO_POINTER (set->ac_root[i]));
+        }
+    }
+
+    while (!g_queue_is_empty (&queue)) {
+        guint state = GPOINTER_TO_UINT (g_queue_pop_head (&queue));
+        GArray *edges = g_array_index (nodes, AcNode, state).edges;
+        guint j;
+
+        for (j = 0; j < edges->len; ++j) {
+            AcEdge *edge = &g_array_index (edges, AcEdge, j);
+            guint fail = g_array_index (nodes, AcNode, state).fail;
+            guint target;
+
+            while (!(target = ac_goto (set, fail, edge->byte)) && fail) {
+                fail = g_array_index (nodes, AcNode, fail).fail;
+            }
+
+            AcNode *child = &g_array_index (nodes, AcNode, edge->next);
+            child->fail = target;
+            child->output = child->output || g_array_index (nodes, AcNode, target).output;
+
+            g_queue_push_tail (&queue, GUINT_TO_POINTER (edge->next));
+        }
+    }
+}
+
+guint
+ac_goto (RuleSet *set, guint state, guint8 byte)
+{
+    if (!state) {
+        return set->ac_root[byte];
+    }
+
+    GArray *edges = g_array_index (set->ac_nodes, AcNode, state).edges;
+    guint i;
+
+    for (i = 0; i < edges->len; ++i) {
+        AcEdge *edge = &g_array_index (edges, AcEdge, i);
+        if (edge->byte == byte) {
+            return edge->next;
+        }
+    }
+
+    return 0;
+}
+
+gboolean
+ac_match (RuleSet *set, const gchar *uri)
+{
+    const gchar *p;
+    guint state = 0;
+
+    for (p = uri; *p; ++p) {
+        guint8 byte = g_ascii_tolower (*p);
+        guint next;
+
+        while (!(next = ac_goto (set, state, byte)) && state) {
+            state = g_array_index (set->ac_nodes, AcNode, state).fail;
+        }
+
+        state = next;
+
+        if (g_array_index (set->ac_nodes, AcNode, state).output) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
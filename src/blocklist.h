@@ -0,0 +1,29 @@
+#ifndef UZBL_BLOCKLIST_H
+#define UZBL_BLOCKLIST_H
+
+#include <glib.h>
+
+/* A set of URL blocking and exception rules in (a subset of) the Adblock
+ * Plus filter syntax. Rules are compiled on the first match after they
+ * change. */
+typedef struct _UzblBlocklist UzblBlocklist;
+
+UzblBlocklist *
+uzbl_blocklist_new ();
+void
+uzbl_blocklist_free (UzblBlocklist *blocklist);
+
+gboolean
+uzbl_blocklist_add_rule (UzblBlocklist *blocklist, const gchar *rule);
+gboolean
+uzbl_blocklist_load_file (UzblBlocklist *blocklist, const gchar *path, GError **error);
+void
+uzbl_blocklist_clear (UzblBlocklist *blocklist);
+
+guint
+uzbl_blocklist_size (UzblBlocklist *blocklist);
+
+gboolean
+uzbl_blocklist_match (UzblBlocklist *blocklist, const gchar *uri);
+
+#endif
@@ -0,0 +1,682 @@
+#include "bookmarks.h"
+
+#include "setup.h"
+#include "util.h"
+#include "uzbl-core.h"
+#include "variables.h"
+
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Marks a bookmark as removed: "#removed\tURI". */
+#define REMOVED_PREFIX "#removed\t"
+
+/* The file is rewritten once it has more outdated lines than bookmarks. */
+#define COMPACT_MIN_STALE 64
+
+typedef struct {
+    gchar  *uri;
+    gchar  *title;
+    /* Sorted without duplicates. */
+    gchar **tags;
+} UzblBookmark;
+
+struct _UzblBookmarks {
+    /* The file the store has been read from. Records are only ever appended
+     * to it (a later record for a URI replaces earlier ones), so the store is
+     * kept up to date by reading whatever follows the offset. */
+    gchar      *path;
+    ino_t       inode;
+    dev_t       device;
+    gsize       offset;
+    /* Lines in the file which no longer describe a bookmark. */
+    guint       stale;
+
+    GHashTable *by_uri;
+    /* Sets of bookmarks by tag. */
+    GHashTable *by_tag;
+    /* Bookmarks sorted by URI for prefix searches; rebuilt when needed. */
+    GPtrArray  *sorted;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+void
+uzbl_bookmarks_init ()
+{
+    uzbl.bookmarks = g_malloc0 (sizeof (UzblBookmarks));
+}
+
+static void
+free_store ();
+
+void
+uzbl_bookmarks_free ()
+{
+    free_store ();
+
+    g_free (uzbl.bookmarks);
+    uzbl.bookmarks = NULL;
+}
+
+static int
+open_locked (const gchar *path);
+static void
+update_store (const gchar *path);
+static gchar *
+format_record (const UzblBookmark *bookmark);
+static gchar **
+merge_tags (gchar * const *tags, const gchar * const *more);
+static gboolean
+append_line (int fd, const gchar *path, const gchar *line);
+static void
+maybe_compact (const gchar *path);
+
+gboolean
+uzbl_bookmarks_add (const gchar *uri, const gchar *title, const gchar * const *tags)
+{
+    gchar *path = uzbl_variables_get_string ("bookmarks_file");
+    gboolean ok = FALSE;
+
+    if (!path || !*path || !uri || !*uri) {
+        g_free (path);
+        return FALSE;
+    }
+
+    /* Other instances may share the file; hold the lock from reading the
+     * current record until the new one has been written. */
+    int fd = open_locked (path);
+    if (0 <= fd) {
+        update_store (path);
+
+        const UzblBookmark *current = g_hash_table_lookup (uzbl.bookmarks->by_uri, uri);
+        UzblBookmark bookmark;
+        static gchar *no_tags[] = { NULL };
+
+        bookmark.uri = g_strdelimit (g_strdup (uri), "\t\r\n", ' ');
+        bookmark.title = g_strdelimit (g_strdup ((title && *title) ? title :
+                                                 current ? current->title : ""), "\t\r\n", ' ');
+        bookmark.tags = merge_tags (current ? current->tags : no_tags, tags);
+
+        gchar *line = format_record (&bookmark);
+
+        ok = append_line (fd, path, line);
+        if (ok) {
+            update_store (path);
+            maybe_compact (path);
+        }
+
+        g_free (line);
+        g_free (bookmark.uri);
+        g_free (bookmark.title);
+        g_strfreev (bookmark.tags);
+
+        close (fd);
+    }
+
+    g_free (path);
+
+    return ok;
+}
+
+gboolean
+uzbl_bookmarks_remove (const gchar *uri)
+{
+    gchar *path = uzbl_variables_get_string ("bookmarks_file");
+    gboolean ok = FALSE;
+
+    if (!path || !*path || !uri) {
+        g_free (path);
+        return FALSE;
+    }
+
+    int fd = open_locked (path);
+    if (0 <= fd) {
+        update_store (path);
+
+        if (g_hash_table_contains (uzbl.bookmarks->by_uri, uri)) {
+            gchar *line = g_strconcat (REMOVED_PREFIX, uri, NULL);
+
+            ok = append_line (fd, path, line);
+            if (ok) {
+                update_store (path);
+                maybe_compact (path);
+            }
+
+            g_free (line);
+        }
+
+        close (fd);
+    }
+
+    g_free (path);
+
+    return ok;
+}
+
+static void
+load_store ();
+static gint
+compare_bookmarks (gconstpointer a, gconstpointer b);
+
+void
+uzbl_bookmarks_tagged (const gchar * const *tags, GString *result)
+{
+    load_store ();
+
+    if (!uzbl.bookmarks->by_uri || !tags || !*tags) {
+        return;
+    }
+
+    /* Only the bookmarks with the rarest tag need to be checked. */
+    GHashTable *smallest = NULL;
+    const gchar * const *tag;
+
+    for (tag = tags; *tag; ++tag) {
+        GHashTable *set = g_hash_table_lookup (uzbl.bookmarks->by_tag, *tag);
+
+        if (!set) {
+            return;
+        }
+
+        if (!smallest || (g_hash_table_size (set) < g_hash_table_size (smallest))) {
+            smallest = set;
+        }
+    }
+
+    GPtrArray *matches = g_ptr_array_new ();
+    GHashTableIter iter;
+    gpointer key;
+
+    g_hash_table_iter_init (&iter, smallest);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        gboolean match = TRUE;
+
+        for (tag = tags; match && *tag; ++tag) {
+            GHashTable *set = g_hash_table_lookup (uzbl.bookmarks->by_tag, *tag);
+
+            match = (set == smallest) || g_hash_table_contains (set, key);
+        }
+
+        if (match) {
+            g_ptr_array_add (matches, key);
+        }
+    }
+
+    g_ptr_array_sort (matches, compare_bookmarks);
+
+    guint i;
+    for (i = 0; i < matches->len; ++i) {
+        gchar *line = format_record (g_ptr_array_index (matches, i));
+
+        g_string_append (result, line);
+        g_string_append_c (result, '\n');
+        g_free (line);
+    }
+
+    g_ptr_array_free (matches, TRUE);
+}
+
+static void
+sort_store ();
+
+void
+uzbl_bookmarks_prefix (const gchar *prefix, GString *result)
+{
+    load_store ();
+
+    if (!uzbl.bookmarks->by_uri || !prefix) {
+        return;
+    }
+
+    sort_store ();
+
+    GPtrArray *sorted = uzbl.bookmarks->sorted;
+    gsize len = strlen (prefix);
+    guint low = 0;
+    guint high = sorted->len;
+
+    /* Find the first URI not before the prefix; all matches follow it. */
+    while (low < high) {
+        guint mid = low + (high - low) / 2;
+        const UzblBookmark *bookmark = g_ptr_array_index (sorted, mid);
+
+        if (strcmp (bookmark->uri, prefix) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    for (; low < sorted->len; ++low) {
+        const UzblBookmark *bookmark = g_ptr_array_index (sorted, low);
+
+        if (strncmp (bookmark->uri, prefix, len)) {
+            break;
+        }
+
+        gchar *line = format_record (bookmark);
+
+        g_string_append (result, line);
+        g_string_append_c (result, '\n');
+        g_free (line);
+    }
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+static void
+free_bookmark (gpointer data);
+static void
+free_tag_set (gpointer data);
+
+void
+free_store ()
+{
+    if (uzbl.bookmarks->by_uri) {
+        if (uzbl.bookmarks->sorted) {
+            g_ptr_array_free (uzbl.bookmarks->sorted, TRUE);
+        }
+        g_hash_table_destroy (uzbl.bookmarks->by_tag);
+        g_hash_table_destroy (uzbl.bookmarks->by_uri);
+    }
+
+    g_free (uzbl.bookmarks->path);
+    uzbl.bookmarks->path = NULL;
+    uzbl.bookmarks->offset = 0;
+    uzbl.bookmarks->stale = 0;
+    uzbl.bookmarks->by_uri = NULL;
+    uzbl.bookmarks->by_tag = NULL;
+    uzbl.bookmarks->sorted = NULL;
+}
+
+void
+load_store ()
+{
+    gchar *path = uzbl_variables_get_string ("bookmarks_file");
+
+    if (path && *path) {
+        update_store (path);
+    } else {
+        free_store ();
+    }
+
+    g_free (path);
+}
+
+int
+open_locked (const gchar *path)
+{
+    for (;;) {
+        int fd = g_open (path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+
+        if (fd < 0) {
+            uzbl_debug ("Failed to open bookmarks: %s: %s\n", path, g_strerror (errno));
+            return -1;
+        }
+
+        while (flock (fd, LOCK_EX)) {
+            if (errno != EINTR) {
+                uzbl_debug ("Failed to lock bookmarks: %s: %s\n", path, g_strerror (errno));
+                close (fd);
+                return -1;
+            }
+        }
+
+        /* The file may have been compacted (replaced) while waiting. */
+        struct stat locked;
+        GStatBuf current;
+
+        if (!fstat (fd, &locked) && !g_stat (path, &current) &&
+            (locked.st_ino == current.st_ino) && (locked.st_dev == current.st_dev)) {
+            return fd;
+        }
+
+        close (fd);
+    }
+}
+
+static void
+apply_line (const gchar *line);
+
+void
+update_store (const gchar *path)
+{
+    GStatBuf buf;
+
+    if (g_stat (path, &buf)) {
+        buf.st_size = 0;
+        buf.st_ino = 0;
+        buf.st_dev = 0;
+    }
+
+    /* Start over for a new file or one which has been replaced or
+     * truncated. */
+    if (!uzbl.bookmarks->by_uri ||
+        g_strcmp0 (path, uzbl.bookmarks->path) ||
+        (buf.st_ino != uzbl.bookmarks->inode) ||
+        (buf.st_dev != uzbl.bookmarks->device) ||
+        ((gsize)buf.st_size < uzbl.bookmarks->offset)) {
+        free_store ();
+
+        uzbl.bookmarks->path = g_strdup (path);
+        uzbl.bookmarks->inode = buf.st_ino;
+        uzbl.bookmarks->device = buf.st_dev;
+        uzbl.bookmarks->by_uri = g_hash_table_new_full (g_str_hash, g_str_equal,
+            NULL, free_bookmark);
+        uzbl.bookmarks->by_tag = g_hash_table_new_full (g_str_hash, g_str_equal,
+            g_free, free_tag_set);
+    }
+
+    if ((gsize)buf.st_size <= uzbl.bookmarks->offset) {
+        return;
+    }
+
+    GError *err = NULL;
+    GMappedFile *file = g_mapped_file_new (path, FALSE, &err);
+
+    if (!file) {
+        uzbl_debug ("Failed to read bookmarks: %s\n", err->message);
+        g_error_free (err);
+        return;
+    }
+
+    /* Only complete lines are read; the rest is read next time. */
+    const gchar *contents = g_mapped_file_get_contents (file);
+    const gchar *end = contents + g_mapped_file_get_length (file);
+    const gchar *line = contents + uzbl.bookmarks->offset;
+    const gchar *eol;
+
+    while ((line < end) && (eol = memchr (line, '\n', end - line))) {
+        gchar *record = g_strndup (line, eol - line);
+
+        apply_line (record);
+
+        g_free (record);
+        line = eol + 1;
+    }
+
+    uzbl.bookmarks->offset = line - contents;
+
+    g_mapped_file_unref (file);
+}
+
+static void
+index_tags (UzblBookmark *bookmark);
+static void
+unindex_tags (UzblBookmark *bookmark);
+
+void
+apply_line (const gchar *line)
+{
+    UzblBookmarks *store = uzbl.bookmarks;
+
+    if (g_str_has_prefix (line, REMOVED_PREFIX)) {
+        UzblBookmark *bookmark = g_hash_table_lookup (store->by_uri, line + strlen (REMOVED_PREFIX));
+
+        /* Both the marker and the record it removes are outdated now. */
+        if (bookmark) {
+            unindex_tags (bookmark);
+            g_hash_table_remove (store->by_uri, bookmark->uri);
+            store->stale += 2;
+
+            if (store->sorted) {
+                g_ptr_array_free (store->sorted, TRUE);
+                store->sorted = NULL;
+            }
+        } else {
+            ++store->stale;
+        }
+
+        return;
+    }
+
+    if (!*line || (*line == '#')) {
+        ++store->stale;
+        return;
+    }
+
+    /* "URI\tTITLE\tTAGS" */
+    gchar **fields = g_strsplit (line, "\t", 3);
+    gchar **words = g_strsplit ((fields[1] && fields[2]) ? fields[2] : "", " ", -1);
+    const gchar *uri = fields[0];
+    static gchar *no_tags[] = { NULL };
+
+    UzblBookmark *bookmark = g_hash_table_lookup (store->by_uri, uri);
+
+    if (bookmark) {
+        unindex_tags (bookmark);
+        g_free (bookmark->title);
+        g_strfreev (bookmark->tags);
+        ++store->stale;
+    } else {
+        bookmark = g_malloc0 (sizeof (UzblBookmark));
+        bookmark->uri = g_strdup (uri);
+        g_hash_table_insert (store->by_uri, bookmark->uri, bookmark);
+
+        if (store->sorted) {
+            g_ptr_array_free (store->sorted, TRUE);
+            store->sorted = NULL;
+        }
+    }
+
+    bookmark->title = g_strdup (fields[1] ? fields[1] : "");
+    bookmark->tags = merge_tags (no_tags, (const gchar * const *)words);
+    index_tags (bookmark);
+
+    g_strfreev (words);
+    g_strfreev (fields);
+}
+
+void
+index_tags (UzblBookmark *bookmark)
+{
+    gchar **tag;
+
+    for (tag = bookmark->tags; *tag; ++tag) {
+        GHashTable *set = g_hash_table_lookup (uzbl.bookmarks->by_tag, *tag);
+
+        if (!set) {
+            set = g_hash_table_new (g_direct_hash, g_direct_equal);
+            g_hash_table_insert (uzbl.bookmarks->by_tag, g_strdup (*tag), set);
+        }
+
+        g_hash_table_add (set, bookmark);
+    }
+}
+
+void
+unindex_tags (UzblBookmark *bookmark)
+{
+    gchar **tag;
+
+    for (tag = bookmark->tags; *tag; ++tag) {
+        GHashTable *set = g_hash_table_lookup (uzbl.bookmarks->by_tag, *tag);
+
+        if (!set) {
+            continue;
+        }
+
+        g_hash_table_remove (set, bookmark);
+        if (!g_hash_table_size (set)) {
+            g_hash_table_remove (uzbl.bookmarks->by_tag, *tag);
+        }
+    }
+}
+
+static gint
+compare_strings (gconstpointer a, gconstpointer b);
+
+gchar **
+merge_tags (gchar * const *tags, const gchar * const *more)
+{
+    GPtrArray *all = g_ptr_array_new ();
+    guint i;
+
+    for (i = 0; tags && tags[i]; ++i) {
+        g_ptr_array_add (all, tags[i]);
+    }
+    for (i = 0; more && more[i]; ++i) {
+        if (*more[i]) {
+            g_ptr_array_add (all, (gpointer)more[i]);
+        }
+    }
+
+    g_ptr_array_sort (all, compare_strings);
+
+    GPtrArray *merged = g_ptr_array_sized_new (all->len + 1);
+
+    for (i = 0; i < all->len; ++i) {
+        const gchar *tag = g_ptr_array_index (all, i);
+
+        if (!i || strcmp (tag, g_ptr_array_index (all, i - 1))) {
+            /* Tags are separated by spaces in the file. */
+            g_ptr_array_add (merged, g_strdelimit (g_strdup (tag), " \t\r\n", '_'));
+        }
+    }
+    g_ptr_array_add (merged, NULL);
+
+    g_ptr_array_free (all, TRUE);
+
+    return (gchar **)g_ptr_array_free (merged, FALSE);
+}
+
+gint
+compare_strings (gconstpointer a, gconstpointer b)
+{
+    return strcmp (*(const gchar **)a, *(const gchar **)b);
+}
+
+gchar *
+format_record (const UzblBookmark *bookmark)
+{
+    gchar *tags = g_strjoinv (" ", bookmark->tags);
+    gchar *line = g_strdup_printf ("%s\t%s\t%s", bookmark->uri, bookmark->title, tags);
+
+    g_free (tags);
+
+    return line;
+}
+
+gboolean
+append_line (int fd, const gchar *path, const gchar *line)
+{
+    /* A single write so that readers never see half of a record. */
+    gchar *record = g_strconcat (line, "\n", NULL);
+    const gchar *data = record;
+    gsize len = strlen (record);
+
+    while (len) {
+        ssize_t written = write (fd, data, len);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            uzbl_debug ("Failed to write bookmarks: %s: %s\n", path, g_strerror (errno));
+            g_free (record);
+            return FALSE;
+        }
+
+        data += written;
+        len -= written;
+    }
+
+    g_free (record);
+
+    return TRUE;
+}
+
+void
+maybe_compact (const gchar *path)
+{
+    UzblBookmarks *store = uzbl.bookmarks;
+    guint live = g_hash_table_size (store->by_uri);
+
+    if (store->stale < MAX (live, COMPACT_MIN_STALE)) {
+        return;
+    }
+
+    sort_store ();
+
+    GString *contents = g_string_new ("");
+    guint i;
+
+    for (i = 0; i < store->sorted->len; ++i) {
+        gchar *line = format_record (g_ptr_array_index (store->sorted, i));
+
+        g_string_append (contents, line);
+        g_string_append_c (contents, '\n');
+        g_free (line);
+    }
+
+    /* The new file replaces the old one at once; the caller still holds the
+     * lock on the old one so nothing is appended to it meanwhile. */
+    GError *err = NULL;
+
+    if (g_file_set_contents (path, contents->str, contents->len, &err)) {
+        g_chmod (path, 0600);
+        update_store (path);
+    } else {
+        uzbl_debug ("Failed to compact bookmarks: %s\n", err->message);
+        g_error_free (err);
+    }
+
+    g_string_free (contents, TRUE);
+}
+
+void
+sort_store ()
+{
+    UzblBookmarks *store = uzbl.bookmarks;
+
+    if (store->sorted) {
+        return;
+    }
+
+    store->sorted = g_ptr_array_sized_new (g_hash_table_size (store->by_uri));
+
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init (&iter, store->by_uri);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        g_ptr_array_add (store->sorted, value);
+    }
+
+    g_ptr_array_sort (store->sorted, compare_bookmarks);
+}
+
+gint
+compare_bookmarks (gconstpointer a, gconstpointer b)
+{
+    const UzblBookmark *bookmark_a = *(const UzblBookmark **)a;
+    const UzblBookmark *bookmark_b = *(const UzblBookmark **)b;
+
+    return strcmp (bookmark_a->uri, bookmark_b->uri);
+}
+
+void
+free_bookmark (gpointer data)
+{
+    UzblBookmark *bookmark = (UzblBookmark *)data;
+
+    g_free (bookmark->uri);
+    g_free (bookmark->title);
+    g_strfreev (bookmark->tags);
+
+    g_free (bookmark);
+}
+
+void
+free_tag_set (gpointer data)
+{
+    g_hash_table_destroy ((GHashTable *)data);
+}
@@ -0,0 +1,23 @@
+#ifndef UZBL_BOOKMARKS_H
+#define UZBL_BOOKMARKS_H
+
+#include <glib.h>
+
+/* Adds a bookmark to bookmarks_file or merges the tags into an existing one.
+ * The title is kept if the new one is NULL or empty. */
+gboolean
+uzbl_bookmarks_add (const gchar *uri, const gchar *title, const gchar * const *tags);
+/* Removes a bookmark from bookmarks_file. */
+gboolean
+uzbl_bookmarks_remove (const gchar *uri);
+
+/* Appends the bookmarks which have all of the tags as "URI\tTITLE\tTAGS"
+ * lines sorted by URI. */
+void
+uzbl_bookmarks_tagged (const gchar * const *tags, GString *result);
+/* Appends the bookmarks whose URI starts with the prefix as
+ * "URI\tTITLE\tTAGS" lines sorted by URI. */
+void
+uzbl_bookmarks_prefix (const gchar *prefix, GString *result);
+
+#endif
@@ -1,13 +1,19 @@
 #include "commands.h"
 
+#include "binds.h"
+#include "bookmarks.h"
+#include "cookies.h"
 #include "events.h"
 #include "gui.h"
+#include "history.h"
 #include "io.h"
 #include "js.h"
 #include "menu.h"
 #include "requests.h"
+#include "rules.h"
 #include "scheme.h"
 #include "setup.h"
+#include "snapshot.h"
 #include "type.h"
 #include "util.h"
 #include "uzbl-core.h"
@@ -40,6 +46,7 @@ struct _UzblCommands {
 #if WEBKIT_CHECK_VERSION (2, 5, 1)
     /* Script variables */
     GHashTable *script_handler_data_table;
+    GPtrArray *user_scripts;
 #endif
 };
 
@@ -77,6 +84,9 @@ uzbl_command_run_free (UzblCommandRun *run);
 typedef struct _UzblScriptHandlerData UzblScriptHandlerData;
 static void
 script_handler_data_free (gpointer data);
+typedef struct _UzblUserScript UzblUserScript;
+static void
+user_script_free (gpointer data);
 #endif
 
 /* =========================== PUBLIC API =========================== */
@@ -106,6 +116,7 @@ uzbl_commands_init ()
     uzbl.commands->script_handler_data_table = g_hash_table_new_full (
         g_str_hash, g_str_equal,
         g_free, script_handler_data_free);
+    uzbl.commands->user_scripts = g_ptr_array_new_with_free_func (user_script_free);
 #endif
 
     const UzblCommand *cmd = &builtin_command_table[0];
@@ -129,6 +140,7 @@ uzbl_commands_free ()
 
 #if WEBKIT_CHECK_VERSION (2, 5, 1)
     g_hash_table_destroy (uzbl.commands->script_handler_data_table);
+    g_ptr_array_free (uzbl.commands->user_scripts, TRUE);
 #endif
 
     g_free (uzbl.commands);
@@ -210,6 +222,12 @@ uzbl_commands_lookup (const gchar *cmd)
     return g_hash_table_lookup (uzbl.commands->table, cmd);
 }
 
+gboolean
+uzbl_commands_is_task (const UzblCommand *info)
+{
+    return (info && info->task);
+}
+
 const UzblCommand *
 uzbl_commands_parse (const gchar *cmd, GArray *argv)
 {
@@ -228,6 +246,16 @@ uzbl_commands_parse (const gchar *cmd, GArray *argv)
     return info;
 }
 
+const UzblCommand *
+uzbl_commands_parse_expanded (const gchar *line, GArray *argv)
+{
+    if (!line || line[0] == '#' || !*line) {
+        return NULL;
+    }
+
+    return parse_command (line, argv);
+}
+
 void
 uzbl_commands_parse_async (const gchar         *cmd,
                            GArray              *argv,
@@ -513,6 +541,47 @@ uzbl_commands_run (const gchar *cmd, GString *result)
     uzbl_commands_args_free (argv);
 }
 
+static GArray *
+spawn_args (GArray *argv);
+static GArray *
+spawn_sh_args (GArray *argv);
+
+GInputStream *
+uzbl_commands_spawn_stream (const UzblCommand *info, GArray *argv, GError **error)
+{
+    GArray *args = NULL;
+
+    if (!info) {
+        return NULL;
+    }
+
+    if (!g_strcmp0 (info->name, "spawn_sync")) {
+        args = spawn_args (argv);
+    } else if (!g_strcmp0 (info->name, "spawn_sh_sync")) {
+        args = spawn_sh_args (argv);
+    }
+
+    if (!args) {
+        return NULL;
+    }
+
+    GSubprocess *proc = g_subprocessv ((const gchar * const *)args->data,
+        G_SUBPROCESS_FLAGS_STDOUT_PIPE, error);
+    GInputStream *stream = NULL;
+
+    uzbl_commands_args_free (args);
+
+    if (proc) {
+        /* The process is reaped by GIO once it exits; the stream only needs
+         * to keep it around while it is being read. */
+        stream = g_object_ref (g_subprocess_get_stdout_pipe (proc));
+        g_object_set_data_full (G_OBJECT (stream), "uzbl-subprocess",
+            proc, g_object_unref);
+    }
+
+    return stream;
+}
+
 typedef void (*UzblLineCallback) (const gchar *line, gpointer data);
 
 static gboolean
@@ -523,7 +592,16 @@ parse_command_from_file_cb (const gchar *line, gpointer data);
 void
 uzbl_commands_load_file (const gchar *path)
 {
-    if (!for_each_line_in_file (path, parse_command_from_file_cb, NULL)) {
+    gboolean loaded;
+
+    uzbl_snapshot_record_file (path);
+
+    /* Defer variable side effects until the whole file has been read. */
+    uzbl_variables_begin_batch ();
+    loaded = for_each_line_in_file (path, parse_command_from_file_cb, NULL);
+    uzbl_variables_end_batch ();
+
+    if (!loaded) {
         gchar *tmp = g_strdup_printf ("File %s can not be read.", path);
         uzbl_events_send (COMMAND_ERROR, NULL,
             TYPE_STR, tmp,
@@ -549,6 +627,36 @@ script_handler_data_free (gpointer data)
 
     g_free (handler_data);
 }
+
+struct _UzblUserScript {
+    gchar                           *path;
+    gchar                           *source;
+    GFileMonitor                    *monitor;
+
+    WebKitUserContentInjectedFrames  frames;
+    WebKitUserScriptInjectionTime    when;
+    gchar                          **whitelist;
+    gchar                          **blacklist;
+};
+
+void
+user_script_free (gpointer data)
+{
+    UzblUserScript *user_script = (UzblUserScript *)data;
+
+    if (user_script->monitor) {
+        g_signal_handlers_disconnect_by_data (user_script->monitor, user_script);
+        g_file_monitor_cancel (user_script->monitor);
+        g_object_unref (user_script->monitor);
+    }
+
+    g_free (user_script->path);
+    g_free (user_script->source);
+    g_strfreev (user_script->whitelist);
+    g_strfreev (user_script->blacklist);
+
+    g_free (user_script);
+}
 #endif
 
 static JSValueRef
@@ -671,6 +779,9 @@ parse_command_from_file_cb (const gchar *line, gpointer data)
     parse_command_from_file (line);
 }
 
+static JSValueRef
+scalar_result_to_js (JSContextRef ctx, const gchar *result);
+
 JSValueRef
 call_command (JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, size_t argumentCount, const JSValueRef arguments[], JSValueRef* exception)
 {
@@ -715,23 +826,105 @@ call_command (JSContextRef ctx, JSObjectRef function, JSObjectRef thisObject, si
 
     uzbl_commands_run_parsed (info, argv, result);
 
-    JSStringRef result_str = JSStringCreateWithUTF8CString (result->str);
-
-    json_ret = JSValueMakeFromJSONString (ctx, result_str);
+    json_ret = scalar_result_to_js (ctx, result->str);
 
     if (!json_ret) {
-        uzbl_debug ("Failed to parse result as JSON for command \'%s\': %s\n", info->name, result->str);
+        JSStringRef result_str = JSStringCreateWithUTF8CString (result->str);
+
+        json_ret = JSValueMakeFromJSONString (ctx, result_str);
+
+        if (!json_ret) {
+            uzbl_debug ("Failed to parse result as JSON for command \'%s\': %s\n", info->name, result->str);
 
-        json_ret = JSValueMakeString (ctx, result_str);
+            json_ret = JSValueMakeString (ctx, result_str);
+        }
+
+        JSStringRelease (result_str);
     }
 
-    JSStringRelease (result_str);
     g_string_free (result, TRUE);
     uzbl_commands_args_free (argv);
 
     return json_ret;
 }
 
+static gboolean
+is_json_number (const gchar *str);
+
+JSValueRef
+scalar_result_to_js (JSContextRef ctx, const gchar *result)
+{
+    /* Only containers and quoted strings need the JSON parser; anything else
+     * gives the same value as JSON.parse would (or the plain string on
+     * failure) without going through it. */
+    if (!*result) {
+        /* Fall through to creating an empty string. */
+    } else if (!g_strcmp0 (result, "true")) {
+        return JSValueMakeBoolean (ctx, true);
+    } else if (!g_strcmp0 (result, "false")) {
+        return JSValueMakeBoolean (ctx, false);
+    } else if (!g_strcmp0 (result, "null")) {
+        return JSValueMakeNull (ctx);
+    } else if (is_json_number (result)) {
+        return JSValueMakeNumber (ctx, g_ascii_strtod (result, NULL));
+    } else if (strchr ("[{\"", *result) ||
+               g_ascii_isspace (*result) ||
+               g_ascii_isspace (result[strlen (result) - 1])) {
+        return NULL;
+    }
+
+    JSStringRef result_str = JSStringCreateWithUTF8CString (result);
+    JSValueRef ret = JSValueMakeString (ctx, result_str);
+    JSStringRelease (result_str);
+
+    return ret;
+}
+
+gboolean
+is_json_number (const gchar *str)
+{
+    const gchar *p = str;
+
+    if (*p == '-') {
+        ++p;
+    }
+
+    if (*p == '0') {
+        ++p;
+    } else if (g_ascii_isdigit (*p)) {
+        while (g_ascii_isdigit (*p)) {
+            ++p;
+        }
+    } else {
+        return FALSE;
+    }
+
+    if (*p == '.') {
+        ++p;
+        if (!g_ascii_isdigit (*p)) {
+            return FALSE;
+        }
+        while (g_ascii_isdigit (*p)) {
+            ++p;
+        }
+    }
+
+    if ((*p == 'e') || (*p == 'E')) {
+        ++p;
+        if ((*p == '+') || (*p == '-')) {
+            ++p;
+        }
+        if (!g_ascii_isdigit (*p)) {
+            return FALSE;
+        }
+        while (g_ascii_isdigit (*p)) {
+            ++p;
+        }
+    }
+
+    return (*p == '\0');
+}
+
 GArray *
 split_quoted (const gchar *src)
 {
@@ -815,7 +1008,16 @@ parse_command_from_file (const char *cmd)
     gchar *work_string = g_strdup (cmd);
     g_strstrip (work_string);
 
-    uzbl_commands_run (work_string, NULL);
+    GArray *argv = uzbl_commands_args_new ();
+    const UzblCommand *info = uzbl_commands_parse (work_string, argv);
+
+    if (info) {
+        uzbl_snapshot_record_command (info->name, work_string, argv);
+    }
+
+    uzbl_commands_run_parsed (info, argv, NULL);
+
+    uzbl_commands_args_free (argv);
     g_free (work_string);
 }
 
@@ -871,6 +1073,12 @@ DECLARE_COMMAND (save);
 /* Cookie commands */
 DECLARE_COMMAND (cookie);
 
+/* History commands */
+DECLARE_COMMAND (history_query);
+
+/* Bookmark commands */
+DECLARE_COMMAND (bookmark);
+
 /* Display commands */
 DECLARE_COMMAND (scroll);
 DECLARE_COMMAND (zoom);
@@ -894,9 +1102,14 @@ DECLARE_COMMAND (menu);
 /* Search commands */
 DECLARE_COMMAND (search);
 
+/* Hint commands */
+DECLARE_TASK (hint);
+
 /* Security commands */
 DECLARE_COMMAND (security);
 DECLARE_COMMAND (dns);
+DECLARE_COMMAND (block);
+DECLARE_COMMAND (rule);
 
 /* Inspector commands */
 DECLARE_COMMAND (inspector);
@@ -917,6 +1130,8 @@ DECLARE_COMMAND (exit);
 /* Variable commands */
 DECLARE_COMMAND (set);
 DECLARE_COMMAND (toggle);
+DECLARE_COMMAND (begin_batch);
+DECLARE_COMMAND (end_batch);
 DECLARE_COMMAND (dump_config);
 DECLARE_COMMAND (dump_config_as_events);
 DECLARE_COMMAND (print);
@@ -946,6 +1161,12 @@ builtin_command_table[] = {
     /* Cookie commands */
     { "cookie",                         cmd_cookie,                   TRUE,  TRUE,  FALSE },
 
+    /* History commands */
+    { "history_query",                  cmd_history_query,            TRUE,  TRUE,  FALSE },
+
+    /* Bookmark commands */
+    { "bookmark",                       cmd_bookmark,                 TRUE,  TRUE,  FALSE },
+
     /* Display commands */
     { "scroll",                         cmd_scroll,                   TRUE,  TRUE,  FALSE },
     { "zoom",                           cmd_zoom,                     TRUE,  TRUE,  FALSE },
@@ -969,9 +1190,14 @@ builtin_command_table[] = {
     /* Search commands */
     { "search",                         cmd_search,                   FALSE, TRUE,  FALSE },
 
+    /* Hint commands */
+    { "hint",                           COMMAND (cmd_hint),           TRUE,  TRUE,  TRUE  },
+
     /* Security commands */
     { "security",                       cmd_security,                 TRUE,  TRUE,  FALSE },
     { "dns",                            cmd_dns,                      TRUE,  TRUE,  FALSE },
+    { "block",                          cmd_block,                    TRUE,  TRUE,  FALSE },
+    { "rule",                           cmd_rule,                     FALSE, TRUE,  FALSE },
 
     /* Inspector commands */
     { "inspector",                      cmd_inspector,                TRUE,  TRUE,  FALSE },
@@ -993,6 +1219,8 @@ builtin_command_table[] = {
     /* Variable commands */
     { "set",                            cmd_set,                      FALSE, FALSE, FALSE},
     { "toggle",                         cmd_toggle,                   TRUE,  TRUE,  FALSE },
+    { "begin_batch",                    cmd_begin_batch,              TRUE,  TRUE,  FALSE },
+    { "end_batch",                      cmd_end_batch,                TRUE,  TRUE,  FALSE },
     /* TODO: Add more dump commands (e.g., current frame/page source) */
     { "dump_config",                    cmd_dump_config,              TRUE,  TRUE,  FALSE },
     { "dump_config_as_events",          cmd_dump_config_as_events,    TRUE,  TRUE,  FALSE },
@@ -1239,11 +1467,96 @@ IMPLEMENT_COMMAND (cookie)
         } else {
             uzbl_debug ("Unrecognized cookie clear type: %s\n", type);
         }
+    } else if (!g_strcmp0 (command, "import")) {
+        ARG_CHECK (argv, 2);
+
+        uzbl_cookies_import (argv_idx (argv, 1));
+    } else if (!g_strcmp0 (command, "export")) {
+        ARG_CHECK (argv, 2);
+
+        uzbl_cookies_export (argv_idx (argv, 1));
     } else {
         uzbl_debug ("Unrecognized cookie command: %s\n", command);
     }
 }
 
+/* History commands */
+
+IMPLEMENT_COMMAND (history_query)
+{
+    ARG_CHECK (argv, 1);
+
+    if (!result) {
+        return;
+    }
+
+    gint64 count = g_ascii_strtoll (argv_idx (argv, 0), NULL, 10);
+
+    if (count < 0) {
+        uzbl_debug ("Invalid history query count: %s\n", argv_idx (argv, 0));
+        return;
+    }
+
+    /* A count of 0 asks for every match. */
+    if (!count) {
+        count = G_MAXUINT;
+    }
+
+    /* The rest of the arguments make up the query. */
+    GString *query = g_string_new ("");
+
+    guint i;
+    for (i = 1; i < argv->len; ++i) {
+        if (1 < i) {
+            g_string_append_c (query, ' ');
+        }
+        g_string_append (query, argv_idx (argv, i));
+    }
+
+    uzbl_history_query (query->str, MIN (count, G_MAXUINT), result);
+
+    g_string_free (query, TRUE);
+}
+
+/* Bookmark commands */
+
+IMPLEMENT_COMMAND (bookmark)
+{
+    ARG_CHECK (argv, 1);
+
+    const gchar *command = argv_idx (argv, 0);
+
+    if (!g_strcmp0 (command, "add")) {
+        ARG_CHECK (argv, 2);
+
+        const gchar *uri = argv_idx (argv, 1);
+        const gchar *title = (argv->len > 2) ? argv_idx (argv, 2) : NULL;
+        const gchar * const *tags = (argv->len > 3) ? (const gchar * const *)&g_array_index (argv, gchar *, 3) : NULL;
+
+        if (!uzbl_bookmarks_add (uri, title, tags)) {
+            uzbl_debug ("Failed to add bookmark: %s\n", uri);
+        }
+    } else if (!g_strcmp0 (command, "remove")) {
+        ARG_CHECK (argv, 2);
+
+        uzbl_bookmarks_remove (argv_idx (argv, 1));
+    } else if (!g_strcmp0 (command, "tagged")) {
+        ARG_CHECK (argv, 2);
+
+        if (result) {
+            uzbl_bookmarks_tagged ((const gchar * const *)&g_array_index (argv, gchar *, 1), result);
+        }
+    } else if (!g_strcmp0 (command, "prefix")) {
+        ARG_CHECK (argv, 2);
+
+        if (result) {
+            uzbl_bookmarks_prefix (argv_idx (argv, 1), result);
+        }
+    } else {
+        uzbl_debug ("Unrecognized bookmark command: %s\n", command);
+    }
+}
+
 /* Display commands */
 
 /*
@@ -1687,6 +2000,8 @@ IMPLEMENT_COMMAND (css)
 #if WEBKIT_CHECK_VERSION (2, 7, 2)
 static void
 script_message_callback (WebKitUserContentManager *manager, WebKitJavascriptResult *res, gpointer data);
+static void
+add_user_script (WebKitUserContentManager *manager, UzblUserScript *user_script);
 
 IMPLEMENT_COMMAND (script)
 {
@@ -1698,7 +2013,7 @@ IMPLEMENT_COMMAND (script)
 
     WebKitUserContentManager *manager = webkit_web_view_get_user_content_manager (uzbl.gui.web_view);
 
-    if (!g_strcmp0 (command, "add")) {
+    if (!g_strcmp0 (command, "add") || !g_strcmp0 (command, "file")) {
         ARG_CHECK (argv, 2);
 
         const gchar *uri = argv_idx (argv, 1);
@@ -1746,14 +2061,37 @@ IMPLEMENT_COMMAND (script)
             blacklist_list = g_strsplit (blacklist, ",", 0);
         }
 
-        WebKitUserScript *script = webkit_user_script_new (
-            uri,
-            frames,
-            when,
-            (const gchar * const *)whitelist_list,
-            (const gchar * const *)blacklist_list);
-        webkit_user_content_manager_add_script (manager, script);
-        webkit_user_script_unref (script);
+        gchar *path = NULL;
+        gchar *source = NULL;
+        GError *err = NULL;
+
+        if (g_strcmp0 (command, "file")) {
+            source = g_strdup (uri);
+        } else if (!(path = find_existing_file (uri))) {
+            uzbl_debug ("Script file not found: %s\n", uri);
+        } else if (!g_file_get_contents (path, &source, NULL, &err)) {
+            uzbl_debug ("Failed to read script file %s: %s\n", path, err->message);
+            g_error_free (err);
+        }
+
+        if (source) {
+            UzblUserScript *user_script = g_malloc0 (sizeof (UzblUserScript));
+
+            user_script->path = path;
+            path = NULL;
+            user_script->source = source;
+            user_script->frames = frames;
+            user_script->when = when;
+            user_script->whitelist = whitelist_list;
+            user_script->blacklist = blacklist_list;
+
+            whitelist_list = NULL;
+            blacklist_list = NULL;
+
+            add_user_script (manager, user_script);
+        }
+
+        g_free (path);
 
         if (whitelist_list) {
             g_strfreev (whitelist_list);
@@ -1763,6 +2101,7 @@ IMPLEMENT_COMMAND (script)
         }
     } else if (!g_strcmp0 (command, "clear")) {
         webkit_user_content_manager_remove_all_scripts (manager);
+        g_ptr_array_set_size (uzbl.commands->user_scripts, 0);
 #if WEBKIT_CHECK_VERSION (2, 7, 2)
     } else if (!g_strcmp0 (command, "listen")) {
         ARG_CHECK (argv, 2);
@@ -2206,6 +2545,128 @@ IMPLEMENT_COMMAND (search)
 #undef search_options
 }
 
+/* Hint commands */
+
+static void
+collect_hints_cb (GObject      *source,
+                  GAsyncResult *result,
+                  gpointer      data);
+
+IMPLEMENT_TASK (hint)
+{
+    TASK_ARG_CHECK (task, argv, 1);
+
+    const gchar *command = argv_idx (argv, 0);
+
+    if (!g_strcmp0 (command, "collect")) {
+        const gchar *mode = argv_idx (argv, 1);
+        const gchar *typed = argv_idx (argv, 2);
+
+        if (!mode || !*mode) {
+            mode = "click";
+        }
+
+        /* "*" binds run again for every key; only collect on the first. */
+        if (typed && *typed) {
+            GString *str = (GString*) g_task_get_task_data (task);
+            if (str) {
+                g_string_append (str, "null");
+            }
+            g_task_return_pointer (task, NULL, NULL);
+            g_object_unref (task);
+            return;
+        }
+
+        if (g_strcmp0 (mode, "click") && g_strcmp0 (mode, "uri")) {
+            uzbl_debug ("Unrecognized hint mode: %s", mode);
+            g_task_return_pointer (task, NULL, NULL);
+            g_object_unref (task);
+            return;
+        }
+
+        uzbl_io_collect_hints_async (mode, collect_hints_cb, task);
+    } else {
+        uzbl_debug ("Unrecognized hint command: %s", command);
+        g_task_return_pointer (task, NULL, NULL);
+        g_object_unref (task);
+    }
+}
+
+static void
+append_json_string (GString *str, const gchar *value);
+
+void
+collect_hints_cb (GObject      *source,
+                  GAsyncResult *result,
+                  gpointer      data)
+{
+    UZBL_UNUSED (source);
+
+    GTask *task = G_TASK (data);
+    GError *err = NULL;
+    GVariant *hints = uzbl_io_collect_hints_finish (result, &err);
+
+    if (err) {
+        g_task_return_error (task, err);
+        g_object_unref (task);
+        return;
+    }
+
+    /* Hints are returned as a JSON array of [id, x, y, width, height, href]
+     * arrays for follow.js to draw. */
+    GString *str = (GString*) g_task_get_task_data (task);
+    if (str) {
+        GVariantIter iter;
+        guint32 id;
+        gint x;
+        gint y;
+        gint width;
+        gint height;
+        const gchar *href;
+        gboolean first = TRUE;
+
+        g_string_append_c (str, '[');
+        g_variant_iter_init (&iter, hints);
+        while (g_variant_iter_next (&iter, "(uiiii&s)", &id, &x, &y, &width, &height, &href)) {
+            g_string_append_printf (str, "%s[%u,%d,%d,%d,%d,",
+                                    first ? "" : ",", id, x, y, width, height);
+            append_json_string (str, href);
+            g_string_append_c (str, ']');
+            first = FALSE;
+        }
+        g_string_append_c (str, ']');
+    }
+
+    g_variant_unref (hints);
+    g_task_return_pointer (task, NULL, NULL);
+    g_object_unref (task);
+}
+
+void
+append_json_string (GString *str, const gchar *value)
+{
+    const gchar *p;
+
+    g_string_append_c (str, '"');
+    for (p = value; *p; ++p) {
+        switch (*p) {
+        case '"':
+        case '\\':
+            g_string_append_c (str, '\\');
+            g_string_append_c (str, *p);
+            break;
+        default:
+            if ((guchar)*p < 0x20) {
+                g_string_append_printf (str, "\\u%04x", *p);
+            } else {
+                g_string_append_c (str, *p);
+            }
+            break;
+        }
+    }
+    g_string_append_c (str, '"');
+}
+
 /* Security commands */
 
 IMPLEMENT_COMMAND (security)
@@ -2274,8 +2735,6 @@ IMPLEMENT_COMMAND (security)
 
 IMPLEMENT_COMMAND (dns)
 {
-    UZBL_UNUSED (result);
-
     ARG_CHECK (argv, 1);
 
     const gchar *command = argv_idx (argv, 0);
@@ -2288,11 +2747,97 @@ IMPLEMENT_COMMAND (dns)
         WebKitWebContext *context = webkit_web_view_get_context (uzbl.gui.web_view);
 
         webkit_web_context_prefetch_dns (context, hostname);
+    } else if (!g_strcmp0 (command, "stats")) {
+        if (result) {
+            uzbl_gui_prefetch_stats (result);
+        }
     } else {
         uzbl_debug ("Unrecognized dns command: %s\n", command);
     }
 }
 
+IMPLEMENT_COMMAND (block)
+{
+    UZBL_UNUSED (result);
+
+    ARG_CHECK (argv, 1);
+
+    const gchar *command = argv_idx (argv, 0);
+
+    /* Rules live in the web process; they are kept here as well so that a
+     * new web process gets the same rules. */
+    if (!g_strcmp0 (command, "load")) {
+        ARG_CHECK (argv, 2);
+
+        const gchar *req_path = argv_idx (argv, 1);
+        gchar *path = find_existing_file (req_path);
+
+        if (!path) {
+            uzbl_debug ("Block rule file not found: %s\n", req_path);
+            return;
+        }
+
+        uzbl_io_send_ext_state (EXT_BLOCK_RULES, "load", path);
+
+        g_free (path);
+    } else if (!g_strcmp0 (command, "add")) {
+        ARG_CHECK (argv, 2);
+
+        const gchar *rule = argv_idx (argv, 1);
+
+        uzbl_io_send_ext_state (EXT_BLOCK_RULES, "add", rule);
+    } else if (!g_strcmp0 (command, "clear")) {
+        uzbl_io_clear_ext_state (EXT_BLOCK_RULES);
+        uzbl_io_send_ext_message (EXT_BLOCK_RULES, EXTIO_NO_PAGE, "clear", "");
+    } else {
+        uzbl_debug ("Unrecognized block command: %s\n", command);
+    }
+}
+
+IMPLEMENT_COMMAND (rule)
+{
+    UZBL_UNUSED (result);
+
+    ARG_CHECK (argv, 1);
+
+    /* The argument may be a command, so the rest of the line is kept as it
+     * is, quotes and all. */
+    gchar **tokens = g_strsplit (argv_idx (argv, 0), " ", 5);
+    guint ntokens = g_strv_length (tokens);
+
+    const gchar *table_str = tokens[0];
+    const gchar *command = (ntokens > 1) ? tokens[1] : NULL;
+    UzblRuleTable table;
+
+    if (!g_strcmp0 (table_str, "navigation")) {
+        table = UZBL_RULES_NAVIGATION;
+    } else if (!g_strcmp0 (table_str, "request")) {
+        table = UZBL_RULES_REQUEST;
+    } else {
+        uzbl_debug ("Unrecognized rule table: %s\n", table_str);
+        g_strfreev (tokens);
+        return;
+    }
+
+    if (!g_strcmp0 (command, "add")) {
+        if (ntokens < 4) {
+            uzbl_debug ("Missing rule pattern or action\n");
+        } else {
+            const gchar *pattern = tokens[2];
+            const gchar *action = tokens[3];
+            const gchar *argument = (ntokens > 4) ? g_strstrip (tokens[4]) : NULL;
+
+            uzbl_rules_add (table, pattern, action, argument);
+        }
+    } else if (!g_strcmp0 (command, "clear")) {
+        uzbl_rules_clear (table);
+    } else {
+        uzbl_debug ("Unrecognized rule command: %s\n", command);
+    }
+
+    g_strfreev (tokens);
+}
+
 /* Inspector commands */
 
 IMPLEMENT_COMMAND (inspector)
@@ -2365,6 +2910,7 @@ IMPLEMENT_TASK (js)
         gchar *path;
         if ((path = find_existing_file (req_path))) {
             uzbl_js_run_file_async (jsctx, path, &jsargs, run_js_cb, task);
+            g_free (path);
         } else {
             g_task_return_pointer (task, NULL, NULL);
             g_object_unref (task);
@@ -2527,11 +3073,19 @@ IMPLEMENT_COMMAND (include)
     gchar *path = NULL;
 
     if ((path = find_existing_file (req_path))) {
+        uzbl_snapshot_record_include_begin (path);
         uzbl_commands_load_file (path);
+        uzbl_snapshot_record_include_end ();
         uzbl_events_send (FILE_INCLUDED, NULL,
             TYPE_STR, path,
             NULL);
         g_free (path);
+    } else {
+        if (!strchr (req_path, ':')) {
+            /* Creating the file later must invalidate a config snapshot. */
+            uzbl_snapshot_record_file (req_path);
+        }
+        uzbl_snapshot_record_include_missing ();
     }
 }
 
@@ -2619,6 +3173,22 @@ IMPLEMENT_COMMAND (print)
     g_free (buf);
 }
 
+IMPLEMENT_COMMAND (begin_batch)
+{
+    UZBL_UNUSED (argv);
+    UZBL_UNUSED (result);
+
+    uzbl_variables_begin_batch ();
+}
+
+IMPLEMENT_COMMAND (end_batch)
+{
+    UZBL_UNUSED (argv);
+    UZBL_UNUSED (result);
+
+    uzbl_variables_end_batch ();
+}
+
 IMPLEMENT_COMMAND (dump_config)
 {
     UZBL_UNUSED (argv);
@@ -2649,6 +3219,8 @@ IMPLEMENT_COMMAND (event)
     if (event) {
         GString *event_name = g_string_ascii_up (g_string_new (event));
 
+        uzbl_binds_event (event_name->str, arg_string ? arg_string : "");
+
         uzbl_events_send (USER_EVENT, event_name->str,
             TYPE_FORMATTEDSTR, arg_string ? arg_string : "",
             NULL);
@@ -2771,6 +3343,108 @@ script_message_callback (WebKitUserContentManager *manager, WebKitJavascriptResu
 
     g_free (res_str);
 }
+
+static void
+install_user_script (WebKitUserContentManager *manager, const UzblUserScript *user_script);
+static void
+reinstall_user_scripts (WebKitUserContentManager *manager);
+static void
+user_script_changed (GFileMonitor *monitor, GFile *file, GFile *other,
+                     GFileMonitorEvent event, gpointer data);
+
+void
+add_user_script (WebKitUserContentManager *manager, UzblUserScript *user_script)
+{
+    gboolean replaced = FALSE;
+
+    if (user_script->path) {
+        /* Adding the same file again replaces it rather than injecting it
+         * twice. */
+        guint i;
+        for (i = 0; i < uzbl.commands->user_scripts->len; ++i) {
+            const UzblUserScript *old = g_ptr_array_index (uzbl.commands->user_scripts, i);
+
+            if (!g_strcmp0 (old->path, user_script->path)) {
+                g_ptr_array_remove_index (uzbl.commands->user_scripts, i);
+                replaced = TRUE;
+                break;
+            }
+        }
+
+        GFile *file = g_file_new_for_path (user_script->path);
+        user_script->monitor = g_file_monitor_file (file, G_FILE_MONITOR_NONE, NULL, NULL);
+        g_object_unref (file);
+
+        if (user_script->monitor) {
+            g_signal_connect (user_script->monitor, "changed",
+                G_CALLBACK (user_script_changed), user_script);
+        }
+    }
+
+    g_ptr_array_add (uzbl.commands->user_scripts, user_script);
+
+    if (replaced) {
+        reinstall_user_scripts (manager);
+    } else {
+        install_user_script (manager, user_script);
+    }
+}
+
+void
+install_user_script (WebKitUserContentManager *manager, const UzblUserScript *user_script)
+{
+    WebKitUserScript *script = webkit_user_script_new (
+        user_script->source,
+        user_script->frames,
+        user_script->when,
+        (const gchar * const *)user_script->whitelist,
+        (const gchar * const *)user_script->blacklist);
+    webkit_user_content_manager_add_script (manager, script);
+    webkit_user_script_unref (script);
+}
+
+void
+reinstall_user_scripts (WebKitUserContentManager *manager)
+{
+    /* Scripts can only be removed all at once, so put back the others to
+     * keep the injection order. */
+    webkit_user_content_manager_remove_all_scripts (manager);
+
+    guint i;
+    for (i = 0; i < uzbl.commands->user_scripts->len; ++i) {
+        install_user_script (manager, g_ptr_array_index (uzbl.commands->user_scripts, i));
+    }
+}
+
+void
+user_script_changed (GFileMonitor *monitor, GFile *file, GFile *other,
+                     GFileMonitorEvent event, gpointer data)
+{
+    UZBL_UNUSED (monitor);
+    UZBL_UNUSED (file);
+    UZBL_UNUSED (other);
+
+    UzblUserScript *user_script = (UzblUserScript *)data;
+
+    if ((event != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT) &&
+        (event != G_FILE_MONITOR_EVENT_CREATED)) {
+        return;
+    }
+
+    gchar *source = NULL;
+
+    /* Keep the cached copy if the file went away or is unreadable. */
+    if (!g_file_get_contents (user_script->path, &source, NULL, NULL)) {
+        return;
+    }
+
+    g_free (user_script->source);
+    user_script->source = source;
+
+    uzbl_debug ("Reloaded script file %s\n", user_script->path);
+
+    reinstall_user_scripts (webkit_web_view_get_user_content_manager (uzbl.gui.web_view));
+}
 #endif
 
 void
@@ -2792,25 +3466,10 @@ run_system_command (GArray *args, char **output_stdout);
 void
 spawn (GArray *argv, GString *result, gboolean exec)
 {
-    ARG_CHECK (argv, 1);
-
-    const gchar *req_path = argv_idx (argv, 0);
-
-    gchar *path = find_existing_file (req_path);
-
-    if (!path) {
-        /* Assume it's a valid command. */
-        path = g_strdup (req_path);
-    }
-
-    GArray *args = uzbl_commands_args_new ();
-
-    uzbl_commands_args_append (args, path);
+    GArray *args = spawn_args (argv);
 
-    guint i;
-    for (i = 1; i < argv->len; ++i) {
-        const gchar *arg = argv_idx (argv, i);
-        uzbl_commands_args_append (args, g_strdup (arg));
+    if (!args) {
+        return;
     }
 
     gchar *r = NULL;
@@ -2835,20 +3494,69 @@ spawn (GArray *argv, GString *result, gboolean exec)
 
 void
 spawn_sh (GArray *argv, GString *result)
+{
+    GArray *sh_cmd = spawn_sh_args (argv);
+
+    if (!sh_cmd) {
+        return;
+    }
+
+    gchar *r = NULL;
+    run_system_command (sh_cmd, result ? &r : NULL);
+    if (result && r) {
+        remove_trailing_newline (r);
+        g_string_append (result, r);
+    }
+
+    g_free (r);
+    uzbl_commands_args_free (sh_cmd);
+}
+
+GArray *
+spawn_args (GArray *argv)
+{
+    if (argv->len < 1) {
+        return NULL;
+    }
+
+    const gchar *req_path = argv_idx (argv, 0);
+
+    gchar *path = find_existing_file (req_path);
+
+    if (!path) {
+        /* Assume it's a valid command. */
+        path = g_strdup (req_path);
+    }
+
+    GArray *args = uzbl_commands_args_new ();
+
+    uzbl_commands_args_append (args, path);
+
+    guint i;
+    for (i = 1; i < argv->len; ++i) {
+        const gchar *arg = argv_idx (argv, i);
+        uzbl_commands_args_append (args, g_strdup (arg));
+    }
+
+    return args;
+}
+
+GArray *
+spawn_sh_args (GArray *argv)
 {
     gchar *shell = uzbl_variables_get_string ("shell_cmd");
 
     if (!*shell) {
         uzbl_debug ("spawn_sh: shell_cmd is not set!\n");
         g_free (shell);
-        return;
+        return NULL;
     }
     guint i;
 
     GArray *sh_cmd = split_quoted (shell);
     g_free (shell);
     if (!sh_cmd) {
-        return;
+        return NULL;
     }
 
     for (i = 0; i < argv->len; ++i) {
@@ -2856,15 +3564,7 @@ spawn_sh (GArray *argv, GString *result)
         uzbl_commands_args_append (sh_cmd, g_strdup (arg));
     }
 
-    gchar *r = NULL;
-    run_system_command (sh_cmd, result ? &r : NULL);
-    if (result && r) {
-        remove_trailing_newline (r);
-        g_string_append (result, r);
-    }
-
-    g_free (r);
-    uzbl_commands_args_free (sh_cmd);
+    return sh_cmd;
 }
 
 void
@@ -25,9 +25,15 @@ uzbl_commands_args_free (GArray *argv);
 
 const UzblCommand *
 uzbl_commands_lookup (const gchar *cmd);
+/* Whether the command only runs asynchronously. */
+gboolean
+uzbl_commands_is_task (const UzblCommand *info);
 
 const UzblCommand *
 uzbl_commands_parse (const gchar *cmd, GArray *argv);
+/* Parses a line which has already been expanded. */
+const UzblCommand *
+uzbl_commands_parse_expanded (const gchar *line, GArray *argv);
 void
 uzbl_commands_parse_async (const gchar         *cmd,
                            GArray              *argv,
@@ -59,6 +65,12 @@ uzbl_commands_run_argv (const gchar *cmd, GArray *argv, GString *result);
 void
 uzbl_commands_run (const gchar *cmd, GString *result);
 
+/* Starts a spawn_sync or spawn_sh_sync command with its standard output
+ * available as the returned stream rather than waiting for it to exit.
+ * Returns NULL (without an error) for any other command. */
+GInputStream *
+uzbl_commands_spawn_stream (const UzblCommand *info, GArray *argv, GError **error);
+
 void
 uzbl_commands_load_file (const gchar *path);
 
@@ -0,0 +1,539 @@
+#include "cookies.h"
+
+#include "commands.h"
+#include "events.h"
+#include "setup.h"
+#include "type.h"
+#include "util.h"
+#include "uzbl-core.h"
+
+#include <string.h>
+
+/* How long to wait for more changes before refreshing the snapshot. */
+#define COOKIES_CHANGED_DELAY 500
+
+struct _UzblCookies {
+    /* The cookies as of the last COOKIES_CHANGED event, keyed by domain, path
+     * and name. */
+    GHashTable *snapshot;
+
+    guint       refresh_id;
+    gboolean    refreshing;
+    /* Changes seen while a refresh was running. */
+    gboolean    dirty;
+    /* Do not report the next refresh. */
+    gboolean    silent;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+static void
+free_cookie (gpointer data);
+static GHashTable *
+cookie_table_new ();
+
+void
+uzbl_cookies_init ()
+{
+    uzbl.cookies = g_malloc0 (sizeof (UzblCookies));
+
+    uzbl.cookies->snapshot = cookie_table_new ();
+}
+
+void
+uzbl_cookies_free ()
+{
+    if (uzbl.cookies->refresh_id) {
+        g_source_remove (uzbl.cookies->refresh_id);
+    }
+
+    g_hash_table_unref (uzbl.cookies->snapshot);
+
+    g_free (uzbl.cookies);
+    uzbl.cookies = NULL;
+}
+
+#if WEBKIT_CHECK_VERSION (2, 20, 0)
+typedef struct {
+    gchar *path;
+
+    /* Outstanding requests to the cookie manager. */
+    guint  pending;
+    guint  imported;
+    guint  failed;
+} UzblCookieImport;
+
+typedef void (*UzblCookiesCollected) (GHashTable *cookies, guint failed, gpointer data);
+
+static WebKitCookieManager *
+cookie_manager ();
+static SoupCookie *
+parse_netscape_cookie (const gchar *line, gint64 now);
+static void
+append_netscape_cookie (GString *lines, SoupCookie *cookie);
+static void
+import_cookie_cb (GObject *object, GAsyncResult *res, gpointer data);
+static void
+collect_cookies (UzblCookiesCollected callback, gpointer data);
+static void
+export_collected (GHashTable *cookies, guint failed, gpointer data);
+static gboolean
+refresh_snapshot (gpointer data);
+static void
+snapshot_collected (GHashTable *cookies, guint failed, gpointer data);
+#endif
+
+void
+uzbl_cookies_import (const gchar *path)
+{
+#if WEBKIT_CHECK_VERSION (2, 20, 0)
+    WebKitCookieManager *manager = cookie_manager ();
+    gchar *contents = NULL;
+    GError *err = NULL;
+
+    if (!manager) {
+        return;
+    }
+
+    if (!g_file_get_contents (path, &contents, NULL, &err)) {
+        uzbl_debug ("Failed to read cookies: %s\n", err->message);
+        g_error_free (err);
+        return;
+    }
+
+    UzblCookieImport *import = g_malloc0 (sizeof (UzblCookieImport));
+    gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+    gchar **lines = g_strsplit (contents, "\n", -1);
+    gchar **line;
+
+    g_free (contents);
+
+    import->path = g_strdup (path);
+    /* Held until every cookie has been handed over so that callbacks cannot
+     * finish the import early. */
+    import->pending = 1;
+
+    /* Every cookie is handed to the manager up front; the event is sent once
+     * the last of them has been stored. */
+    for (line = lines; *line; ++line) {
+        SoupCookie *cookie = parse_netscape_cookie (*line, now);
+
+        if (!cookie) {
+            continue;
+        }
+
+        ++import->pending;
+        webkit_cookie_manager_add_cookie (manager, cookie,
+                                          NULL, import_cookie_cb, import);
+        soup_cookie_free (cookie);
+    }
+
+    g_strfreev (lines);
+
+    import_cookie_cb (NULL, NULL, import);
+#else
+    UZBL_UNUSED (path);
+
+    uzbl_debug ("Importing cookies requires WebKit 2.20.0 or newer.\n");
+#endif
+}
+
+void
+uzbl_cookies_export (const gchar *path)
+{
+#if WEBKIT_CHECK_VERSION (2, 20, 0)
+    collect_cookies (export_collected, g_strdup (path));
+#else
+    UZBL_UNUSED (path);
+
+    uzbl_debug ("Exporting cookies requires WebKit 2.20.0 or newer.\n");
+#endif
+}
+
+void
+uzbl_cookies_changed ()
+{
+#if WEBKIT_CHECK_VERSION (2, 20, 0)
+    if (uzbl.cookies->refreshing) {
+        uzbl.cookies->dirty = TRUE;
+        return;
+    }
+
+    if (!uzbl.cookies->refresh_id) {
+        uzbl.cookies->refresh_id = g_timeout_add (COOKIES_CHANGED_DELAY,
+            refresh_snapshot, NULL);
+    }
+#endif
+}
+
+void
+uzbl_cookies_reset ()
+{
+    uzbl.cookies->silent = TRUE;
+    uzbl_cookies_changed ();
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+void
+free_cookie (gpointer data)
+{
+    soup_cookie_free ((SoupCookie *)data);
+}
+
+GHashTable *
+cookie_table_new ()
+{
+    return g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, free_cookie);
+}
+
+#if WEBKIT_CHECK_VERSION (2, 20, 0)
+WebKitCookieManager *
+cookie_manager ()
+{
+    if (!uzbl.gui.web_view) {
+        return NULL;
+    }
+
+    WebKitWebContext *context = webkit_web_view_get_context (uzbl.gui.web_view);
+    return webkit_web_context_get_cookie_manager (context);
+}
+
+#define HTTP_ONLY_PREFIX "#HttpOnly_"
+
+SoupCookie *
+parse_netscape_cookie (const gchar *line, gint64 now)
+{
+    gboolean http_only = FALSE;
+
+    if (g_str_has_prefix (line, HTTP_ONLY_PREFIX)) {
+        http_only = TRUE;
+        line += strlen (HTTP_ONLY_PREFIX);
+    } else if ((*line == '#') || !*line) {
+        return NULL;
+    }
+
+    /* DOMAIN FLAG PATH SECURE EXPIRES NAME VALUE */
+    gchar **fields = g_strsplit (line, "\t", 7);
+    SoupCookie *cookie = NULL;
+
+    if (g_strv_length (fields) == 7) {
+        gint64 expires = g_ascii_strtoll (fields[4], NULL, 10);
+        gchar *value = g_strchomp (fields[6]);
+
+        /* Skip cookies which have already expired. */
+        if (!expires || (now < expires)) {
+            cookie = soup_cookie_new (fields[5], value, fields[0], fields[2], -1);
+        }
+
+        if (cookie) {
+            soup_cookie_set_secure (cookie, !g_strcmp0 (fields[3], "TRUE"));
+            soup_cookie_set_http_only (cookie, http_only);
+
+            if (expires) {
+                SoupDate *date = soup_date_new_from_time_t ((time_t)expires);
+                soup_cookie_set_expires (cookie, date);
+                soup_date_free (date);
+            }
+        }
+    }
+
+    g_strfreev (fields);
+
+    return cookie;
+}
+
+void
+append_netscape_cookie (GString *lines, SoupCookie *cookie)
+{
+    const gchar *domain = soup_cookie_get_domain (cookie);
+    SoupDate *expires = soup_cookie_get_expires (cookie);
+
+    g_string_append_printf (lines, "%s%s\t%s\t%s\t%s\t%" G_GINT64_FORMAT "\t%s\t%s\n",
+        soup_cookie_get_http_only (cookie) ? HTTP_ONLY_PREFIX : "",
+        domain,
+        (*domain == '.') ? "TRUE" : "FALSE",
+        soup_cookie_get_path (cookie),
+        soup_cookie_get_secure (cookie) ? "TRUE" : "FALSE",
+        expires ? (gint64)soup_date_to_time_t (expires) : (gint64)0,
+        soup_cookie_get_name (cookie),
+        soup_cookie_get_value (cookie));
+}
+
+#undef HTTP_ONLY_PREFIX
+
+void
+import_cookie_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    UzblCookieImport *import = (UzblCookieImport *)data;
+
+    if (res) {
+        GError *err = NULL;
+
+        if (webkit_cookie_manager_add_cookie_finish (WEBKIT_COOKIE_MANAGER (object), res, &err)) {
+            ++import->imported;
+        } else {
+            ++import->failed;
+            uzbl_debug ("Failed to import cookie: %s\n", err->message);
+            g_error_free (err);
+        }
+    }
+
+    if (--import->pending) {
+        return;
+    }
+
+    uzbl_events_send (COOKIES_IMPORTED, NULL,
+        TYPE_STR, import->path,
+        TYPE_INT, import->imported,
+        TYPE_INT, import->failed,
+        NULL);
+
+    g_free (import->path);
+    g_free (import);
+}
+
+typedef struct {
+    WebKitCookieManager  *manager;
+
+    guint                 pending;
+    guint                 failed;
+    GHashTable           *cookies;
+
+    UzblCookiesCollected  callback;
+    gpointer              data;
+} UzblCookieCollection;
+
+static void
+collect_domains_cb (GObject *object, GAsyncResult *res, gpointer data);
+static void
+collect_cookies_cb (GObject *object, GAsyncResult *res, gpointer data);
+
+void
+collect_cookies (UzblCookiesCollected callback, gpointer data)
+{
+    WebKitCookieManager *manager = cookie_manager ();
+
+    if (!manager) {
+        GHashTable *cookies = cookie_table_new ();
+        callback (cookies, 1, data);
+        g_hash_table_unref (cookies);
+        return;
+    }
+
+    WebKitWebContext *context = webkit_web_view_get_context (uzbl.gui.web_view);
+    WebKitWebsiteDataManager *data_manager = webkit_web_context_get_website_data_manager (context);
+    UzblCookieCollection *collection = g_malloc0 (sizeof (UzblCookieCollection));
+
+    collection->manager = g_object_ref (manager);
+    collection->cookies = cookie_table_new ();
+    collection->callback = callback;
+    collection->data = data;
+
+    /* There is no way to list every cookie, so ask for the domains which have
+     * any and then for the cookies of each of them. */
+    webkit_website_data_manager_fetch (data_manager, WEBKIT_WEBSITE_DATA_COOKIES,
+                                       NULL, collect_domains_cb, collection);
+}
+
+void
+collect_domains_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    UzblCookieCollection *collection = (UzblCookieCollection *)data;
+    GError *err = NULL;
+    GList *sites = webkit_website_data_manager_fetch_finish (WEBKIT_WEBSITE_DATA_MANAGER (object), res, &err);
+    GList *site;
+
+    if (err) {
+        uzbl_debug ("Failed to list cookie domains: %s\n", err->message);
+        g_error_free (err);
+        ++collection->failed;
+    }
+
+    collection->pending = 1;
+
+    for (site = sites; site; site = g_list_next (site)) {
+        const gchar *name = webkit_website_data_get_name ((WebKitWebsiteData *)site->data);
+        gchar *uri = g_strdup_printf ("https://%s/", name);
+
+        ++collection->pending;
+        webkit_cookie_manager_get_cookies (collection->manager, uri,
+                                           NULL, collect_cookies_cb, collection);
+        g_free (uri);
+    }
+
+    g_list_free_full (sites, (GDestroyNotify)webkit_website_data_unref);
+
+    collect_cookies_cb (NULL, NULL, collection);
+}
+
+void
+collect_cookies_cb (GObject *object, GAsyncResult *res, gpointer data)
+{
+    UzblCookieCollection *collection = (UzblCookieCollection *)data;
+
+    if (res) {
+        GError *err = NULL;
+        GList *cookies = webkit_cookie_manager_get_cookies_finish (WEBKIT_COOKIE_MANAGER (object), res, &err);
+        GList *iter;
+
+        if (err) {
+            ++collection->failed;
+            uzbl_debug ("Failed to fetch cookies: %s\n", err->message);
+            g_error_free (err);
+        }
+
+        for (iter = cookies; iter; iter = g_list_next (iter)) {
+            SoupCookie *cookie = (SoupCookie *)iter->data;
+            gchar *key = g_strdup_printf ("%s\t%s\t%s",
+                                          soup_cookie_get_domain (cookie),
+                                          soup_cookie_get_path (cookie),
+                                          soup_cookie_get_name (cookie));
+
+            g_hash_table_replace (collection->cookies, key, cookie);
+        }
+
+        g_list_free (cookies);
+    }
+
+    if (--collection->pending) {
+        return;
+    }
+
+    collection->callback (collection->cookies, collection->failed, collection->data);
+
+    g_object_unref (collection->manager);
+    g_hash_table_unref (collection->cookies);
+    g_free (collection);
+}
+
+void
+export_collected (GHashTable *cookies, guint failed, gpointer data)
+{
+    gchar *path = (gchar *)data;
+    GString *lines = g_string_new ("# Netscape HTTP Cookie File\n");
+    GList *keys = g_list_sort (g_hash_table_get_keys (cookies), (GCompareFunc)strcmp);
+    GList *key;
+    GError *err = NULL;
+
+    for (key = keys; key; key = g_list_next (key)) {
+        append_netscape_cookie (lines, g_hash_table_lookup (cookies, key->data));
+    }
+
+    g_list_free (keys);
+
+    if (g_file_set_contents (path, lines->str, lines->len, &err)) {
+        uzbl_events_send (COOKIES_EXPORTED, NULL,
+            TYPE_STR, path,
+            TYPE_INT, g_hash_table_size (cookies),
+            TYPE_INT, failed,
+            NULL);
+    } else {
+        uzbl_debug ("Failed to write cookies: %s\n", err->message);
+        g_error_free (err);
+    }
+
+    g_string_free (lines, TRUE);
+    g_free (path);
+}
+
+gboolean
+refresh_snapshot (gpointer data)
+{
+    UZBL_UNUSED (data);
+
+    uzbl.cookies->refresh_id = 0;
+    uzbl.cookies->refreshing = TRUE;
+    uzbl.cookies->dirty = FALSE;
+
+    collect_cookies (snapshot_collected, NULL);
+
+    return FALSE;
+}
+
+static void
+append_cookie_fields (GArray *fields, SoupCookie *cookie);
+
+void
+snapshot_collected (GHashTable *cookies, guint failed, gpointer data)
+{
+    UZBL_UNUSED (data);
+
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+
+    uzbl.cookies->refreshing = FALSE;
+
+    /* A partial listing would show up as removals; wait for the next change
+     * instead. */
+    if (failed) {
+        uzbl_debug ("Failed to refresh the cookie snapshot\n");
+    } else if (uzbl.cookies->silent) {
+        uzbl.cookies->silent = FALSE;
+    } else {
+        GArray *fields = uzbl_commands_args_new ();
+        guint added = 0;
+        guint removed = 0;
+
+        /* Changed cookies are reported as additions which replace the old
+         * value. */
+        g_hash_table_iter_init (&iter, cookies);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+            SoupCookie *old = g_hash_table_lookup (uzbl.cookies->snapshot, key);
+
+            if (!old || !soup_cookie_equal (old, (SoupCookie *)value)) {
+                append_cookie_fields (fields, (SoupCookie *)value);
+                ++added;
+            }
+        }
+
+        g_hash_table_iter_init (&iter, uzbl.cookies->snapshot);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+            if (!g_hash_table_contains (cookies, key)) {
+                append_cookie_fields (fields, (SoupCookie *)value);
+                ++removed;
+            }
+        }
+
+        if (added || removed) {
+            uzbl_events_send (COOKIES_CHANGED, NULL,
+                TYPE_INT, added,
+                TYPE_INT, removed,
+                TYPE_STR_ARRAY, fields,
+                NULL);
+        }
+
+        uzbl_commands_args_free (fields);
+    }
+
+    if (!failed) {
+        g_hash_table_unref (uzbl.cookies->snapshot);
+        uzbl.cookies->snapshot = g_hash_table_ref (cookies);
+    }
+
+    if (uzbl.cookies->dirty) {
+        uzbl_cookies_changed ();
+    }
+}
+
+void
+append_cookie_fields (GArray *fields, SoupCookie *cookie)
+{
+    SoupDate *expires = soup_cookie_get_expires (cookie);
+
+    /* The same fields as the ADD_COOKIE and DELETE_COOKIE events. */
+    uzbl_commands_args_append (fields, g_strdup (soup_cookie_get_domain (cookie)));
+    uzbl_commands_args_append (fields, g_strdup (soup_cookie_get_path (cookie)));
+    uzbl_commands_args_append (fields, g_strdup (soup_cookie_get_name (cookie)));
+    uzbl_commands_args_append (fields, g_strdup (soup_cookie_get_value (cookie)));
+    uzbl_commands_args_append (fields, g_strconcat (
+        soup_cookie_get_secure (cookie) ? "https" : "http",
+        soup_cookie_get_http_only (cookie) ? "Only" : "",
+        NULL));
+    uzbl_commands_args_append (fields, expires ?
+        g_strdup_printf ("%ld", (long)soup_date_to_time_t (expires)) :
+        g_strdup (""));
+}
+#endif
@@ -0,0 +1,24 @@
+#ifndef UZBL_COOKIES_H
+#define UZBL_COOKIES_H
+
+#include <glib.h>
+
+/* Adds the cookies from a Netscape cookies.txt file; COOKIES_IMPORTED is sent
+ * once all of them have been stored. */
+void
+uzbl_cookies_import (const gchar *path);
+/* Writes every cookie to a Netscape cookies.txt file and sends
+ * COOKIES_EXPORTED. */
+void
+uzbl_cookies_export (const gchar *path);
+
+/* Schedules a COOKIES_CHANGED event for the cookies changed since the last
+ * one. Changes within a short window are sent together. */
+void
+uzbl_cookies_changed ();
+/* Takes a new snapshot without reporting the differences (e.g., after the
+ * cookie storage has been replaced). */
+void
+uzbl_cookies_reset ();
+
+#endif
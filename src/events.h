@@ -47,6 +47,9 @@
     call (DOWNLOAD_COMPLETE),   \
     call (ADD_COOKIE),          \
     call (DELETE_COOKIE),       \
+    call (COOKIES_IMPORTED),    \
+    call (COOKIES_EXPORTED),    \
+    call (COOKIES_CHANGED),     \
     call (FOCUS_ELEMENT),       \
     call (BLUR_ELEMENT),        \
     call (WEB_PROCESS_CRASHED), \
@@ -57,6 +60,7 @@
     call (SCRIPT_MESSAGE),      \
     call (SHOW_NOTIFICATION),   \
     call (CLOSE_NOTIFICATION),  \
+    call (REQUESTS_BLOCKED),    \
     /* Must be last entry. */   \
     call (LAST_EVENT)
 
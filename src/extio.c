@@ -1,248 +1,413 @@
 #include "extio.h"
 #include "util.h"
 
-#define HEADER_SIZE 8
+#include <string.h>
 
-static void
-read_header_async (GInputStream        *stream,
-                   GAsyncReadyCallback  callback,
-                   gpointer             user_data);
-static GVariant*
-read_header_finish (GInputStream  *stream,
-                    GAsyncResult  *result,
-                    GError       **error);
-static void
-read_payload_async (GInputStream        *stream,
-                    ExtIOMessageType     type,
-                    gsize                size,
-                    GAsyncReadyCallback  callback,
-                    gpointer             user_data);
-static GVariant*
-read_payload_finish (GInputStream      *stream,
-                     GAsyncResult      *result,
-                     ExtIOMessageType  *messagetype,
-                     GError           **error);
+/* The header is a serialized "(iit)" GVariant: the message type, the payload
+ * size and the ID of the page the message is about, all in host byte order. */
+#define HEADER_SIZE 16
+
+typedef struct {
+    gint32  type;
+    gint32  size;
+    guint64 page_id;
+} ExtIOHeader;
+
+G_STATIC_ASSERT (sizeof (ExtIOHeader) == HEADER_SIZE);
+
+/* Size of the chunks read from the stream and the number of spare chunks
+ * kept around for reuse. */
+#define CHUNK_SIZE 16384
+#define CHUNK_POOL_MAX 8
+
+/* =========================== BUFFER POOL ========================== */
+
+G_LOCK_DEFINE_STATIC (chunk_pool);
+static GTrashStack *chunk_pool = NULL;
+static guint chunk_pool_size = 0;
 
 static void
-read_header_read_all_cb (GObject      *source,
-                         GAsyncResult *res,
-                         gpointer      user_data);
+chunk_release (gpointer data);
 
-void
-read_header_async (GInputStream        *stream,
-                   GAsyncReadyCallback  callback,
-                   gpointer             user_data)
+static GBytes *
+chunk_new (gsize size)
 {
-    void *buffer = g_malloc (HEADER_SIZE);
-    GTask *task = g_task_new (stream, NULL, callback, user_data);
+    if (size > CHUNK_SIZE) {
+        return g_bytes_new_take (g_malloc (size), size);
+    }
+
+    gpointer data;
+
+    G_LOCK (chunk_pool);
+    data = g_trash_stack_pop (&chunk_pool);
+    if (data) {
+        --chunk_pool_size;
+    }
+    G_UNLOCK (chunk_pool);
 
-    g_task_set_task_data (task, buffer, g_free);
+    if (!data) {
+        data = g_malloc (CHUNK_SIZE);
+    }
 
-    g_input_stream_read_all_async (stream, buffer, HEADER_SIZE,
-                                   G_PRIORITY_DEFAULT,
-                                   NULL,
-                                   read_header_read_all_cb,
-                                   task);
+    return g_bytes_new_with_free_func (data, CHUNK_SIZE, chunk_release, data);
 }
 
 void
-read_header_read_all_cb (GObject      *source,
-                         GAsyncResult *res,
-                         gpointer      user_data)
+chunk_release (gpointer data)
 {
-    GInputStream *stream = G_INPUT_STREAM (source);
-    GTask *task = G_TASK (user_data);
-    gsize read;
-    GError *error;
-    void *buffer = g_task_get_task_data (task);
-
-    if (!g_input_stream_read_all_finish (stream, res, &read, &error)) {
-        g_task_return_error (task, error);
-        return;
+    G_LOCK (chunk_pool);
+    if (chunk_pool_size < CHUNK_POOL_MAX) {
+        g_trash_stack_push (&chunk_pool, data);
+        ++chunk_pool_size;
+        data = NULL;
     }
+    G_UNLOCK (chunk_pool);
 
-    const GVariantType *type = g_variant_type_new ("(ii)");
-    GVariant *var = g_variant_new_from_data (type, buffer, read, FALSE,
-                                             NULL, NULL);
-
-    g_task_return_pointer (task, var, NULL);
+    g_free (data);
 }
 
-GVariant*
-read_header_finish (GInputStream  *stream,
-                    GAsyncResult  *result,
-                    GError       **error)
+/* ============================= READER ============================= */
+
+struct _ExtIOReader {
+    GInputStream         *stream;
+    GCancellable         *cancellable;
+    ExtIOMessageCallback  callback;
+    gpointer              user_data;
+
+    /* The chunk being filled. Decoded messages keep references to the slices
+     * they were created from, so chunks are only reused once all of those
+     * messages are gone. */
+    GBytes *chunk;
+    guint8 *data;
+    gsize   capacity;
+    gsize   start;
+    gsize   end;
+
+    /* Set while a read is pending or its messages are being handled; the
+     * reader is only destroyed once that is over. */
+    gboolean reading;
+    gboolean freed;
+};
+
+static void
+reader_read (ExtIOReader *reader);
+
+ExtIOReader *
+uzbl_extio_reader_new (GInputStream         *stream,
+                       ExtIOMessageCallback  callback,
+                       gpointer              user_data)
 {
-    UZBL_UNUSED (stream);
-    GTask *task = G_TASK (result);
+    ExtIOReader *reader = g_slice_new0 (ExtIOReader);
 
-    return (GVariant*) g_task_propagate_pointer (task, error);
-}
+    reader->stream = g_object_ref (stream);
+    reader->cancellable = g_cancellable_new ();
+    reader->callback = callback;
+    reader->user_data = user_data;
 
+    reader_read (reader);
 
-typedef struct _ReadPayloadData ReadPayloadData;
-struct _ReadPayloadData {
-    ExtIOMessageType type;
-    void *buffer;
-};
+    return reader;
+}
 
 static void
-read_payload_read_all_cb (GObject      *source,
-                          GAsyncResult *res,
-                          gpointer      user_data);
-static void
-read_payload_data_free (gpointer data);
+reader_destroy (ExtIOReader *reader);
 
 void
-read_payload_async (GInputStream        *stream,
-                    ExtIOMessageType     type,
-                    gsize                size,
-                    GAsyncReadyCallback  callback,
-                    gpointer             user_data)
+uzbl_extio_reader_free (ExtIOReader *reader)
 {
-    ReadPayloadData *data = g_slice_new (ReadPayloadData);
-    data->buffer = g_malloc (size);
-    data->type = type;
-
-    GTask *task = g_task_new (stream, NULL, callback, user_data);
-    g_task_set_task_data (task, data, read_payload_data_free);
-    g_input_stream_read_all_async (stream, data->buffer, size,
-                                   G_PRIORITY_DEFAULT,
-                                   NULL,
-                                   read_payload_read_all_cb,
-                                   task);
+    if (!reader) {
+        return;
+    }
+
+    if (reader->reading) {
+        /* The pending read owns the reader until it is cancelled or its
+         * messages have been handled. */
+        reader->freed = TRUE;
+        g_cancellable_cancel (reader->cancellable);
+        return;
+    }
+
+    reader_destroy (reader);
 }
 
+static void
+reader_read_cb (GObject      *source,
+                GAsyncResult *res,
+                gpointer      user_data);
+
 void
-read_payload_data_free (gpointer data)
+reader_read (ExtIOReader *reader)
 {
-    ReadPayloadData *rpd = (ReadPayloadData*)data;
-    g_free (rpd->buffer);
-    g_slice_free (ReadPayloadData, rpd);
+    if (!reader->chunk) {
+        reader->chunk = chunk_new (CHUNK_SIZE);
+        reader->data = (guint8 *)g_bytes_get_data (reader->chunk, &reader->capacity);
+        reader->start = 0;
+        reader->end = 0;
+    }
+
+    reader->reading = TRUE;
+
+    g_input_stream_read_async (reader->stream,
+                               reader->data + reader->end,
+                               reader->capacity - reader->end,
+                               G_PRIORITY_DEFAULT,
+                               reader->cancellable,
+                               reader_read_cb,
+                               reader);
 }
 
+static gboolean
+reader_decode (ExtIOReader *reader);
+static void
+reader_rebase (ExtIOReader *reader);
+
 void
-read_payload_read_all_cb (GObject      *source,
-                          GAsyncResult *res,
-                          gpointer      user_data)
+reader_read_cb (GObject      *source,
+                GAsyncResult *res,
+                gpointer      user_data)
 {
-    GInputStream *stream = G_INPUT_STREAM (source);
-    GTask *task = G_TASK (user_data);
-    gsize read;
+    ExtIOReader *reader = (ExtIOReader *)user_data;
     GError *error = NULL;
-    ReadPayloadData *data = g_task_get_task_data (task);
+    gssize read = g_input_stream_read_finish (G_INPUT_STREAM (source), res, &error);
 
-    if (!g_input_stream_read_all_finish (stream, res, &read, &error)) {
-        g_task_return_error (task, error);
+    if (reader->freed) {
+        g_clear_error (&error);
+        reader_destroy (reader);
         return;
     }
 
-    const GVariantType *type = uzbl_extio_get_variant_type (data->type);
-    GVariant *var = g_variant_new_from_data (type, data->buffer, read, FALSE,
-                                             NULL, NULL);
-    g_task_return_pointer (task, var, NULL);
+    if (read <= 0) {
+        /* End of stream or an error; either way no more messages. */
+        reader->callback (0, EXTIO_NO_PAGE, NULL, error, reader->user_data);
+        g_clear_error (&error);
+    } else {
+        reader->end += read;
+
+        if (reader_decode (reader)) {
+            reader_rebase (reader);
+            reader_read (reader);
+            return;
+        }
+    }
+
+    /* No more reads; the callbacks may have freed the reader meanwhile. */
+    reader->reading = FALSE;
+
+    if (reader->freed) {
+        reader_destroy (reader);
+    }
 }
 
-GVariant*
-read_payload_finish (GInputStream      *stream,
-                     GAsyncResult      *result,
-                     ExtIOMessageType  *messagetype,
-                     GError           **error)
+gboolean
+reader_decode (ExtIOReader *reader)
 {
-    UZBL_UNUSED (stream);
-    GTask *task = G_TASK (result);
-    ReadPayloadData *data = g_task_get_task_data (task);
+    while (reader->end - reader->start >= HEADER_SIZE) {
+        ExtIOHeader header;
+        memcpy (&header, reader->data + reader->start, HEADER_SIZE);
+
+        ExtIOMessageType type = header.type;
+        gint32 size = header.size;
+
+        if (size < 0) {
+            GError *error = g_error_new (G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                                         "invalid message size %d", size);
+            reader->callback (type, header.page_id, NULL, error, reader->user_data);
+            g_error_free (error);
+            return FALSE;
+        }
+
+        if (reader->end - reader->start - HEADER_SIZE < (gsize)size) {
+            break;
+        }
+
+        gsize offset = reader->start + HEADER_SIZE;
+        const GVariantType *vt = uzbl_extio_get_variant_type (type);
+
+        reader->start = offset + size;
+
+        if (!vt) {
+            g_debug ("skipping message of unknown type %d", type);
+            continue;
+        }
+
+        /* Messages are decoded straight out of the chunk unless the payload
+         * is misaligned for its type, in which case GVariant needs its own
+         * copy. Strings have no alignment requirements. */
+        GBytes *payload;
+        if (((offset % 8) == 0) || g_variant_type_equal (vt, G_VARIANT_TYPE_STRING)) {
+            payload = g_bytes_new_from_bytes (reader->chunk, offset, size);
+        } else {
+            payload = g_bytes_new (reader->data + offset, size);
+        }
+
+        GVariant *message = g_variant_ref_sink (g_variant_new_from_bytes (vt, payload, FALSE));
+        g_bytes_unref (payload);
+
+        reader->callback (type, header.page_id, message, NULL, reader->user_data);
+
+        g_variant_unref (message);
+
+        if (reader->freed) {
+            return FALSE;
+        }
+    }
 
-    *messagetype = data->type;
-    return (GVariant*) g_task_propagate_pointer (task, error);
+    return TRUE;
 }
 
-static void
-read_header_cb (GObject      *source,
-                GAsyncResult *res,
-                gpointer      user_data);
-static void
-read_payload_cb (GObject     *source,
-                GAsyncResult *res,
-                gpointer      user_data);
-
 void
-uzbl_extio_read_message_async (GInputStream        *stream,
-                               GAsyncReadyCallback  callback,
-                               gpointer             user_data)
+reader_rebase (ExtIOReader *reader)
 {
-    GTask *task = g_task_new (stream, NULL, callback, user_data);
+    gsize remaining = reader->end - reader->start;
+    gsize needed = CHUNK_SIZE;
+
+    if (remaining >= HEADER_SIZE) {
+        ExtIOHeader header;
+        memcpy (&header, reader->data + reader->start, HEADER_SIZE);
+        needed = MAX (needed, HEADER_SIZE + (gsize)header.size);
+    }
 
-    read_header_async (stream, read_header_cb, (gpointer) task);
+    /* Keep filling the current chunk while nothing has been taken out of it
+     * and the pending message fits. */
+    if (!reader->start && (reader->end < reader->capacity) && (needed <= reader->capacity)) {
+        return;
+    }
+
+    GBytes *chunk = chunk_new (needed);
+    guint8 *data = (guint8 *)g_bytes_get_data (chunk, NULL);
+
+    memcpy (data, reader->data + reader->start, remaining);
+
+    g_bytes_unref (reader->chunk);
+    reader->chunk = chunk;
+    reader->data = data;
+    reader->capacity = g_bytes_get_size (chunk);
+    reader->start = 0;
+    reader->end = remaining;
 }
 
 void
-read_header_cb (GObject      *source,
-                GAsyncResult *res,
-                gpointer      user_data)
+reader_destroy (ExtIOReader *reader)
 {
-    GInputStream *stream = G_INPUT_STREAM (source);
-    GTask *task = G_TASK (user_data);
+    if (reader->chunk) {
+        g_bytes_unref (reader->chunk);
+    }
+    g_object_unref (reader->cancellable);
+    g_object_unref (reader->stream);
 
-    GError *error = NULL;
+    g_slice_free (ExtIOReader, reader);
+}
 
-    GVariant *header;
+/* ============================= WRITER ============================= */
 
-    if (!(header = read_header_finish (stream, res, &error))) {
-        g_task_return_error (task, error);
-        return;
+/* Messages sent during one main loop iteration are written together. */
+typedef struct {
+    GOutputStream *stream;
+    GByteArray    *pending;
+    guint          flush_id;
+} ExtIOWriter;
+
+static void
+writer_free (gpointer data);
+static gboolean
+writer_flush_cb (gpointer data);
+
+static ExtIOWriter *
+get_writer (GOutputStream *stream)
+{
+    static GQuark writer_quark = 0;
+
+    if (!writer_quark) {
+        writer_quark = g_quark_from_static_string ("uzbl-extio-writer");
     }
 
-    gint32 type;
-    gint32 size;
+    ExtIOWriter *writer = g_object_get_qdata (G_OBJECT (stream), writer_quark);
+
+    if (!writer) {
+        writer = g_slice_new0 (ExtIOWriter);
+        writer->stream = stream;
+        writer->pending = g_byte_array_sized_new (CHUNK_SIZE);
+
+        g_object_set_qdata_full (G_OBJECT (stream), writer_quark, writer, writer_free);
+    }
 
-    g_variant_get (header, "(ii)", &type, &size);
-    UZBL_UNUSED (type);
-    read_payload_async (stream, type, size, read_payload_cb, (gpointer) task);
+    return writer;
 }
 
-void
-read_payload_cb (GObject     *source,
-                GAsyncResult *res,
-                gpointer      user_data)
+static void
+writer_flush (ExtIOWriter *writer)
 {
-    GInputStream *stream = G_INPUT_STREAM (source);
-    GTask *task = G_TASK (user_data);
     GError *error = NULL;
-    ExtIOMessageType messagetype;
-    GVariant *var;
 
-    if (!(var = read_payload_finish (stream, res, &messagetype, &error))) {
-        g_task_return_error (task, error);
+    if (writer->flush_id) {
+        g_source_remove (writer->flush_id);
+        writer->flush_id = 0;
+    }
+
+    if (!writer->pending->len) {
         return;
     }
 
-    g_task_set_task_data (task, GINT_TO_POINTER (messagetype), NULL);
-    g_task_return_pointer (task, var, g_free);
+    if (!g_output_stream_write_all (writer->stream,
+                                    writer->pending->data, writer->pending->len,
+                                    NULL, NULL, &error)) {
+        g_warning ("writing extension messages: %s", error->message);
+        g_error_free (error);
+    }
+
+    g_byte_array_set_size (writer->pending, 0);
 }
 
-GVariant *
-uzbl_extio_read_message_finish (GInputStream      *stream,
-                                GAsyncResult      *result,
-                                ExtIOMessageType  *messagetype,
-                                GError           **error)
+gboolean
+writer_flush_cb (gpointer data)
+{
+    ExtIOWriter *writer = (ExtIOWriter *)data;
+
+    writer->flush_id = 0;
+    writer_flush (writer);
+
+    return G_SOURCE_REMOVE;
+}
+
+void
+writer_free (gpointer data)
 {
-    UZBL_UNUSED (stream);
-    GTask *task = G_TASK (result);
+    ExtIOWriter *writer = (ExtIOWriter *)data;
+
+    if (writer->flush_id) {
+        g_source_remove (writer->flush_id);
+    }
+    g_byte_array_free (writer->pending, TRUE);
 
-    *messagetype = GPOINTER_TO_INT (g_task_get_task_data (task));
-    return (GVariant*) g_task_propagate_pointer (task, error);
+    g_slice_free (ExtIOWriter, writer);
 }
 
+/* =========================== PUBLIC API =========================== */
+
 const GVariantType *
 uzbl_extio_get_variant_type (ExtIOMessageType type)
 {
     switch (type) {
     case EXT_HELO:
         return G_VARIANT_TYPE ("i");
-    case EXT_FOCUS:
-    case EXT_BLUR:
-        return G_VARIANT_TYPE ("s");
+    case EXT_EDITABLE:
+        /* (editable, tag name) */
+        return G_VARIANT_TYPE ("(bs)");
+    case EXT_COLLECT_HINTS:
+        /* (serial, mode) */
+        return G_VARIANT_TYPE ("(us)");
+    case EXT_HINTS:
+        /* (serial, hints) */
+        return G_VARIANT_TYPE ("(ua" EXTIO_HINT_FORMAT ")");
+    case EXT_BLOCK_RULES:
+        /* (command, argument) */
+        return G_VARIANT_TYPE ("(ss)");
+    case EXT_BLOCK_STATS:
+        /* (blocked, checked) */
+        return G_VARIANT_TYPE ("(uu)");
+    case EXT_PRECONNECT:
+        /* (origin) */
+        return G_VARIANT_TYPE ("(s)");
     }
 
     return 0;
@@ -251,42 +416,50 @@ uzbl_extio_get_variant_type (ExtIOMessageType type)
 void
 uzbl_extio_send_message (GOutputStream    *stream,
                          ExtIOMessageType  type,
+                         guint64           page_id,
                          GVariant         *message)
 {
+    ExtIOWriter *writer = get_writer (stream);
     gsize size = g_variant_get_size (message);
-    GVariant *header = g_variant_new ("(ii)", type, size);
+    ExtIOHeader header = { type, size, page_id };
+    guint offset = writer->pending->len;
 
-    gsize headersize = g_variant_get_size (header);
-    gchar *buf = g_malloc (headersize);
-    g_variant_store (header, buf);
+    g_byte_array_set_size (writer->pending, offset + HEADER_SIZE + size);
+    memcpy (writer->pending->data + offset, &header, HEADER_SIZE);
+    g_variant_store (message, writer->pending->data + offset + HEADER_SIZE);
 
-    g_output_stream_write (stream, buf, headersize, NULL, NULL);
-    g_variant_unref (header);
-    g_free (buf);
+    if (!writer->flush_id) {
+        writer->flush_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                                            writer_flush_cb, writer, NULL);
+    }
+}
 
-    buf = g_malloc (size);
-    g_variant_store (message, buf);
-    g_output_stream_write (stream, buf, size, NULL, NULL);
+void
+uzbl_extio_flush (GOutputStream *stream)
+{
+    writer_flush (get_writer (stream));
 }
 
 void
 uzbl_extio_send_new_messagev (GOutputStream    *stream,
                               ExtIOMessageType  type,
+                              guint64           page_id,
                               va_list *vargs)
 {
     GVariant *message = uzbl_extio_new_messagev (type, vargs);
-    uzbl_extio_send_message (stream, type, message);
+    uzbl_extio_send_message (stream, type, page_id, message);
     g_variant_unref (message);
 }
 
 void
 uzbl_extio_send_new_message (GOutputStream    *stream,
                              ExtIOMessageType  type,
+                             guint64           page_id,
                              ...)
 {
     va_list vargs;
-    va_start (vargs, type);
-    uzbl_extio_send_new_messagev (stream, type, &vargs);
+    va_start (vargs, page_id);
+    uzbl_extio_send_new_messagev (stream, type, page_id, &vargs);
     va_end (vargs);
 }
 
@@ -4,40 +4,66 @@
 #include <glib.h>
 #include <gio/gio.h>
 
-#define EXTIO_PROTOCOL 1
+#define EXTIO_PROTOCOL 4
+
+/* Page ID used for messages which concern the web process as a whole rather
+ * than a single page. WebKit never hands out 0 as a page ID. */
+#define EXTIO_NO_PAGE 0
 
 typedef enum {
     EXT_HELO,
-    EXT_FOCUS,
-    EXT_BLUR
+    EXT_EDITABLE,
+    EXT_COLLECT_HINTS,
+    EXT_HINTS,
+    EXT_BLOCK_RULES,
+    EXT_BLOCK_STATS,
+    EXT_PRECONNECT
 } ExtIOMessageType;
 
-void
-uzbl_extio_read_message_async (GInputStream        *stream,
-                               GAsyncReadyCallback  callback,
-                               gpointer             user_data);
+/* Each hint is (id, x, y, width, height, href); the id is stored in the
+ * element's data-uzbl-hint attribute. */
+#define EXTIO_HINT_FORMAT "(uiiiis)"
 
-GVariant *
-uzbl_extio_read_message_finish (GInputStream      *stream,
-                                GAsyncResult      *result,
-                                ExtIOMessageType  *messagetype,
-                                GError           **error);
+/* Called for each message read from the stream along with the ID of the page
+ * it is addressed to. On end of stream or error, it is called once more with
+ * a NULL message and no further reads are done. */
+typedef void (*ExtIOMessageCallback) (ExtIOMessageType  type,
+                                      guint64           page_id,
+                                      GVariant         *message,
+                                      const GError     *error,
+                                      gpointer          user_data);
+
+typedef struct _ExtIOReader ExtIOReader;
+
+ExtIOReader *
+uzbl_extio_reader_new (GInputStream         *stream,
+                       ExtIOMessageCallback  callback,
+                       gpointer              user_data);
+void
+uzbl_extio_reader_free (ExtIOReader *reader);
 
 const GVariantType *
 uzbl_extio_get_variant_type (ExtIOMessageType type);
 
+/* Messages are queued and written out together once the main loop is idle;
+ * use uzbl_extio_flush to write them out immediately. */
 void
 uzbl_extio_send_message (GOutputStream    *stream,
                          ExtIOMessageType  type,
+                         guint64           page_id,
                          GVariant         *message);
+void
+uzbl_extio_flush (GOutputStream *stream);
 
 void
 uzbl_extio_send_new_messagev (GOutputStream    *stream,
                               ExtIOMessageType  type,
+                              guint64           page_id,
                               va_list *vargs);
 void
 uzbl_extio_send_new_message (GOutputStream    *stream,
                              ExtIOMessageType  type,
+                             guint64           page_id,
                              ...);
 
 GVariant *
@@ -1,9 +1,14 @@
 #include "gui.h"
 
+#include "binds.h"
 #include "commands.h"
+#include "cookies.h"
 #include "events.h"
+#include "history.h"
 #include "io.h"
 #include "menu.h"
+#include "rules.h"
+#include "sites.h"
 #include "status-bar.h"
 #include "type.h"
 #include "util.h"
@@ -42,11 +47,22 @@ struct _UzblGui {
     GdkEventButton *last_button;
 
     gboolean load_failed;
+    /* Set while loading the target of a navigation rewrite. */
+    gboolean rewrite_pending;
 #if WEBKIT_CHECK_VERSION (2, 5, 1)
     WebKitUserContentManager *user_manager;
 #endif
 
     WebKitWebView *tmp_web_view;
+
+    /* Hover prefetching */
+    GHashTable *prefetched;
+    guint prefetch_budget_used;
+    guint prefetch_count;
+    guint prefetch_duplicates;
+    guint prefetch_over_budget;
+    guint prefetch_hits;
+    guint prefetch_misses;
 };
 
 /* =========================== PUBLIC API =========================== */
@@ -75,6 +91,8 @@ uzbl_gui_init (const gchar *cache_dir,
                const gchar *web_extensions_dir)
 {
     uzbl.gui_ = g_malloc0 (sizeof (UzblGui));
+    uzbl.gui_->prefetched = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, g_free);
 
     status_bar_init ();
     WebKitWebContext *context = create_web_context (cache_dir, data_dir, web_extensions_dir);
@@ -117,6 +135,8 @@ uzbl_gui_free ()
         g_object_unref (uzbl.gui_->tmp_web_view);
     }
 
+    g_hash_table_destroy (uzbl.gui_->prefetched);
+
     g_free (uzbl.gui_);
     uzbl.gui_ = NULL;
 }
@@ -215,6 +235,18 @@ update_title_expand_title_cb (GObject      *source,
     g_free (format);
 }
 
+void
+uzbl_gui_prefetch_stats (GString *result)
+{
+    g_string_append_printf (result,
+        "prefetched %u duplicates %u over_budget %u hits %u misses %u",
+        uzbl.gui_->prefetch_count,
+        uzbl.gui_->prefetch_duplicates,
+        uzbl.gui_->prefetch_over_budget,
+        uzbl.gui_->prefetch_hits,
+        uzbl.gui_->prefetch_misses);
+}
+
 
 /* ===================== HELPER IMPLEMENTATIONS ===================== */
 
@@ -335,6 +367,8 @@ static void
 download_cb (WebKitWebContext *context, WebKitDownload *download, gpointer data);
 static void
 extension_cb (WebKitWebContext *context, gpointer data);
+static void
+cookies_changed_cb (WebKitCookieManager *manager, gpointer data);
 static gboolean
 permission_cb (WebKitWebView *view, WebKitPermissionRequest *request, gpointer data);
 #if WEBKIT_CHECK_VERSION (2, 5, 90)
@@ -399,6 +433,10 @@ web_view_init (WebKitWebContext *context)
         "signal::initialize-web-extensions",            G_CALLBACK (extension_cb),             NULL,
         NULL);
 
+    g_object_connect (G_OBJECT (webkit_web_context_get_cookie_manager (context)),
+        "signal::changed",                              G_CALLBACK (cookies_changed_cb),       NULL,
+        NULL);
+
     g_object_connect (G_OBJECT (uzbl.gui.web_view),
         /* Keyboard events */
         "signal::key-press-event",                      G_CALLBACK (key_press_cb),             NULL,
@@ -528,6 +566,7 @@ uzbl_input_commit_cb (GtkIMContext *context, const gchar *str, gpointer data)
     UzblGui *gui = (UzblGui *)data;
 
     gchar *modifiers = get_modifier_mask (gui->current_key_state);
+    uzbl_binds_flush ();
     uzbl_events_send (KEY_PRESS, NULL,
         TYPE_STR, modifiers,
         TYPE_STR, str,
@@ -686,6 +725,8 @@ button_release_cb (GtkWidget *widget, GdkEventButton *event, gpointer data)
 
 static void
 send_hover_event (const gchar *uri, const gchar *title);
+static void
+hover_prefetch (const gchar *uri);
 
 void
 mouse_target_cb (WebKitWebView *view, WebKitHitTestResult *hit_test, guint modifiers, gpointer data)
@@ -712,6 +753,7 @@ mouse_target_cb (WebKitWebView *view, WebKitHitTestResult *hit_test, guint modif
     const gchar *title = webkit_hit_test_result_get_link_title (hit_test);
 
     send_hover_event (uri, title);
+    hover_prefetch (uri);
 }
 
 /* Page metadata events */
@@ -867,6 +909,26 @@ load_changed_cb (WebKitWebView *view, WebKitLoadEvent event, gpointer data)
 
     const gchar *uri = webkit_web_view_get_uri (view);
 
+    /* Rules aren't applied again to the load of a rewritten URI, so a rule
+     * whose result matches itself can't loop. */
+    if ((event == WEBKIT_LOAD_STARTED) && uzbl.gui_->rewrite_pending) {
+        uzbl.gui_->rewrite_pending = FALSE;
+    } else if (event == WEBKIT_LOAD_STARTED) {
+        gchar *rewritten = NULL;
+
+        /* Only main frame loads start here, so subframes are left alone. */
+        if ((uzbl_rules_match (UZBL_RULES_NAVIGATION, uri, &rewritten) == UZBL_RULE_REWRITE) &&
+            g_strcmp0 (rewritten, uri)) {
+            uzbl_debug ("Navigation rewritten -> %s\n", rewritten);
+            uzbl.gui_->rewrite_pending = TRUE;
+            webkit_web_view_load_uri (view, rewritten);
+            g_free (rewritten);
+            return;
+        }
+
+        g_free (rewritten);
+    }
+
     send_load_status (event, uri);
 }
 
@@ -1024,6 +1086,15 @@ extension_cb (WebKitWebContext *context, gpointer data)
         NULL);
 }
 
+void
+cookies_changed_cb (WebKitCookieManager *manager, gpointer data)
+{
+    UZBL_UNUSED (manager);
+    UZBL_UNUSED (data);
+
+    uzbl_cookies_changed ();
+}
+
 static gboolean
 request_permission (const gchar *uri, const gchar *type, const gchar *desc, GObject *obj);
 
@@ -1610,6 +1681,7 @@ send_keypress_event (GdkEventKey *event)
     } else if (event->is_modifier && mod) {
         gchar *newmods = get_modifier_mask (mod);
 
+        uzbl_binds_flush ();
         uzbl_events_send ((event->type == GDK_KEY_PRESS) ? MOD_PRESS : MOD_RELEASE, NULL,
             TYPE_STR, modifiers,
             TYPE_NAME, newmods,
@@ -1622,12 +1694,16 @@ send_keypress_event (GdkEventKey *event)
          * combining chars right. */
         ulen = g_unichar_to_utf8 (ukval, ucs);
         ucs[ulen] = 0;
-        uzbl_events_send ((event->type == GDK_KEY_PRESS) ? KEY_PRESS : KEY_RELEASE, NULL,
-            TYPE_STR, modifiers,
-            TYPE_STR, ucs,
-            NULL);
+        /* Binds the core can run do not wait for the event manager. */
+        if ((event->type != GDK_KEY_PRESS) || !uzbl_binds_key_press (modifiers, ucs)) {
+            uzbl_events_send ((event->type == GDK_KEY_PRESS) ? KEY_PRESS : KEY_RELEASE, NULL,
+                TYPE_STR, modifiers,
+                TYPE_STR, ucs,
+                NULL);
+        }
     } else if ((keyname = gdk_keyval_name (event->keyval))) {
         /* Send keysym for non-printable chars. */
+        uzbl_binds_flush ();
         uzbl_events_send ((event->type == GDK_KEY_PRESS) ? KEY_PRESS : KEY_RELEASE, NULL,
             TYPE_STR, modifiers,
             TYPE_NAME, keyname,
@@ -1680,6 +1756,7 @@ send_button_event (guint buttonval, guint state, gint mode)
 
     details = g_strdup_printf ("%sButton%d", reps, buttonval);
 
+    uzbl_binds_flush ();
     uzbl_events_send ((mode == GDK_BUTTON_PRESS) ? KEY_PRESS : KEY_RELEASE, NULL,
         TYPE_STR, modifiers,
         TYPE_FORMATTEDSTR, details,
@@ -1716,8 +1793,96 @@ send_hover_event (const gchar *uri, const gchar *title)
     uzbl_gui_update_title ();
 }
 
+static gboolean
+prefetch_expired (gpointer key, gpointer value, gpointer data);
+
+void
+hover_prefetch (const gchar *uri)
+{
+    gboolean preconnect = uzbl_variables_get_int ("preconnect_on_hover");
+
+    if (!preconnect && !uzbl_variables_get_int ("prefetch_on_hover")) {
+        return;
+    }
+
+    SoupURI *soup_uri = soup_uri_new (uri);
+
+    if (!soup_uri) {
+        return;
+    }
+
+    const gchar *host = soup_uri_get_host (soup_uri);
+
+    if (!host || !*host || !SOUP_URI_IS_VALID (soup_uri) ||
+        ((soup_uri->scheme != SOUP_URI_SCHEME_HTTP) && (soup_uri->scheme != SOUP_URI_SCHEME_HTTPS))) {
+        soup_uri_free (soup_uri);
+        return;
+    }
+
+    gint64 now = g_get_monotonic_time ();
+    gint64 window = (gint64)uzbl_variables_get_int ("prefetch_window") * G_USEC_PER_SEC;
+    gint64 *last = g_hash_table_lookup (uzbl.gui_->prefetched, host);
+
+    if (last && (now - *last < window)) {
+        ++uzbl.gui_->prefetch_duplicates;
+        soup_uri_free (soup_uri);
+        return;
+    }
+
+    if (uzbl.gui_->prefetch_budget_used >= (guint)MAX (uzbl_variables_get_int ("prefetch_budget"), 0)) {
+        ++uzbl.gui_->prefetch_over_budget;
+        soup_uri_free (soup_uri);
+        return;
+    }
+
+    ++uzbl.gui_->prefetch_budget_used;
+    ++uzbl.gui_->prefetch_count;
+
+    /* Keep the table from growing with every host ever hovered. */
+    if (g_hash_table_size (uzbl.gui_->prefetched) >= 256) {
+        g_hash_table_foreach_remove (uzbl.gui_->prefetched, prefetch_expired, &now);
+    }
+
+    gint64 *stamp = g_new (gint64, 1);
+    *stamp = now;
+    g_hash_table_replace (uzbl.gui_->prefetched, g_strdup (host), stamp);
+
+    uzbl_debug ("Prefetching on hover -> %s\n", host);
+
+    WebKitWebContext *context = webkit_web_view_get_context (uzbl.gui.web_view);
+    webkit_web_context_prefetch_dns (context, host);
+
+    if (preconnect) {
+        /* The page's web process opens the connection. */
+        SoupURI *origin_uri = soup_uri_copy_host (soup_uri);
+        gchar *origin = soup_uri_to_string (origin_uri, FALSE);
+
+        uzbl_io_send_ext_message (EXT_PRECONNECT,
+                                  webkit_web_view_get_page_id (uzbl.gui.web_view),
+                                  origin);
+
+        g_free (origin);
+        soup_uri_free (origin_uri);
+    }
+
+    soup_uri_free (soup_uri);
+}
+
+gboolean
+prefetch_expired (gpointer key, gpointer value, gpointer data)
+{
+    UZBL_UNUSED (key);
+
+    gint64 now = *(gint64 *)data;
+    gint64 window = (gint64)uzbl_variables_get_int ("prefetch_window") * G_USEC_PER_SEC;
+
+    return (now - *(gint64 *)value >= window);
+}
+
 static void
 decide_navigation (GObject *source, GAsyncResult *res, gpointer data);
+static void
+count_prefetch (const gchar *uri);
 
 gboolean
 navigation_decision (WebKitPolicyDecision *decision, const gchar *uri, const gchar *src_frame,
@@ -1730,6 +1895,10 @@ navigation_decision (WebKitPolicyDecision *decision, const gchar *uri, const gch
 
     uzbl_debug ("Navigation requested -> %s\n", uri);
 
+    if (!g_strcmp0 (type, "link")) {
+        count_prefetch (uri);
+    }
+
     uzbl_events_send (NAVIGATION_STARTING, NULL,
         TYPE_STR, uri,
         TYPE_STR, src_frame ? src_frame : "",
@@ -1737,10 +1906,40 @@ navigation_decision (WebKitPolicyDecision *decision, const gchar *uri, const gch
         TYPE_STR, type,
         NULL);
 
-    gchar *handler = uzbl_variables_get_string ("navigation_handler");
+    gchar *handler = NULL;
+    gchar *argument = NULL;
+
+    /* Rules decide without a round trip through the handler. */
+    switch (uzbl_rules_match (UZBL_RULES_NAVIGATION, uri, &argument)) {
+    case UZBL_RULE_ALLOW:
+        make_policy (decision, use);
+        return TRUE;
+    case UZBL_RULE_IGNORE:
+        make_policy (decision, ignore);
+        return TRUE;
+    case UZBL_RULE_DOWNLOAD:
+        make_policy (decision, download);
+        return TRUE;
+    case UZBL_RULE_REWRITE:
+        /* WebKit does not say which frame the navigation is for, so it is
+         * rewritten once it is known to be loading in the main frame. */
+        make_policy (decision, use);
+        g_free (argument);
+        return TRUE;
+    case UZBL_RULE_DELEGATE:
+        handler = argument;
+        break;
+    case UZBL_RULE_NONE:
+    default:
+        handler = uzbl_variables_get_string ("navigation_handler");
+        break;
+    }
 
     GArray *args = uzbl_commands_args_new ();
-    const UzblCommand *scheme_command = uzbl_commands_parse (handler, args);
+    /* Rule commands were expanded when the rule was added. */
+    const UzblCommand *scheme_command = argument ?
+        uzbl_commands_parse_expanded (handler, args) :
+        uzbl_commands_parse (handler, args);
 
     if (scheme_command) {
         uzbl_commands_args_append (args, g_strdup (uri));
@@ -1774,16 +1973,41 @@ request_decision (const gchar *uri, gpointer data)
         TYPE_STR, uri,
         NULL);
 
-    gchar *handler = uzbl_variables_get_string ("request_handler");
+    WebKitResponsePolicyDecision *decision = (WebKitResponsePolicyDecision *)data;
+    gchar *handler = NULL;
+    gchar *argument = NULL;
+
+    switch (uzbl_rules_match (UZBL_RULES_REQUEST, uri, &argument)) {
+    case UZBL_RULE_ALLOW:
+        g_object_unref (decision);
+        return FALSE;
+    case UZBL_RULE_IGNORE:
+        make_policy (decision, ignore);
+        g_object_unref (decision);
+        return TRUE;
+    case UZBL_RULE_DOWNLOAD:
+        make_policy (decision, download);
+        g_object_unref (decision);
+        return TRUE;
+    case UZBL_RULE_DELEGATE:
+        handler = argument;
+        break;
+    case UZBL_RULE_NONE:
+    default:
+        handler = uzbl_variables_get_string ("request_handler");
+        break;
+    }
 
     GArray *args = uzbl_commands_args_new ();
-    const UzblCommand *request_command = uzbl_commands_parse (handler, args);
+    /* Rule commands were expanded when the rule was added. */
+    const UzblCommand *request_command = argument ?
+        uzbl_commands_parse_expanded (handler, args) :
+        uzbl_commands_parse (handler, args);
 
     if (request_command) {
         const gchar *can_display = "unknown";
 
-        WebKitResponsePolicyDecision *request = (WebKitResponsePolicyDecision *)data;
-        if (webkit_response_policy_decision_is_mime_type_supported (request)) {
+        if (webkit_response_policy_decision_is_mime_type_supported (decision)) {
             can_display = "can_display";
         } else {
             can_display = "cant_display";
@@ -1812,13 +2036,18 @@ send_load_status (WebKitLoadEvent status, const gchar *uri)
 
     switch (status) {
     case WEBKIT_LOAD_STARTED:
+        /* Apply per-site settings before anything of the page is seen. */
+        uzbl_sites_apply (uri);
         uzbl_events_send (LOAD_START, NULL,
             NULL);
         break;
     case WEBKIT_LOAD_REDIRECTED:
+        uzbl_sites_apply (uri);
         event = LOAD_REDIRECTED;
         break;
     case WEBKIT_LOAD_COMMITTED:
+        /* Each page gets its own prefetch budget. */
+        uzbl.gui_->prefetch_budget_used = 0;
         event = LOAD_COMMIT;
         break;
     case WEBKIT_LOAD_FINISHED:
@@ -1826,6 +2055,7 @@ send_load_status (WebKitLoadEvent status, const gchar *uri)
             uzbl.gui_->load_failed = FALSE;
             break;
         }
+        uzbl_history_add (uri, webkit_web_view_get_title (uzbl.gui.web_view));
         event = LOAD_FINISH;
         break;
     default:
@@ -2323,6 +2553,34 @@ button_to_modifier (guint buttonval)
     return 0;
 }
 
+void
+count_prefetch (const gchar *uri)
+{
+    if (!uzbl_variables_get_int ("prefetch_on_hover") &&
+        !uzbl_variables_get_int ("preconnect_on_hover")) {
+        return;
+    }
+
+    SoupURI *soup_uri = soup_uri_new (uri);
+
+    if (!soup_uri) {
+        return;
+    }
+
+    const gchar *host = soup_uri_get_host (soup_uri);
+    gint64 window = (gint64)uzbl_variables_get_int ("prefetch_window") * G_USEC_PER_SEC;
+    gint64 *last = host ? g_hash_table_lookup (uzbl.gui_->prefetched, host) : NULL;
+
+    /* A followed link whose host was warmed up by hovering it. */
+    if (last && (g_get_monotonic_time () - *last < window)) {
+        ++uzbl.gui_->prefetch_hits;
+    } else {
+        ++uzbl.gui_->prefetch_misses;
+    }
+
+    soup_uri_free (soup_uri);
+}
+
 void
 decide_navigation (GObject *source, GAsyncResult *res, gpointer data)
 {
@@ -6,4 +6,8 @@
 void
 uzbl_gui_update_title ();
 
+/* Appends the hover prefetching statistics. */
+void
+uzbl_gui_prefetch_stats (GString *result);
+
 #endif
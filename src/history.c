@@ -0,0 +1,1117 @@
+#include "history.h"
+
+#include "setup.h"
+#include "util.h"
+#include "uzbl-core.h"
+#include "variables.h"
+
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    gchar    *path;
+    GBytes   *records;
+    gboolean  sync;
+} UzblHistoryWrite;
+
+typedef struct {
+    guint   id;
+    gchar  *uri;
+    gchar  *title;
+    guint   visits;
+    gint64  last_visit;
+
+    /* The last query which looked at the entry. */
+    guint   seen;
+} UzblHistoryEntry;
+
+/* The index is saved next to history_file so that other instances only have
+ * to read the records added after it. The file is the header followed by the
+ * entries, the trigrams, their posting lists and the strings. */
+#define HISTORY_INDEX_MAGIC "UZBLHIX1"
+/* How much of history_file must be indexed before the index is saved. */
+#define HISTORY_INDEX_SAVE_SIZE (1 << 20)
+
+typedef struct {
+    gchar   magic[8];
+    guint64 log_offset;
+    /* Checksum of the end of the indexed part of history_file. */
+    guint32 log_check;
+    guint32 n_entries;
+    guint32 n_trigrams;
+    guint32 n_postings;
+    guint64 strings_len;
+} UzblHistoryIndexHeader;
+
+typedef struct {
+    guint32 uri;
+    guint32 title;
+    guint32 visits;
+    guint32 reserved;
+    gint64  last_visit;
+} UzblHistoryIndexEntry;
+
+typedef struct {
+    guint32 trigram;
+    guint32 start;
+    guint32 len;
+} UzblHistoryIndexTrigram;
+
+struct _UzblHistory {
+    /* Records not yet handed to a writer. */
+    GString *records;
+    guint    flush_id;
+
+    /* Only one write runs at a time so that records stay in order. */
+    GMutex   lock;
+    GCond    done;
+    gboolean writing;
+
+    /* Records added by this instance which have been indexed but not read
+     * back from the file yet, with their counts. Only kept while the index
+     * exists; it is read up to the end after every write. */
+    GHashTable *own_records;
+
+    /* Index of the visited pages. It is loaded on the first query from the
+     * saved index and the records after it in history_file and then kept up
+     * to date from new visits and the records other instances append. */
+    gchar      *index_path;
+    gsize       index_offset;
+    gsize       saved_offset;
+    GPtrArray  *entries;
+    GHashTable *by_uri;
+    /* Entry ids by the trigrams of their (lowercase) URIs and titles. */
+    GHashTable *trigrams;
+    guint       query;
+
+    /* The start of the day last seen in the file. */
+    gchar       day[11];
+    gint64      day_start;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+void
+uzbl_history_init ()
+{
+    uzbl.history = g_malloc0 (sizeof (UzblHistory));
+
+    uzbl.history->records = g_string_new ("");
+    g_mutex_init (&uzbl.history->lock);
+    g_cond_init (&uzbl.history->done);
+    uzbl.history->own_records = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, NULL);
+}
+
+static UzblHistoryWrite *
+history_write_new ();
+static void
+history_write_free (gpointer data);
+static gboolean
+write_records (UzblHistoryWrite *job, GError **error);
+static void
+update_index ();
+static void
+save_index ();
+static void
+free_index ();
+
+void
+uzbl_history_free ()
+{
+    if (uzbl.history->flush_id) {
+        g_source_remove (uzbl.history->flush_id);
+    }
+
+    /* Wait for the running write and then write the rest directly. */
+    g_mutex_lock (&uzbl.history->lock);
+    while (uzbl.history->writing) {
+        g_cond_wait (&uzbl.history->done, &uzbl.history->lock);
+    }
+    g_mutex_unlock (&uzbl.history->lock);
+
+    UzblHistoryWrite *job = history_write_new ();
+    if (job) {
+        GError *err = NULL;
+
+        if (!write_records (job, &err)) {
+            uzbl_debug ("Failed to write history: %s\n", err->message);
+            g_error_free (err);
+        }
+
+        history_write_free (job);
+    }
+
+    /* Read back the records just written so that the index matches the
+     * file and can be saved. */
+    if (uzbl.history->entries) {
+        update_index ();
+        save_index ();
+    }
+
+    free_index ();
+    g_hash_table_destroy (uzbl.history->own_records);
+
+    g_string_free (uzbl.history->records, TRUE);
+    g_mutex_clear (&uzbl.history->lock);
+    g_cond_clear (&uzbl.history->done);
+
+    g_free (uzbl.history);
+    uzbl.history = NULL;
+}
+
+static gchar *
+strip_credentials (const gchar *uri);
+static gboolean
+flush_timeout (gpointer data);
+static void
+index_visit (gchar *uri, gchar *title, gint64 time);
+
+void
+uzbl_history_add (const gchar *uri, const gchar *title)
+{
+    gchar *path = uzbl_variables_get_string ("history_file");
+    gboolean enabled = (path && *path && !g_getenv ("UZBL_PRIVATE"));
+
+    g_free (path);
+
+    if (!enabled || !uri || !*uri) {
+        return;
+    }
+
+    GDateTime *now = g_date_time_new_now_local ();
+    gchar *timestamp = g_date_time_format (now, "%Y-%m-%d %H:%M:%S");
+    gchar *safe_uri = strip_credentials (uri);
+    gchar *safe_title = g_strdelimit (g_strdup (title ? title : ""), "\r\n", ' ');
+
+    /* The same format as history.sh: "DATE TIME URI TITLE". */
+    gchar *record = g_strdup_printf ("%s %s %s", timestamp, safe_uri, safe_title);
+
+    g_string_append (uzbl.history->records, record);
+    g_string_append_c (uzbl.history->records, '\n');
+
+    /* Without an index, the record is read from the file once it exists. */
+    if (uzbl.history->entries) {
+        /* The record is indexed now; it is skipped when read back from the
+         * file. */
+        guint count = GPOINTER_TO_UINT (g_hash_table_lookup (uzbl.history->own_records, record));
+        g_hash_table_replace (uzbl.history->own_records, record, GUINT_TO_POINTER (count + 1));
+
+        index_visit (safe_uri, safe_title, g_date_time_to_unix (now));
+    } else {
+        g_free (record);
+        g_free (safe_uri);
+        g_free (safe_title);
+    }
+
+    g_free (timestamp);
+    g_date_time_unref (now);
+
+    int interval = uzbl_variables_get_int ("history_flush_interval");
+
+    if (interval <= 0) {
+        uzbl_history_flush ();
+    } else if (!uzbl.history->flush_id) {
+        uzbl.history->flush_id = g_timeout_add_seconds (interval, flush_timeout, NULL);
+    }
+}
+
+static void
+write_records_thread (GTask *task, gpointer source, gpointer data, GCancellable *cancellable);
+static void
+records_written (GObject *source, GAsyncResult *res, gpointer data);
+
+void
+uzbl_history_flush ()
+{
+    if (uzbl.history->flush_id) {
+        g_source_remove (uzbl.history->flush_id);
+        uzbl.history->flush_id = 0;
+    }
+
+    /* Records added meanwhile go out once the running write is done. */
+    g_mutex_lock (&uzbl.history->lock);
+    gboolean writing = uzbl.history->writing;
+    g_mutex_unlock (&uzbl.history->lock);
+
+    if (writing) {
+        return;
+    }
+
+    UzblHistoryWrite *job = history_write_new ();
+    if (!job) {
+        return;
+    }
+
+    g_mutex_lock (&uzbl.history->lock);
+    uzbl.history->writing = TRUE;
+    g_mutex_unlock (&uzbl.history->lock);
+
+    GTask *task = g_task_new (NULL, NULL, records_written, NULL);
+    g_task_set_task_data (task, job, history_write_free);
+    g_task_run_in_thread (task, write_records_thread);
+    g_object_unref (task);
+}
+
+typedef struct {
+    gdouble                 score;
+    const UzblHistoryEntry *entry;
+} UzblHistoryMatch;
+
+static GArray *
+query_candidates (const gchar *query);
+static gboolean
+entry_matches (const UzblHistoryEntry *entry, const gchar *query);
+static gdouble
+entry_score (const UzblHistoryEntry *entry, const gchar *query, gint64 now);
+static gint
+compare_matches (gconstpointer a, gconstpointer b);
+
+void
+uzbl_history_query (const gchar *query, guint count, GString *result)
+{
+    update_index ();
+
+    if (!uzbl.history->entries || !count) {
+        return;
+    }
+
+    GArray *candidates = query_candidates (query);
+    GArray *best = g_array_sized_new (FALSE, FALSE, sizeof (UzblHistoryMatch),
+        MIN (count, uzbl.history->entries->len) + 1);
+    gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+    guint n = candidates ? candidates->len : uzbl.history->entries->len;
+    /* Keeping the best matches sorted only pays off if most are dropped. */
+    gboolean bounded = (count < n);
+    guint i;
+
+    ++uzbl.history->query;
+
+    for (i = 0; i < n; ++i) {
+        guint id = candidates ? g_array_index (candidates, guint, i) : i;
+        UzblHistoryEntry *entry = g_ptr_array_index (uzbl.history->entries, id);
+
+        /* Posting lists may name an entry more than once. */
+        if (entry->seen == uzbl.history->query) {
+            continue;
+        }
+        entry->seen = uzbl.history->query;
+
+        if (!entry_matches (entry, query)) {
+            continue;
+        }
+
+        UzblHistoryMatch match = { entry_score (entry, query, now), entry };
+
+        if (!bounded) {
+            g_array_append_val (best, match);
+            continue;
+        }
+
+        if ((best->len == count) &&
+            (match.score <= g_array_index (best, UzblHistoryMatch, count - 1).score)) {
+            continue;
+        }
+
+        /* Keep the best matches sorted by descending score. */
+        guint pos = best->len;
+        while (pos && (g_array_index (best, UzblHistoryMatch, pos - 1).score < match.score)) {
+            --pos;
+        }
+
+        g_array_insert_val (best, pos, match);
+        if (best->len > count) {
+            g_array_set_size (best, count);
+        }
+    }
+
+    if (!bounded) {
+        g_array_sort (best, compare_matches);
+    }
+
+    for (i = 0; i < best->len; ++i) {
+        const UzblHistoryEntry *entry = g_array_index (best, UzblHistoryMatch, i).entry;
+
+        g_string_append_printf (result, "%s %s\n", entry->uri, entry->title);
+    }
+
+    g_array_free (best, TRUE);
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+UzblHistoryWrite *
+history_write_new ()
+{
+    gchar *path = uzbl_variables_get_string ("history_file");
+
+    if (!uzbl.history->records->len || !path || !*path) {
+        g_string_truncate (uzbl.history->records, 0);
+        g_free (path);
+        return NULL;
+    }
+
+    UzblHistoryWrite *job = g_malloc (sizeof (UzblHistoryWrite));
+
+    job->path = path;
+    job->records = g_string_free_to_bytes (uzbl.history->records);
+    job->sync = uzbl_variables_get_int ("history_fsync");
+
+    uzbl.history->records = g_string_new ("");
+
+    return job;
+}
+
+void
+history_write_free (gpointer data)
+{
+    UzblHistoryWrite *job = (UzblHistoryWrite *)data;
+
+    g_free (job->path);
+    g_bytes_unref (job->records);
+
+    g_free (job);
+}
+
+gboolean
+write_records (UzblHistoryWrite *job, GError **error)
+{
+    gsize len;
+    const gchar *data = g_bytes_get_data (job->records, &len);
+    int saved_errno = 0;
+
+    int fd = g_open (job->path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd < 0) {
+        saved_errno = errno;
+    }
+
+    while (!saved_errno && len) {
+        ssize_t written = write (fd, data, len);
+
+        if (written < 0) {
+            if (errno != EINTR) {
+                saved_errno = errno;
+            }
+            continue;
+        }
+
+        data += written;
+        len -= written;
+    }
+
+    if (!saved_errno && job->sync && fsync (fd)) {
+        saved_errno = errno;
+    }
+
+    if ((0 <= fd) && close (fd) && !saved_errno) {
+        saved_errno = errno;
+    }
+
+    if (saved_errno) {
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+            "%s: %s", job->path, g_strerror (saved_errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gchar *
+strip_credentials (const gchar *uri)
+{
+    const gchar *authority = strstr (uri, "://");
+
+    if (!authority) {
+        return g_strdup (uri);
+    }
+
+    authority += 3;
+
+    const gchar *end = authority + strcspn (authority, "/?#");
+    const gchar *at = g_strrstr_len (authority, end - authority, "@");
+
+    if (!at) {
+        return g_strdup (uri);
+    }
+
+    return g_strdup_printf ("%.*s%s", (int)(authority - uri), uri, at + 1);
+}
+
+static void
+new_index (const gchar *path);
+static void
+load_saved_index (const gchar *path);
+static gboolean
+log_check (const gchar *path, gsize offset, guint32 *check);
+static void
+read_records (GMappedFile *file);
+static void
+index_record (const gchar *record);
+static gint64
+parse_time (const gchar *line);
+static void
+index_text (UzblHistoryEntry *entry, const gchar *text);
+
+void
+update_index ()
+{
+    gchar *path = uzbl_variables_get_string ("history_file");
+    GStatBuf buf;
+
+    if (!path || !*path) {
+        g_free (path);
+        return;
+    }
+
+    if (g_stat (path, &buf)) {
+        buf.st_size = 0;
+    }
+
+    gboolean loading = FALSE;
+
+    /* Start over for a new file or one which has been truncated. */
+    if (g_strcmp0 (path, uzbl.history->index_path) ||
+        ((gsize)buf.st_size < uzbl.history->index_offset)) {
+        new_index (path);
+        loading = TRUE;
+
+        /* The running write's records are read from the file. */
+        g_mutex_lock (&uzbl.history->lock);
+        while (uzbl.history->writing) {
+            g_cond_wait (&uzbl.history->done, &uzbl.history->lock);
+        }
+        g_mutex_unlock (&uzbl.history->lock);
+
+        load_saved_index (path);
+
+        if (g_stat (path, &buf)) {
+            buf.st_size = 0;
+        }
+    }
+
+    if ((gsize)buf.st_size > uzbl.history->index_offset) {
+        GError *err = NULL;
+        GMappedFile *file = g_mapped_file_new (path, FALSE, &err);
+
+        if (file) {
+            read_records (file);
+            g_mapped_file_unref (file);
+        } else {
+            uzbl_debug ("Failed to read history: %s\n", err->message);
+            g_error_free (err);
+        }
+    }
+
+    if ((uzbl.history->index_offset - uzbl.history->saved_offset) >= HISTORY_INDEX_SAVE_SIZE) {
+        save_index ();
+    }
+
+    /* Records still waiting to be written are not in the file yet. */
+    if (loading) {
+        const gchar *line = uzbl.history->records->str;
+        const gchar *eol;
+
+        while ((eol = strchr (line, '\n'))) {
+            gchar *record = g_strndup (line, eol - line);
+            guint count = GPOINTER_TO_UINT (g_hash_table_lookup (uzbl.history->own_records, record));
+
+            line = eol + 1;
+
+            index_record (record);
+            g_hash_table_replace (uzbl.history->own_records, record, GUINT_TO_POINTER (count + 1));
+        }
+    }
+
+    g_free (path);
+}
+
+void
+save_index ()
+{
+    /* The index has to match the file exactly. */
+    if (!uzbl.history->entries ||
+        (uzbl.history->index_offset == uzbl.history->saved_offset) ||
+        g_hash_table_size (uzbl.history->own_records)) {
+        return;
+    }
+
+    UzblHistoryIndexHeader header;
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, HISTORY_INDEX_MAGIC, sizeof (header.magic));
+    header.log_offset = uzbl.history->index_offset;
+
+    if (!log_check (uzbl.history->index_path, uzbl.history->index_offset, &header.log_check)) {
+        return;
+    }
+
+    GByteArray *entries = g_byte_array_new ();
+    GByteArray *trigrams = g_byte_array_new ();
+    GArray *postings = g_array_new (FALSE, FALSE, sizeof (guint32));
+    GString *strings = g_string_new ("");
+    guint i;
+
+    for (i = 0; i < uzbl.history->entries->len; ++i) {
+        const UzblHistoryEntry *entry = g_ptr_array_index (uzbl.history->entries, i);
+        UzblHistoryIndexEntry saved = { 0, 0, entry->visits, 0, entry->last_visit };
+
+        saved.uri = strings->len;
+        g_string_append_len (strings, entry->uri, strlen (entry->uri) + 1);
+        saved.title = strings->len;
+        g_string_append_len (strings, entry->title, strlen (entry->title) + 1);
+
+        g_byte_array_append (entries, (const guint8 *)&saved, sizeof (saved));
+    }
+
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+
+    g_hash_table_iter_init (&iter, uzbl.history->trigrams);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        GArray *posting = (GArray *)value;
+        UzblHistoryIndexTrigram saved = { GPOINTER_TO_UINT (key), postings->len, posting->len };
+
+        g_array_append_vals (postings, posting->data, posting->len);
+        g_byte_array_append (trigrams, (const guint8 *)&saved, sizeof (saved));
+    }
+
+    header.n_entries = uzbl.history->entries->len;
+    header.n_trigrams = g_hash_table_size (uzbl.history->trigrams);
+    header.n_postings = postings->len;
+    header.strings_len = strings->len;
+
+    GByteArray *data = g_byte_array_new ();
+
+    g_byte_array_append (data, (const guint8 *)&header, sizeof (header));
+    g_byte_array_append (data, entries->data, entries->len);
+    g_byte_array_append (data, trigrams->data, trigrams->len);
+    g_byte_array_append (data, (const guint8 *)postings->data, postings->len * sizeof (guint32));
+    g_byte_array_append (data, (const guint8 *)strings->str, strings->len);
+
+    /* Written through a rename, so readers never see a partial index. */
+    UzblHistoryWrite job;
+    GError *err = NULL;
+    gchar *index_file = g_strdup_printf ("%s.idx", uzbl.history->index_path);
+
+    job.path = g_strdup_printf ("%s.%d", index_file, getpid ());
+    job.records = g_byte_array_free_to_bytes (data);
+    job.sync = uzbl_variables_get_int ("history_fsync");
+
+    g_unlink (job.path);
+
+    if (write_records (&job, &err) && !g_rename (job.path, index_file)) {
+        uzbl.history->saved_offset = uzbl.history->index_offset;
+    } else {
+        if (err) {
+            uzbl_debug ("Failed to save the history index: %s\n", err->message);
+            g_error_free (err);
+        }
+        g_unlink (job.path);
+    }
+
+    g_free (index_file);
+    g_free (job.path);
+    g_bytes_unref (job.records);
+    g_string_free (strings, TRUE);
+    g_array_free (postings, TRUE);
+    g_byte_array_unref (trigrams);
+    g_byte_array_unref (entries);
+}
+
+static void
+free_entry (gpointer data);
+static void
+free_posting (gpointer data);
+
+void
+new_index (const gchar *path)
+{
+    free_index ();
+
+    /* Records indexed for the old index are not read back anymore. */
+    g_hash_table_remove_all (uzbl.history->own_records);
+
+    uzbl.history->index_path = g_strdup (path);
+    uzbl.history->index_offset = 0;
+    uzbl.history->saved_offset = 0;
+    uzbl.history->entries = g_ptr_array_new_with_free_func (free_entry);
+    uzbl.history->by_uri = g_hash_table_new (g_str_hash, g_str_equal);
+    uzbl.history->trigrams = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, free_posting);
+}
+
+void
+load_saved_index (const gchar *path)
+{
+    gchar *index_file = g_strdup_printf ("%s.idx", path);
+    GMappedFile *file = g_mapped_file_new (index_file, FALSE, NULL);
+
+    g_free (index_file);
+
+    if (!file) {
+        return;
+    }
+
+    const gchar *contents = g_mapped_file_get_contents (file);
+    gsize len = g_mapped_file_get_length (file);
+    UzblHistoryIndexHeader header;
+    guint32 check;
+
+    if (len < sizeof (header)) {
+        g_mapped_file_unref (file);
+        return;
+    }
+
+    memcpy (&header, contents, sizeof (header));
+
+    if (memcmp (header.magic, HISTORY_INDEX_MAGIC, sizeof (header.magic))) {
+        g_mapped_file_unref (file);
+        return;
+    }
+
+    guint64 entries_len = (guint64)header.n_entries * sizeof (UzblHistoryIndexEntry);
+    guint64 trigrams_len = (guint64)header.n_trigrams * sizeof (UzblHistoryIndexTrigram);
+    guint64 postings_len = (guint64)header.n_postings * sizeof (guint32);
+
+    if (len != sizeof (header) + entries_len + trigrams_len + postings_len + header.strings_len) {
+        g_mapped_file_unref (file);
+        return;
+    }
+
+    const gchar *entries = contents + sizeof (header);
+    const gchar *trigrams = entries + entries_len;
+    const gchar *postings = trigrams + trigrams_len;
+    const gchar *strings = postings + postings_len;
+
+    /* An index for another history_file, or one from before it was
+     * rewritten, is ignored. */
+    if (!header.strings_len || strings[header.strings_len - 1] ||
+        !log_check (path, header.log_offset, &check) || (check != header.log_check)) {
+        g_mapped_file_unref (file);
+        return;
+    }
+
+    gboolean valid = TRUE;
+    guint32 i;
+
+    for (i = 0; valid && (i < header.n_entries); ++i) {
+        UzblHistoryIndexEntry saved;
+
+        memcpy (&saved, entries + i * sizeof (saved), sizeof (saved));
+
+        if ((header.strings_len <= saved.uri) || (header.strings_len <= saved.title)) {
+            valid = FALSE;
+            break;
+        }
+
+        UzblHistoryEntry *entry = g_malloc0 (sizeof (UzblHistoryEntry));
+
+        entry->id = i;
+        entry->uri = g_strdup (strings + saved.uri);
+        entry->title = g_strdup (strings + saved.title);
+        entry->visits = saved.visits;
+        entry->last_visit = saved.last_visit;
+
+        g_ptr_array_add (uzbl.history->entries, entry);
+        g_hash_table_insert (uzbl.history->by_uri, entry->uri, entry);
+    }
+
+    for (i = 0; valid && (i < header.n_trigrams); ++i) {
+        UzblHistoryIndexTrigram saved;
+
+        memcpy (&saved, trigrams + i * sizeof (saved), sizeof (saved));
+
+        if (!saved.len || (header.n_postings < saved.start) ||
+            (header.n_postings - saved.start < saved.len)) {
+            valid = FALSE;
+            break;
+        }
+
+        GArray *posting = g_array_sized_new (FALSE, FALSE, sizeof (guint), saved.len);
+        g_array_append_vals (posting, postings + saved.start * sizeof (guint32), saved.len);
+        g_hash_table_insert (uzbl.history->trigrams, GUINT_TO_POINTER (saved.trigram), posting);
+
+        guint j;
+        for (j = 0; j < posting->len; ++j) {
+            if (g_array_index (posting, guint, j) >= header.n_entries) {
+                valid = FALSE;
+                break;
+            }
+        }
+    }
+
+    if (valid) {
+        uzbl.history->index_offset = header.log_offset;
+        uzbl.history->saved_offset = header.log_offset;
+    } else {
+        uzbl_debug ("Ignoring a corrupt history index for %s\n", path);
+        new_index (path);
+    }
+
+    g_mapped_file_unref (file);
+}
+
+gboolean
+log_check (const gchar *path, gsize offset, guint32 *check)
+{
+    GMappedFile *file = g_mapped_file_new (path, FALSE, NULL);
+
+    if (!file) {
+        return FALSE;
+    }
+
+    if (g_mapped_file_get_length (file) < offset) {
+        g_mapped_file_unref (file);
+        return FALSE;
+    }
+
+    /* FNV-1a over the last records which are covered. */
+    const guchar *end = (const guchar *)g_mapped_file_get_contents (file) + offset;
+    const guchar *p = end - MIN (offset, 4096);
+
+    *check = 2166136261u;
+    for (; p < end; ++p) {
+        *check = (*check ^ *p) * 16777619u;
+    }
+
+    g_mapped_file_unref (file);
+
+    return TRUE;
+}
+
+void
+read_records (GMappedFile *file)
+{
+    /* Only complete lines are read; the rest is read next time. */
+    const gchar *contents = g_mapped_file_get_contents (file);
+    const gchar *end = contents + g_mapped_file_get_length (file);
+    const gchar *line = contents + uzbl.history->index_offset;
+    const gchar *eol;
+
+    while ((line < end) && (eol = memchr (line, '\n', end - line))) {
+        gchar *record = g_strndup (line, eol - line);
+        guint count = GPOINTER_TO_UINT (g_hash_table_lookup (uzbl.history->own_records, record));
+
+        line = eol + 1;
+
+        /* Records from this instance have been indexed already. */
+        if (count > 1) {
+            g_hash_table_insert (uzbl.history->own_records, g_strdup (record), GUINT_TO_POINTER (count - 1));
+        } else if (count) {
+            g_hash_table_remove (uzbl.history->own_records, record);
+        } else {
+            index_record (record);
+        }
+
+        g_free (record);
+    }
+
+    uzbl.history->index_offset = line - contents;
+}
+
+void
+index_record (const gchar *record)
+{
+    /* "DATE TIME URI TITLE" */
+    const gchar *uri = (strlen (record) > 20) ? record + 20 : NULL;
+    const gchar *title = uri ? strchr (uri, ' ') : NULL;
+
+    if (title) {
+        index_visit (g_strndup (uri, title - uri), g_strdup (title + 1), parse_time (record));
+    } else if (uri && *uri) {
+        index_visit (g_strdup (uri), g_strdup (""), parse_time (record));
+    }
+}
+
+void
+index_visit (gchar *uri, gchar *title, gint64 time)
+{
+    UzblHistoryEntry *entry = g_hash_table_lookup (uzbl.history->by_uri, uri);
+
+    if (entry) {
+        g_free (uri);
+    } else {
+        entry = g_malloc0 (sizeof (UzblHistoryEntry));
+        entry->id = uzbl.history->entries->len;
+        entry->uri = uri;
+        entry->title = g_strdup ("");
+
+        g_ptr_array_add (uzbl.history->entries, entry);
+        g_hash_table_insert (uzbl.history->by_uri, entry->uri, entry);
+        index_text (entry, entry->uri);
+    }
+
+    ++entry->visits;
+    entry->last_visit = MAX (entry->last_visit, time);
+
+    /* The latest title wins; the old one's trigrams may linger but every
+     * candidate is checked anyway. */
+    if (*title && strcmp (title, entry->title)) {
+        g_free (entry->title);
+        entry->title = title;
+        index_text (entry, entry->title);
+    } else {
+        g_free (title);
+    }
+}
+
+#define TRIGRAM(s) GUINT_TO_POINTER (((guint)(guchar)g_ascii_tolower ((s)[0]) << 16) | \
+                                     ((guint)(guchar)g_ascii_tolower ((s)[1]) << 8) |  \
+                                     ((guint)(guchar)g_ascii_tolower ((s)[2])))
+
+void
+index_text (UzblHistoryEntry *entry, const gchar *text)
+{
+    gsize len = strlen (text);
+    gsize i;
+
+    for (i = 0; i + 3 <= len; ++i) {
+        gpointer key = TRIGRAM (text + i);
+        GArray *posting = g_hash_table_lookup (uzbl.history->trigrams, key);
+
+        if (!posting) {
+            posting = g_array_new (FALSE, FALSE, sizeof (guint));
+            g_hash_table_insert (uzbl.history->trigrams, key, posting);
+        } else if (g_array_index (posting, guint, posting->len - 1) == entry->id) {
+            continue;
+        }
+
+        g_array_append_val (posting, entry->id);
+    }
+}
+
+GArray *
+query_candidates (const gchar *query)
+{
+    gsize len = strlen (query);
+    GArray *smallest = NULL;
+    static GArray *empty = NULL;
+    gsize i;
+
+    /* Short queries have to look at everything. */
+    if (len < 3) {
+        return NULL;
+    }
+
+    if (!empty) {
+        empty = g_array_new (FALSE, FALSE, sizeof (guint));
+    }
+
+    /* Every match contains all trigrams of the query, so only the entries
+     * with the rarest one need to be checked. */
+    for (i = 0; i + 3 <= len; ++i) {
+        GArray *posting = g_hash_table_lookup (uzbl.history->trigrams, TRIGRAM (query + i));
+
+        if (!posting) {
+            return empty;
+        }
+
+        if (!smallest || (posting->len < smallest->len)) {
+            smallest = posting;
+        }
+    }
+
+    return smallest;
+}
+
+#undef TRIGRAM
+
+static gboolean
+contains (const gchar *haystack, const gchar *needle, gsize len);
+
+gint
+compare_matches (gconstpointer a, gconstpointer b)
+{
+    gdouble score_a = ((const UzblHistoryMatch *)a)->score;
+    gdouble score_b = ((const UzblHistoryMatch *)b)->score;
+
+    /* Highest score first. */
+    return (score_a < score_b) - (score_a > score_b);
+}
+
+gboolean
+entry_matches (const UzblHistoryEntry *entry, const gchar *query)
+{
+    gsize len = strlen (query);
+
+    return !len ||
+           contains (entry->uri, query, len) ||
+           contains (entry->title, query, len);
+}
+
+gboolean
+contains (const gchar *haystack, const gchar *needle, gsize len)
+{
+    for (; *haystack; ++haystack) {
+        if (!g_ascii_strncasecmp (haystack, needle, len)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+gdouble
+entry_score (const UzblHistoryEntry *entry, const gchar *query, gint64 now)
+{
+    gint64 days = (now - entry->last_visit) / (24 * 60 * 60);
+    gdouble weight;
+
+    /* Frequent visits count for more the more recent they are. */
+    if (days < 4) {
+        weight = 100;
+    } else if (days < 14) {
+        weight = 70;
+    } else if (days < 31) {
+        weight = 50;
+    } else if (days < 90) {
+        weight = 30;
+    } else {
+        weight = 10;
+    }
+
+    gdouble score = entry->visits * weight;
+
+    const gchar *host = strstr (entry->uri, "://");
+    gsize len = strlen (query);
+
+    if (host && len) {
+        host += 3;
+        if (g_str_has_prefix (host, "www.")) {
+            host += 4;
+        }
+
+        if (!g_ascii_strncasecmp (host, query, len)) {
+            score += G_MAXUINT32 * 100.0;
+        }
+    }
+
+    return score;
+}
+
+gint64
+parse_time (const gchar *line)
+{
+    int year;
+    int month;
+    int day;
+    int hour;
+    int minute;
+    int second;
+
+    if ((strlen (line) < 19) ||
+        (sscanf (line, "%4d-%2d-%2d %2d:%2d:%2d", &year, &month, &day, &hour, &minute, &second) != 6)) {
+        return 0;
+    }
+
+    /* Most records share the day of the one before. */
+    if (strncmp (line, uzbl.history->day, 10)) {
+        GDateTime *start = g_date_time_new_local (year, month, day, 0, 0, 0);
+
+        if (!start) {
+            return 0;
+        }
+
+        memcpy (uzbl.history->day, line, 10);
+        uzbl.history->day_start = g_date_time_to_unix (start);
+        g_date_time_unref (start);
+    }
+
+    return uzbl.history->day_start + (hour * 60 + minute) * 60 + second;
+}
+
+void
+free_index ()
+{
+    if (uzbl.history->entries) {
+        g_hash_table_destroy (uzbl.history->trigrams);
+        g_hash_table_destroy (uzbl.history->by_uri);
+        g_ptr_array_unref (uzbl.history->entries);
+    }
+
+    g_free (uzbl.history->index_path);
+    uzbl.history->index_path = NULL;
+    uzbl.history->entries = NULL;
+    uzbl.history->by_uri = NULL;
+    uzbl.history->trigrams = NULL;
+}
+
+void
+free_entry (gpointer data)
+{
+    UzblHistoryEntry *entry = (UzblHistoryEntry *)data;
+
+    g_free (entry->uri);
+    g_free (entry->title);
+
+    g_free (entry);
+}
+
+void
+free_posting (gpointer data)
+{
+    g_array_free ((GArray *)data, TRUE);
+}
+
+gboolean
+flush_timeout (gpointer data)
+{
+    UZBL_UNUSED (data);
+
+    uzbl.history->flush_id = 0;
+    uzbl_history_flush ();
+
+    return FALSE;
+}
+
+void
+write_records_thread (GTask *task, gpointer source, gpointer data, GCancellable *cancellable)
+{
+    UZBL_UNUSED (source);
+    UZBL_UNUSED (cancellable);
+
+    UzblHistoryWrite *job = (UzblHistoryWrite *)data;
+    GError *err = NULL;
+    /* The history may be freed as soon as the write is marked done. */
+    UzblHistory *history = uzbl.history;
+
+    if (write_records (job, &err)) {
+        g_task_return_boolean (task, TRUE);
+    } else {
+        g_task_return_error (task, err);
+    }
+
+    g_mutex_lock (&history->lock);
+    history->writing = FALSE;
+    g_cond_broadcast (&history->done);
+    g_mutex_unlock (&history->lock);
+}
+
+void
+records_written (GObject *source, GAsyncResult *res, gpointer data)
+{
+    UZBL_UNUSED (source);
+    UZBL_UNUSED (data);
+
+    GError *err = NULL;
+
+    if (!g_task_propagate_boolean (G_TASK (res), &err)) {
+        uzbl_debug ("Failed to write history: %s\n", err->message);
+        g_error_free (err);
+    }
+
+    /* Read the records back right away so that own_records stays small. */
+    if (uzbl.history && uzbl.history->entries) {
+        update_index ();
+    }
+
+    if (uzbl.history && uzbl.history->records->len && !uzbl.history->flush_id) {
+        uzbl_history_flush ();
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef UZBL_HISTORY_H
+#define UZBL_HISTORY_H
+
+#include <glib.h>
+
+/* Records a visit in history_file unless browsing privately. Records are
+ * buffered and written out every history_flush_interval seconds. */
+void
+uzbl_history_add (const gchar *uri, const gchar *title);
+/* Starts writing any buffered records to history_file. */
+void
+uzbl_history_flush ();
+
+/* Appends up to count of the most frecent pages whose URI or title contains
+ * the query (ignoring case) as "URI TITLE" lines. Pages whose host starts
+ * with the query come first. */
+void
+uzbl_history_query (const gchar *query, guint count, GString *result);
+
+#endif
@@ -48,9 +48,25 @@ struct _UzblIO {
 
     /* Web extension communication */
     GIOStream *extstream;
+    ExtIOReader *extreader;
     int extfdinfo[2];
+    /* Requests awaiting a reply from the extension, by serial. */
+    GHashTable *ext_requests;
+    guint32 ext_serial;
+    /* Messages held until the extension says hello. */
+    gboolean ext_ready;
+    GPtrArray *ext_backlog;
+    /* Messages which configure the extension; these are sent again to the
+     * extension in a new web process. */
+    GPtrArray *ext_state;
 };
 
+typedef struct {
+    ExtIOMessageType type;
+    guint64 page_id;
+    GVariant *message;
+} UzblExtMessage;
+
 /* =========================== PUBLIC API =========================== */
 
 static gboolean
@@ -65,6 +81,10 @@ static gpointer
 run_io (gpointer data);
 static void
 start_command_loop ();
+static void
+fail_ext_requests (const gchar *reason);
+static void
+free_ext_message (gpointer data);
 
 void
 uzbl_io_init ()
@@ -83,6 +103,14 @@ uzbl_io_init ()
 
     uzbl.io->cmd_q = g_async_queue_new_full (g_object_unref);
 
+    uzbl.io->extstream = NULL;
+    uzbl.io->extreader = NULL;
+    uzbl.io->ext_requests = g_hash_table_new (g_direct_hash, g_direct_equal);
+    uzbl.io->ext_serial = 0;
+    uzbl.io->ext_ready = FALSE;
+    uzbl.io->ext_backlog = g_ptr_array_new_with_free_func (free_ext_message);
+    uzbl.io->ext_state = g_ptr_array_new_with_free_func (free_ext_message);
+
     start_command_loop ();
 
     uzbl.io->io_thread = g_thread_new ("uzbl-io", run_io, NULL);
@@ -112,6 +140,12 @@ uzbl_io_free ()
     g_free (uzbl.io->fifo_path);
     g_free (uzbl.io->socket_path);
 
+    uzbl_extio_reader_free (uzbl.io->extreader);
+    fail_ext_requests ("shutting down");
+    g_hash_table_destroy (uzbl.io->ext_requests);
+    g_ptr_array_unref (uzbl.io->ext_backlog);
+    g_ptr_array_unref (uzbl.io->ext_state);
+
     // TODO: Closing can fail if there is a blocking thread
     // g_async_queue_unref (uzbl.io->cmd_q);
     g_thread_unref (uzbl.io->io_thread);
@@ -238,14 +272,79 @@ uzbl_io_command_finish (GObject *source, GAsyncResult *result, GError **error)
     return (GString*) g_task_propagate_pointer (task, error);
 }
 
+static UzblExtMessage *
+new_ext_message (ExtIOMessageType type, guint64 page_id, va_list *vargs);
+static void
+send_ext_message (UzblExtMessage *msg);
+
 void
-uzbl_io_send_ext_message (ExtIOMessageType type, ...)
+uzbl_io_send_ext_message (ExtIOMessageType type, guint64 page_id, ...)
+{
+    va_list vargs;
+    va_start (vargs, page_id);
+    UzblExtMessage *msg = new_ext_message (type, page_id, &vargs);
+    va_end (vargs);
+
+    send_ext_message (msg);
+    free_ext_message (msg);
+}
+
+void
+uzbl_io_send_ext_state (ExtIOMessageType type, ...)
 {
     va_list vargs;
     va_start (vargs, type);
-    GOutputStream *os = g_io_stream_get_output_stream (uzbl.io->extstream);
-    uzbl_extio_send_new_messagev (os, type, &vargs);
+    UzblExtMessage *msg = new_ext_message (type, EXTIO_NO_PAGE, &vargs);
     va_end (vargs);
+
+    send_ext_message (msg);
+    g_ptr_array_add (uzbl.io->ext_state, msg);
+}
+
+void
+uzbl_io_clear_ext_state (ExtIOMessageType type)
+{
+    guint i = 0;
+
+    while (i < uzbl.io->ext_state->len) {
+        UzblExtMessage *msg = g_ptr_array_index (uzbl.io->ext_state, i);
+
+        if (msg->type == type) {
+            g_ptr_array_remove_index (uzbl.io->ext_state, i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void
+uzbl_io_collect_hints_async (const gchar         *mode,
+                             GAsyncReadyCallback  callback,
+                             gpointer             data)
+{
+    GTask *task = g_task_new (NULL, NULL, callback, data);
+
+    if (!uzbl.io->ext_ready || !uzbl.gui.web_view) {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_CONNECTED,
+                                 "web extension is not running");
+        g_object_unref (task);
+        return;
+    }
+
+    guint32 serial = ++uzbl.io->ext_serial;
+
+    g_hash_table_insert (uzbl.io->ext_requests, GUINT_TO_POINTER (serial), task);
+
+    uzbl_io_send_ext_message (EXT_COLLECT_HINTS,
+                              webkit_web_view_get_page_id (uzbl.gui.web_view),
+                              serial, mode);
+}
+
+GVariant *
+uzbl_io_collect_hints_finish (GAsyncResult *result, GError **error)
+{
+    GTask *task = G_TASK (result);
+    return (GVariant*) g_task_propagate_pointer (task, error);
 }
 
 typedef enum {
@@ -344,10 +443,12 @@ uzbl_io_init_socket (const gchar *dir)
     return ret;
 }
 
-void
-read_message_cb (GObject *stream,
-                 GAsyncResult *res,
-                 gpointer user_data);
+static void
+read_message_cb (ExtIOMessageType  messagetype,
+                 guint64           page_id,
+                 GVariant         *message,
+                 const GError     *error,
+                 gpointer          user_data);
 
 gboolean
 uzbl_io_init_extpipe ()
@@ -355,6 +456,23 @@ uzbl_io_init_extpipe ()
     int readfd[2];
     int writefd[2];
 
+    if (uzbl.io->extstream) {
+        /* A new web process; anything sent to the old one is lost. */
+        uzbl_extio_reader_free (uzbl.io->extreader);
+        g_object_unref (uzbl.io->extstream);
+        fail_ext_requests ("web process exited");
+
+        guint i;
+        g_ptr_array_set_size (uzbl.io->ext_backlog, 0);
+        for (i = 0; i < uzbl.io->ext_state->len; ++i) {
+            UzblExtMessage *msg = g_ptr_array_index (uzbl.io->ext_state, i);
+            UzblExtMessage *copy = g_slice_dup (UzblExtMessage, msg);
+            g_variant_ref (copy->message);
+            g_ptr_array_add (uzbl.io->ext_backlog, copy);
+        }
+    }
+    uzbl.io->ext_ready = FALSE;
+
     pipe (readfd);
     pipe (writefd);
 
@@ -367,7 +485,7 @@ uzbl_io_init_extpipe ()
     uzbl.io->extfdinfo[0] = writefd[0];
     uzbl.io->extfdinfo[1] = readfd[1];
 
-    uzbl_extio_read_message_async (input, read_message_cb, NULL);
+    uzbl.io->extreader = uzbl_extio_reader_new (input, read_message_cb, NULL);
 
     return TRUE;
 }
@@ -863,20 +981,26 @@ attach_socket (const gchar *path)
 }
 
 void
-read_message_cb (GObject *source,
-                 GAsyncResult *res,
-                 gpointer user_data)
+read_message_cb (ExtIOMessageType  messagetype,
+                 guint64           page_id,
+                 GVariant         *message,
+                 const GError     *error,
+                 gpointer          user_data)
 {
     UZBL_UNUSED (user_data);
 
-    GInputStream *stream = G_INPUT_STREAM (source);
-    GError *error = NULL;
-    GVariant *message;
-    ExtIOMessageType messagetype;
+    if (!message) {
+        g_warning ("reading message from extension: %s",
+                   error ? error->message : "end of stream");
+        fail_ext_requests ("lost connection to web extension");
+        return;
+    }
 
-    if (!(message = uzbl_extio_read_message_finish (stream, res, &messagetype, &error))) {
-        g_warning ("reading message from extension: %s", error->message);
-        g_error_free (error);
+    /* The web process may host pages for other views (e.g., the related view
+     * used to catch new windows); only messages for our page are handled. */
+    if ((page_id != EXTIO_NO_PAGE) &&
+        (!uzbl.gui.web_view || (page_id != webkit_web_view_get_page_id (uzbl.gui.web_view)))) {
+        uzbl_debug ("Ignoring extension message for page %" G_GUINT64_FORMAT, page_id);
         return;
     }
 
@@ -888,27 +1012,67 @@ read_message_cb (GObject *source,
             if (proto != EXTIO_PROTOCOL) {
                 g_warning ("Extension with incompatible version loaded (expected %d, was %d)", EXTIO_PROTOCOL, proto);
                 gtk_main_quit ();
+                break;
+            }
+
+            guint i;
+            uzbl.io->ext_ready = TRUE;
+            for (i = 0; i < uzbl.io->ext_backlog->len; ++i) {
+                send_ext_message (g_ptr_array_index (uzbl.io->ext_backlog, i));
             }
+            g_ptr_array_set_size (uzbl.io->ext_backlog, 0);
             break;
         }
-    case EXT_FOCUS:
+    case EXT_EDITABLE:
         {
+            gboolean editable;
             gchar *name;
-            uzbl_extio_get_message_data (EXT_FOCUS, message, &name);
-            uzbl_events_send (FOCUS_ELEMENT, NULL,
-                              TYPE_STR, name,
-                              NULL);
+            uzbl_extio_get_message_data (EXT_EDITABLE, message, &editable, &name);
+            /* Focus moving into or out of an editable element is treated
+             * like clicking on a form or on the page. */
+            if (editable) {
+                uzbl_events_send (FOCUS_ELEMENT, NULL,
+                                  TYPE_STR, name,
+                                  NULL);
+                uzbl_events_send (FORM_ACTIVE, NULL,
+                                  TYPE_NAME, "focus",
+                                  NULL);
+            } else {
+                uzbl_events_send (BLUR_ELEMENT, NULL,
+                                  TYPE_STR, name,
+                                  NULL);
+                uzbl_events_send (ROOT_ACTIVE, NULL,
+                                  TYPE_NAME, "focus",
+                                  NULL);
+            }
             g_free (name);
             break;
         }
-    case EXT_BLUR:
+    case EXT_BLOCK_STATS:
         {
-            gchar *name;
-            uzbl_extio_get_message_data (EXT_BLUR, message, &name);
-            uzbl_events_send (BLUR_ELEMENT, NULL,
-                              TYPE_STR, name,
+            guint32 blocked;
+            guint32 checked;
+            uzbl_extio_get_message_data (EXT_BLOCK_STATS, message, &blocked, &checked);
+            uzbl_events_send (REQUESTS_BLOCKED, NULL,
+                              TYPE_INT, blocked,
+                              TYPE_INT, checked,
                               NULL);
-            g_free (name);
+            break;
+        }
+    case EXT_HINTS:
+        {
+            guint32 serial;
+            GVariant *hints;
+            g_variant_get (message, "(u@a" EXTIO_HINT_FORMAT ")", &serial, &hints);
+
+            GTask *task = g_hash_table_lookup (uzbl.io->ext_requests, GUINT_TO_POINTER (serial));
+            if (task) {
+                g_hash_table_remove (uzbl.io->ext_requests, GUINT_TO_POINTER (serial));
+                g_task_return_pointer (task, hints, (GDestroyNotify)g_variant_unref);
+                g_object_unref (task);
+            } else {
+                g_variant_unref (hints);
+            }
             break;
         }
     default:
@@ -919,9 +1083,6 @@ read_message_cb (GObject *source,
             break;
         }
     }
-    g_variant_unref (message);
-
-    uzbl_extio_read_message_async (stream, read_message_cb, NULL);
 }
 
 void
@@ -1036,3 +1197,53 @@ accept_socket_cb (GObject *source, GAsyncResult *res, gpointer data)
     g_socket_listener_accept_async (listener, NULL,
                                     accept_socket_cb, NULL);
 }
+
+void
+fail_ext_requests (const gchar *reason)
+{
+    GHashTableIter iter;
+    gpointer task;
+
+    g_hash_table_iter_init (&iter, uzbl.io->ext_requests);
+    while (g_hash_table_iter_next (&iter, NULL, &task)) {
+        g_task_return_new_error (G_TASK (task), G_IO_ERROR, G_IO_ERROR_CLOSED,
+                                 "%s", reason);
+        g_object_unref (task);
+        g_hash_table_iter_remove (&iter);
+    }
+}
+
+UzblExtMessage *
+new_ext_message (ExtIOMessageType type, guint64 page_id, va_list *vargs)
+{
+    UzblExtMessage *msg = g_slice_new (UzblExtMessage);
+
+    msg->type = type;
+    msg->page_id = page_id;
+    msg->message = uzbl_extio_new_messagev (type, vargs);
+
+    return msg;
+}
+
+void
+send_ext_message (UzblExtMessage *msg)
+{
+    if (!uzbl.io->ext_ready) {
+        UzblExtMessage *copy = g_slice_dup (UzblExtMessage, msg);
+        g_variant_ref (copy->message);
+        g_ptr_array_add (uzbl.io->ext_backlog, copy);
+        return;
+    }
+
+    uzbl_extio_send_message (g_io_stream_get_output_stream (uzbl.io->extstream),
+                             msg->type, msg->page_id, msg->message);
+}
+
+void
+free_ext_message (gpointer data)
+{
+    UzblExtMessage *msg = (UzblExtMessage *)data;
+
+    g_variant_unref (msg->message);
+    g_slice_free (UzblExtMessage, msg);
+}
@@ -19,8 +19,24 @@ uzbl_io_command_finish (GObject       *source,
                         GAsyncResult  *result,
                         GError       **error);
 
+/* Messages sent before the extension is ready are held until it is. */
 void
-uzbl_io_send_ext_message (ExtIOMessageType type, ...);
+uzbl_io_send_ext_message (ExtIOMessageType type, guint64 page_id, ...);
+/* Like uzbl_io_send_ext_message, but also sent to any later web process. */
+void
+uzbl_io_send_ext_state (ExtIOMessageType type, ...);
+void
+uzbl_io_clear_ext_state (ExtIOMessageType type);
+
+/* Collects link hints for the current page in the web process. The result
+ * is an array of EXTIO_HINT_FORMAT tuples. */
+void
+uzbl_io_collect_hints_async (const gchar         *mode,
+                             GAsyncReadyCallback  callback,
+                             gpointer             data);
+GVariant *
+uzbl_io_collect_hints_finish (GAsyncResult  *result,
+                              GError       **error);
 
 gboolean
 uzbl_io_init_fifo (const gchar *dir);
@@ -42,7 +42,7 @@ uzbl_js_evaluate(JSGlobalContextRef   jsctx,
 static JSGlobalContextRef
 uzbl_js_get_context(UzblJSContext context)
 {
-    JSGlobalContextRef jsctx;
+    JSGlobalContextRef jsctx = NULL;
 
     switch (context) {
     case JSCTX_UZBL:
@@ -50,8 +50,17 @@ uzbl_js_get_context(UzblJSContext context)
         JSGlobalContextRetain (jsctx);
         break;
     case JSCTX_CLEAN:
-        jsctx = JSGlobalContextCreate (NULL);
+    {
+        /* A new global object in the shared group is as clean as a new
+         * context, but does not pay for setting up a whole VM. */
+        gint64 start = g_get_monotonic_time ();
+
+        jsctx = JSGlobalContextCreateInGroup (uzbl.state.jscontext_group, NULL);
+
+        uzbl_debug ("Clean JavaScript context created in %" G_GINT64_FORMAT " us\n",
+            g_get_monotonic_time () - start);
         break;
+    }
     case JSCTX_PAGE:
     default:
         g_warning ("Invalid javascript context");
@@ -81,9 +90,13 @@ web_view_run_javascript_cb(GObject      *source,
 
     context = webkit_javascript_result_get_global_context (jsr);
     value = webkit_javascript_result_get_value (jsr);
+
     gchar *result_utf8 = uzbl_js_to_string (context, value);
 
     g_task_return_pointer (task, result_utf8, g_free);
+
+    webkit_javascript_result_unref (jsr);
+    g_object_unref (task);
 }
 
 /* =========================== PUBLIC API =========================== */
@@ -91,6 +104,7 @@ void
 uzbl_js_init ()
 {
     uzbl.state.jscontext = JSGlobalContextCreate (NULL);
+    uzbl.state.jscontext_group = JSContextGroupCreate ();
 
     JSObjectRef global = JSContextGetGlobalObject (uzbl.state.jscontext);
     JSObjectRef uzbl_obj = JSObjectMake (uzbl.state.jscontext, NULL, NULL);
@@ -160,6 +174,12 @@ uzbl_js_object (JSContextRef ctx, const gchar *prop)
     return JSValueToObject (ctx, val, NULL);
 }
 
+static void
+run_script (GTask         *task,
+            UzblJSContext  context,
+            const gchar   *script,
+            const gchar   *path);
+
 void
 uzbl_js_run_string_async (UzblJSContext        context,
                           const gchar         *script,
@@ -167,32 +187,13 @@ uzbl_js_run_string_async (UzblJSContext        context,
                           gpointer             data)
 {
     GTask *task = g_task_new (NULL, NULL, callback, data);
-    gchar *result_utf8 = NULL;
 
-    if (context == JSCTX_PAGE) {
-        webkit_web_view_run_javascript (uzbl.gui.web_view, script, NULL,
-                                        web_view_run_javascript_cb, task);
-        return;
-    }
-
-    GError *err = NULL;
-    JSGlobalContextRef jsctx = uzbl_js_get_context (context);
-    JSValueRef result = uzbl_js_evaluate (jsctx, script, "(uzbl command)", &err);
-    if (err != NULL) {
-        g_debug ("Exception occured while executing script: %s", err->message);
-        g_task_return_error (task, err);
-        g_object_unref (task);
-        return;
-    }
-    if (result && !JSValueIsUndefined (jsctx, result)) {
-        result_utf8 = uzbl_js_to_string (jsctx, result);
-    }
-
-    JSGlobalContextRelease (jsctx);
-    g_task_return_pointer (task, result_utf8, g_free);
-    g_object_unref (task);
+    run_script (task, context, script, "(uzbl command)");
 }
 
+static gchar *
+read_script_file (const gchar *path, GArray *argv);
+
 void
 uzbl_js_run_file_async (UzblJSContext        context,
                         const gchar         *path,
@@ -201,9 +202,29 @@ uzbl_js_run_file_async (UzblJSContext        context,
                         gpointer             data)
 {
     GTask *task = g_task_new (NULL, NULL, callback, data);
+    gchar *script = read_script_file (path, argv);
 
-    gchar *script;
-    gchar *result_utf8 = NULL;
+    run_script (task, context, script, path);
+
+    g_free (script);
+}
+
+gchar *
+uzbl_js_run_finish (GObject       *source,
+                    GAsyncResult  *result,
+                    GError       **error)
+{
+    UZBL_UNUSED (source);
+    GTask *task = G_TASK (result);
+    return g_task_propagate_pointer (task, error);
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+gchar *
+read_script_file (const gchar *path, GArray *argv)
+{
+    gchar *script = NULL;
 
     GIOChannel *chan = g_io_channel_new_file (path, "r", NULL);
     if (chan) {
@@ -212,6 +233,10 @@ uzbl_js_run_file_async (UzblJSContext        context,
         g_io_channel_unref (chan);
     }
 
+    if (!script) {
+        script = g_strdup ("");
+    }
+
     uzbl_debug ("External JavaScript file loaded: %s\n", path);
     guint i;
     for (i = argv->len; 0 != i; --i) {
@@ -225,6 +250,15 @@ uzbl_js_run_file_async (UzblJSContext        context,
         script = new_file_contents;
     }
 
+    return script;
+}
+
+void
+run_script (GTask         *task,
+            UzblJSContext  context,
+            const gchar   *script,
+            const gchar   *path)
+{
     if (context == JSCTX_PAGE) {
         webkit_web_view_run_javascript (uzbl.gui.web_view, script, NULL,
                                         web_view_run_javascript_cb, task);
@@ -236,25 +270,21 @@ uzbl_js_run_file_async (UzblJSContext        context,
     JSValueRef result = uzbl_js_evaluate (jsctx, script, path, &err);
     if (err != NULL) {
         g_debug ("Exception occured while executing script: %s", err->message);
+        JSGlobalContextRelease (jsctx);
         g_task_return_error (task, err);
         g_object_unref (task);
         return;
     }
+
+    gchar *result_utf8 = NULL;
+
     if (result && !JSValueIsUndefined (jsctx, result)) {
         result_utf8 = uzbl_js_to_string (jsctx, result);
     }
 
-    JSGlobalContextRelease (jsctx);
     g_task_return_pointer (task, result_utf8, g_free);
+
+    JSGlobalContextRelease (jsctx);
     g_object_unref (task);
 }
 
-gchar *
-uzbl_js_run_finish (GObject       *source,
-                    GAsyncResult  *result,
-                    GError       **error)
-{
-    UZBL_UNUSED (source);
-    GTask *task = G_TASK (result);
-    return g_task_propagate_pointer (task, error);
-}
@@ -0,0 +1,410 @@
+#include "rules.h"
+
+#include "util.h"
+#include "uzbl-core.h"
+
+#include <string.h>
+
+typedef struct {
+    guint           index;
+
+    /* Conditions; NULL matches anything. */
+    gchar          *scheme;
+    gchar          *host;
+    gboolean        subdomains;
+    gchar          *path;
+    GRegex         *regex;
+
+    UzblRuleAction  action;
+    gchar          *argument;
+} UzblRule;
+
+typedef struct {
+    GPtrArray  *rules;
+
+    /* Rule indices (in order) for rules with a host, keyed by the host, and
+     * for rules without one. Only the host's suffixes need to be looked at
+     * to find the candidates for a URI. */
+    GHashTable *by_host;
+    GArray     *any_host;
+} UzblRuleSet;
+
+struct _UzblRules {
+    UzblRuleSet tables[UZBL_RULES_LAST];
+};
+
+/* =========================== PUBLIC API =========================== */
+
+static void
+free_rule (gpointer data);
+static void
+free_index (gpointer data);
+
+void
+uzbl_rules_init ()
+{
+    uzbl.rules = g_malloc (sizeof (UzblRules));
+
+    guint i;
+    for (i = 0; i < UZBL_RULES_LAST; ++i) {
+        UzblRuleSet *set = &uzbl.rules->tables[i];
+
+        set->rules = g_ptr_array_new_with_free_func (free_rule);
+        set->by_host = g_hash_table_new_full (g_str_hash, g_str_equal,
+            g_free, free_index);
+        set->any_host = g_array_new (FALSE, FALSE, sizeof (guint));
+    }
+}
+
+void
+uzbl_rules_free ()
+{
+    guint i;
+    for (i = 0; i < UZBL_RULES_LAST; ++i) {
+        UzblRuleSet *set = &uzbl.rules->tables[i];
+
+        g_ptr_array_unref (set->rules);
+        g_hash_table_destroy (set->by_host);
+        g_array_free (set->any_host, TRUE);
+    }
+
+    g_free (uzbl.rules);
+    uzbl.rules = NULL;
+}
+
+static gboolean
+parse_action (const gchar *action, UzblRuleAction *value);
+static gboolean
+parse_pattern (UzblRule *rule, const gchar *pattern);
+
+gboolean
+uzbl_rules_add (UzblRuleTable  table,
+                const gchar   *pattern,
+                const gchar   *action,
+                const gchar   *argument)
+{
+    UzblRuleSet *set = &uzbl.rules->tables[table];
+    UzblRule *rule = g_malloc0 (sizeof (UzblRule));
+
+    if (!parse_action (action, &rule->action)) {
+        uzbl_debug ("Unrecognized rule action: %s\n", action);
+        free_rule (rule);
+        return FALSE;
+    }
+
+    if (((rule->action == UZBL_RULE_REWRITE) || (rule->action == UZBL_RULE_DELEGATE)) &&
+        (!argument || !*argument)) {
+        uzbl_debug ("Rule action %s requires an argument\n", action);
+        free_rule (rule);
+        return FALSE;
+    }
+
+    /* Requests are decided once their response has arrived, which is too
+     * late to send them anywhere else. */
+    if ((table == UZBL_RULES_REQUEST) && (rule->action == UZBL_RULE_REWRITE)) {
+        uzbl_debug ("Request rules can't rewrite\n");
+        free_rule (rule);
+        return FALSE;
+    }
+
+    if (!parse_pattern (rule, pattern)) {
+        free_rule (rule);
+        return FALSE;
+    }
+
+    rule->argument = g_strdup (argument);
+    rule->index = set->rules->len;
+    g_ptr_array_add (set->rules, rule);
+
+    if (rule->host) {
+        GArray *indices = g_hash_table_lookup (set->by_host, rule->host);
+
+        if (!indices) {
+            indices = g_array_new (FALSE, FALSE, sizeof (guint));
+            g_hash_table_insert (set->by_host, g_strdup (rule->host), indices);
+        }
+
+        g_array_append_val (indices, rule->index);
+    } else {
+        g_array_append_val (set->any_host, rule->index);
+    }
+
+    return TRUE;
+}
+
+void
+uzbl_rules_clear (UzblRuleTable table)
+{
+    UzblRuleSet *set = &uzbl.rules->tables[table];
+
+    g_ptr_array_set_size (set->rules, 0);
+    g_hash_table_remove_all (set->by_host);
+    g_array_set_size (set->any_host, 0);
+}
+
+static gboolean
+split_uri (const gchar *uri, gchar **scheme, gchar **host, const gchar **path);
+static const UzblRule *
+first_match (UzblRuleSet *set, GArray *indices, const UzblRule *best,
+             const gchar *uri, const gchar *scheme, const gchar *path,
+             gboolean exact_host);
+
+UzblRuleAction
+uzbl_rules_match (UzblRuleTable   table,
+                  const gchar    *uri,
+                  gchar         **argument)
+{
+    UzblRuleSet *set = &uzbl.rules->tables[table];
+    gchar *scheme;
+    gchar *host;
+    const gchar *path;
+
+    *argument = NULL;
+
+    if (!set->rules->len || !uri || !split_uri (uri, &scheme, &host, &path)) {
+        return UZBL_RULE_NONE;
+    }
+
+    const UzblRule *best = first_match (set, set->any_host, NULL,
+                                        uri, scheme, path, FALSE);
+
+    /* Check the rules for each suffix of the host, e.g. "www.example.com",
+     * "example.com" and "com". */
+    const gchar *suffix = host;
+    while (suffix && *suffix) {
+        GArray *indices = g_hash_table_lookup (set->by_host, suffix);
+
+        if (indices) {
+            best = first_match (set, indices, best,
+                                uri, scheme, path, (suffix == host));
+        }
+
+        suffix = strchr (suffix, '.');
+        if (suffix) {
+            ++suffix;
+        }
+    }
+
+    UzblRuleAction action = UZBL_RULE_NONE;
+
+    if (best) {
+        action = best->action;
+
+        if (action == UZBL_RULE_REWRITE) {
+            /* Regular expressions may refer to groups in the replacement. */
+            *argument = best->regex ?
+                g_regex_replace (best->regex, uri, -1, 0, best->argument, 0, NULL) :
+                g_strdup (best->argument);
+        } else if (action == UZBL_RULE_DELEGATE) {
+            *argument = g_strdup (best->argument);
+        }
+
+        if ((action == UZBL_RULE_REWRITE) && !*argument) {
+            action = UZBL_RULE_NONE;
+        }
+    }
+
+    g_free (scheme);
+    g_free (host);
+
+    return action;
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+void
+free_rule (gpointer data)
+{
+    UzblRule *rule = (UzblRule *)data;
+
+    g_free (rule->scheme);
+    g_free (rule->host);
+    g_free (rule->path);
+    if (rule->regex) {
+        g_regex_unref (rule->regex);
+    }
+    g_free (rule->argument);
+
+    g_free (rule);
+}
+
+void
+free_index (gpointer data)
+{
+    g_array_free ((GArray *)data, TRUE);
+}
+
+gboolean
+parse_action (const gchar *action, UzblRuleAction *value)
+{
+    static const struct {
+        const gchar *name;
+        UzblRuleAction action;
+    } actions[] = {
+        { "allow",    UZBL_RULE_ALLOW    },
+        { "ignore",   UZBL_RULE_IGNORE   },
+        { "download", UZBL_RULE_DOWNLOAD },
+        { "rewrite",  UZBL_RULE_REWRITE  },
+        { "delegate", UZBL_RULE_DELEGATE }
+    };
+
+    guint i;
+    for (i = 0; i < G_N_ELEMENTS (actions); ++i) {
+        if (!g_strcmp0 (action, actions[i].name)) {
+            *value = actions[i].action;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+gboolean
+parse_pattern (UzblRule *rule, const gchar *pattern)
+{
+    if (!pattern || !*pattern) {
+        uzbl_debug ("Empty rule pattern\n");
+        return FALSE;
+    }
+
+    /* "~REGEX" matches the whole URI against a regular expression. */
+    if (*pattern == '~') {
+        GError *err = NULL;
+
+        rule->regex = g_regex_new (pattern + 1, G_REGEX_OPTIMIZE, 0, &err);
+        if (!rule->regex) {
+            uzbl_debug ("Invalid rule regex: %s\n", err->message);
+            g_error_free (err);
+            return FALSE;
+        }
+
+        return TRUE;
+    }
+
+    /* Otherwise it is "[SCHEME:][//][HOST][/PATH]" where a host of the form
+     * ".example.com" or "*.example.com" also matches any subdomain and "*"
+     * anywhere matches anything. */
+    const gchar *p = pattern;
+    const gchar *sep = strstr (p, "://");
+
+    if (sep) {
+        rule->scheme = g_ascii_strdown (p, sep - p);
+        p = sep + 3;
+    } else if ((sep = strchr (p, ':')) && !strchr (p, '/')) {
+        rule->scheme = g_ascii_strdown (p, sep - p);
+        p = sep + 1;
+    }
+
+    if (rule->scheme && (!*rule->scheme || !strcmp (rule->scheme, "*"))) {
+        g_free (rule->scheme);
+        rule->scheme = NULL;
+    }
+
+    const gchar *host_end = strchr (p, '/');
+    if (!host_end) {
+        host_end = p + strlen (p);
+    }
+
+    if (g_str_has_prefix (p, "*.")) {
+        rule->subdomains = TRUE;
+        p += 2;
+    } else if (*p == '.') {
+        rule->subdomains = TRUE;
+        ++p;
+    }
+
+    if ((host_end > p) && ((host_end - p != 1) || (*p != '*'))) {
+        rule->host = g_ascii_strdown (p, host_end - p);
+    }
+
+    if (*host_end && strcmp (host_end, "/") && strcmp (host_end, "/*")) {
+        gsize len = strlen (host_end);
+        /* A trailing '*' on a prefix is implied. */
+        if (host_end[len - 1] == '*') {
+            --len;
+        }
+        rule->path = g_strndup (host_end, len);
+    }
+
+    return TRUE;
+}
+
+gboolean
+split_uri (const gchar *uri, gchar **scheme, gchar **host, const gchar **path)
+{
+    const gchar *colon = strchr (uri, ':');
+
+    if (!colon) {
+        return FALSE;
+    }
+
+    *scheme = g_ascii_strdown (uri, colon - uri);
+
+    const gchar *p = colon + 1;
+
+    if (g_str_has_prefix (p, "//")) {
+        p += 2;
+
+        const gchar *end = p + strcspn (p, "/?#");
+        const gchar *at = memchr (p, '@', end - p);
+        const gchar *host_start = at ? at + 1 : p;
+        const gchar *host_end = end;
+
+        if (*host_start == '[') {
+            const gchar *bracket = memchr (host_start, ']', end - host_start);
+            if (bracket) {
+                host_end = bracket + 1;
+            }
+        } else {
+            const gchar *port = memchr (host_start, ':', end - host_start);
+            if (port) {
+                host_end = port;
+            }
+        }
+
+        *host = g_ascii_strdown (host_start, host_end - host_start);
+        *path = *end ? end : "/";
+    } else {
+        *host = g_strdup ("");
+        *path = p;
+    }
+
+    return TRUE;
+}
+
+const UzblRule *
+first_match (UzblRuleSet *set, GArray *indices, const UzblRule *best,
+             const gchar *uri, const gchar *scheme, const gchar *path,
+             gboolean exact_host)
+{
+    guint i;
+
+    for (i = 0; i < indices->len; ++i) {
+        guint index = g_array_index (indices, guint, i);
+        const UzblRule *rule;
+
+        /* Indices are in order, so nothing later can beat the best. */
+        if (best && (index > best->index)) {
+            break;
+        }
+
+        rule = g_ptr_array_index (set->rules, index);
+
+        if (rule->host && !exact_host && !rule->subdomains) {
+            continue;
+        }
+        if (rule->scheme && strcmp (rule->scheme, scheme)) {
+            continue;
+        }
+        if (rule->path && !g_str_has_prefix (path, rule->path)) {
+            continue;
+        }
+        if (rule->regex && !g_regex_match (rule->regex, uri, 0, NULL)) {
+            continue;
+        }
+
+        return rule;
+    }
+
+    return best;
+}
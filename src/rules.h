@@ -0,0 +1,37 @@
+#ifndef UZBL_RULES_H
+#define UZBL_RULES_H
+
+#include <glib.h>
+
+typedef enum {
+    UZBL_RULES_NAVIGATION,
+    UZBL_RULES_REQUEST,
+
+    UZBL_RULES_LAST
+} UzblRuleTable;
+
+typedef enum {
+    UZBL_RULE_NONE,
+    UZBL_RULE_ALLOW,
+    UZBL_RULE_IGNORE,
+    UZBL_RULE_DOWNLOAD,
+    UZBL_RULE_REWRITE,
+    UZBL_RULE_DELEGATE
+} UzblRuleAction;
+
+gboolean
+uzbl_rules_add (UzblRuleTable  table,
+                const gchar   *pattern,
+                const gchar   *action,
+                const gchar   *argument);
+void
+uzbl_rules_clear (UzblRuleTable table);
+
+/* Returns the action of the first rule matching the URI. For rewrite rules,
+ * the argument is the new URI; for delegate rules, it is the command. */
+UzblRuleAction
+uzbl_rules_match (UzblRuleTable   table,
+                  const gchar    *uri,
+                  gchar         **argument);
+
+#endif
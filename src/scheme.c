@@ -3,11 +3,61 @@
 #include "commands.h"
 #include "io.h"
 #include "uzbl-core.h"
+#include "variables.h"
 
 #include <string.h>
 
+typedef struct {
+    gchar  *uri;
+    gchar  *content_type;
+    GBytes *body;
+    gint64  expires;
+    GList  *link;
+} UzblSchemeCacheEntry;
+
+struct _UzblScheme {
+    /* Responses by URI. */
+    GHashTable *cache;
+    /* Entries, most recently used first. */
+    GQueue      lru;
+    gsize       cache_bytes;
+};
+
+/* A streamed response which is waiting for its header or, when it may be
+ * cached, for its body. */
+typedef struct {
+    WebKitURISchemeRequest *request;
+    GDataInputStream       *stream;
+    gchar                  *content_type;
+    gint64                  ttl;
+} UzblSchemeResponse;
+
 /* =========================== PUBLIC API =========================== */
 
+static void
+free_cache_entry (gpointer data);
+
+void
+uzbl_scheme_init ()
+{
+    uzbl.scheme = g_malloc (sizeof (UzblScheme));
+
+    uzbl.scheme->cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+        NULL, free_cache_entry);
+    g_queue_init (&uzbl.scheme->lru);
+    uzbl.scheme->cache_bytes = 0;
+}
+
+void
+uzbl_scheme_free ()
+{
+    g_queue_clear (&uzbl.scheme->lru);
+    g_hash_table_destroy (uzbl.scheme->cache);
+
+    g_free (uzbl.scheme);
+    uzbl.scheme = NULL;
+}
+
 static void
 scheme_callback (WebKitURISchemeRequest *request, gpointer data);
 
@@ -16,8 +66,46 @@ uzbl_scheme_add_handler (const gchar *scheme, const gchar *command)
 {
     WebKitWebContext *context = webkit_web_view_get_context (uzbl.gui.web_view);
     webkit_web_context_register_uri_scheme (context, scheme, scheme_callback, g_strdup (command), g_free);
+
+    /* The new handler may answer differently. */
+    uzbl_scheme_clear_cache ();
+}
+
+static void
+remove_cache_entry (UzblSchemeCacheEntry *entry);
+
+void
+uzbl_scheme_trim_cache ()
+{
+    if (!uzbl.scheme) {
+        return;
+    }
+
+    gsize limit = MAX (uzbl_variables_get_int ("scheme_cache_size"), 0);
+
+    while (uzbl.scheme->cache_bytes > limit) {
+        remove_cache_entry (g_queue_peek_tail (&uzbl.scheme->lru));
+    }
 }
 
+void
+uzbl_scheme_clear_cache ()
+{
+    g_queue_clear (&uzbl.scheme->lru);
+    g_hash_table_remove_all (uzbl.scheme->cache);
+    uzbl.scheme->cache_bytes = 0;
+}
+
+static UzblSchemeCacheEntry *
+lookup_cache (const gchar *uri);
+static void
+store_cache (const gchar *uri, const gchar *content_type, GBytes *body, gint64 ttl);
+static gint64
+parse_header (gchar *header);
+static void
+finish_request (WebKitURISchemeRequest *request, GBytes *body, const gchar *content_type);
+static void
+scheme_header (GObject *source, GAsyncResult *res, gpointer data);
 static void
 scheme_return (GObject *source, GAsyncResult *res, gpointer data);
 
@@ -26,6 +114,14 @@ scheme_callback (WebKitURISchemeRequest *request, gpointer data)
 {
     gchar *command = (gchar *)data;
     const gchar *uri = webkit_uri_scheme_request_get_uri (request);
+    GError *err = NULL;
+
+    UzblSchemeCacheEntry *entry = lookup_cache (uri);
+    if (entry) {
+        uzbl_debug ("Scheme response cached -> %s\n", uri);
+        finish_request (request, entry->body, entry->content_type);
+        return;
+    }
 
     GArray *args = uzbl_commands_args_new ();
     const UzblCommand *cmd = uzbl_commands_parse (command, args);
@@ -37,7 +133,263 @@ scheme_callback (WebKitURISchemeRequest *request, gpointer data)
 
     uzbl_commands_args_append (args, g_strdup (uri));
 
-    uzbl_io_schedule_command (cmd, args, scheme_return, request);
+    /* Programs are read from as they write so that large responses are never
+     * held in memory. The first line is the content type; the response is
+     * handed to WebKit as soon as it is available. */
+    GInputStream *output = uzbl_commands_spawn_stream (cmd, args, &err);
+
+    if (output) {
+        UzblSchemeResponse *response = g_new0 (UzblSchemeResponse, 1);
+
+        response->request = g_object_ref (request);
+        response->stream = g_data_input_stream_new (output);
+
+        g_data_input_stream_read_line_async (response->stream, G_PRIORITY_DEFAULT, NULL,
+            scheme_header, response);
+
+        g_object_unref (output);
+        uzbl_commands_args_free (args);
+    } else if (err) {
+        uzbl_debug ("Failed to start scheme handler: %s\n", err->message);
+        webkit_uri_scheme_request_finish_error (request, err);
+        g_error_free (err);
+        uzbl_commands_args_free (args);
+    } else {
+        g_object_ref (request);
+        uzbl_io_schedule_command (cmd, args, scheme_return, request);
+    }
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+void
+free_cache_entry (gpointer data)
+{
+    UzblSchemeCacheEntry *entry = (UzblSchemeCacheEntry *)data;
+
+    g_free (entry->uri);
+    g_free (entry->content_type);
+    g_bytes_unref (entry->body);
+
+    g_free (entry);
+}
+
+void
+remove_cache_entry (UzblSchemeCacheEntry *entry)
+{
+    uzbl.scheme->cache_bytes -= g_bytes_get_size (entry->body);
+    g_queue_delete_link (&uzbl.scheme->lru, entry->link);
+    g_hash_table_remove (uzbl.scheme->cache, entry->uri);
+}
+
+UzblSchemeCacheEntry *
+lookup_cache (const gchar *uri)
+{
+    UzblSchemeCacheEntry *entry = g_hash_table_lookup (uzbl.scheme->cache, uri);
+
+    if (!entry) {
+        return NULL;
+    }
+
+    if (entry->expires <= g_get_monotonic_time ()) {
+        remove_cache_entry (entry);
+        return NULL;
+    }
+
+    g_queue_unlink (&uzbl.scheme->lru, entry->link);
+    g_queue_push_head_link (&uzbl.scheme->lru, entry->link);
+
+    return entry;
+}
+
+void
+store_cache (const gchar *uri, const gchar *content_type, GBytes *body, gint64 ttl)
+{
+    gsize limit = MAX (uzbl_variables_get_int ("scheme_cache_size"), 0);
+    gsize size = g_bytes_get_size (body);
+
+    if (!ttl || (size > limit)) {
+        return;
+    }
+
+    UzblSchemeCacheEntry *old = g_hash_table_lookup (uzbl.scheme->cache, uri);
+    if (old) {
+        remove_cache_entry (old);
+    }
+
+    UzblSchemeCacheEntry *entry = g_new (UzblSchemeCacheEntry, 1);
+
+    entry->uri = g_strdup (uri);
+    entry->content_type = g_strdup (content_type);
+    entry->body = g_bytes_ref (body);
+    entry->expires = g_get_monotonic_time () + ttl * G_USEC_PER_SEC;
+
+    g_queue_push_head (&uzbl.scheme->lru, entry);
+    entry->link = g_queue_peek_head_link (&uzbl.scheme->lru);
+    g_hash_table_insert (uzbl.scheme->cache, entry->uri, entry);
+    uzbl.scheme->cache_bytes += size;
+
+    uzbl_scheme_trim_cache ();
+}
+
+void
+finish_request (WebKitURISchemeRequest *request, GBytes *body, const gchar *content_type)
+{
+    GInputStream *stream = g_memory_input_stream_new_from_bytes (body);
+
+    webkit_uri_scheme_request_finish (request, stream, g_bytes_get_size (body),
+        (content_type && *content_type) ? content_type : NULL);
+
+    g_object_unref (stream);
+}
+
+/* The header is the content type optionally followed by a tab and
+ * Cache-Control-like directives, e.g. "text/html\tmax-age=60". The header
+ * is truncated to the content type and the time to cache the response for
+ * (zero for never) is returned. */
+gint64
+parse_header (gchar *header)
+{
+    gint64 max_ttl = uzbl_variables_get_int ("scheme_cache_ttl");
+    gint64 ttl = 0;
+    gchar *directives = strchr (header, '\t');
+
+    if (!directives) {
+        return 0;
+    }
+
+    *directives++ = '\0';
+
+    gchar **tokens = g_strsplit_set (directives, ", \t", 0);
+    gchar **token;
+
+    for (token = tokens; *token; ++token) {
+        if (!g_strcmp0 (*token, "cache")) {
+            ttl = max_ttl;
+        } else if (g_str_has_prefix (*token, "max-age=")) {
+            ttl = g_ascii_strtoll (*token + strlen ("max-age="), NULL, 10);
+        } else if (!g_strcmp0 (*token, "no-store")) {
+            ttl = 0;
+            break;
+        }
+    }
+
+    g_strfreev (tokens);
+
+    if (uzbl_variables_get_int ("scheme_cache_size") <= 0) {
+        return 0;
+    }
+
+    return CLAMP (ttl, 0, MAX (max_ttl, 0));
+}
+
+static void
+free_response (UzblSchemeResponse *response);
+static void
+fill_response (UzblSchemeResponse *response);
+
+void
+scheme_header (GObject *source, GAsyncResult *res, gpointer data)
+{
+    UzblSchemeResponse *response = (UzblSchemeResponse *)data;
+    GError *err = NULL;
+
+    response->content_type = g_data_input_stream_read_line_finish (
+        G_DATA_INPUT_STREAM (source), res, NULL, &err);
+
+    if (err) {
+        webkit_uri_scheme_request_finish_error (response->request, err);
+        g_error_free (err);
+        free_response (response);
+        return;
+    }
+
+    if (response->content_type) {
+        response->ttl = parse_header (response->content_type);
+    }
+
+    /* Responses which may be cached are read completely first (the stream
+     * buffers them) unless they turn out to be too large. */
+    if (response->ttl) {
+        fill_response (response);
+        return;
+    }
+
+    /* The rest of the output is the body; its length is unknown. */
+    webkit_uri_scheme_request_finish (response->request, G_INPUT_STREAM (response->stream), -1,
+        (response->content_type && *response->content_type) ? response->content_type : NULL);
+
+    free_response (response);
+}
+
+void
+free_response (UzblSchemeResponse *response)
+{
+    g_object_unref (response->request);
+    g_object_unref (response->stream);
+    g_free (response->content_type);
+
+    g_free (response);
+}
+
+static void
+response_filled (GObject *source, GAsyncResult *res, gpointer data);
+
+void
+fill_response (UzblSchemeResponse *response)
+{
+    GBufferedInputStream *buffered = G_BUFFERED_INPUT_STREAM (response->stream);
+    gsize limit = MAX (uzbl_variables_get_int ("scheme_cache_size"), 0);
+    gsize available = g_buffered_input_stream_get_available (buffered);
+    gsize size = g_buffered_input_stream_get_buffer_size (buffered);
+
+    if (available == size) {
+        if (limit <= size) {
+            /* Too large to cache; stream the rest as usual. */
+            webkit_uri_scheme_request_finish (response->request, G_INPUT_STREAM (response->stream), -1,
+                *response->content_type ? response->content_type : NULL);
+            free_response (response);
+            return;
+        }
+
+        g_buffered_input_stream_set_buffer_size (buffered, MIN (size * 2, limit));
+    }
+
+    g_buffered_input_stream_fill_async (buffered, -1, G_PRIORITY_DEFAULT, NULL,
+        response_filled, response);
+}
+
+void
+response_filled (GObject *source, GAsyncResult *res, gpointer data)
+{
+    UzblSchemeResponse *response = (UzblSchemeResponse *)data;
+    GBufferedInputStream *buffered = G_BUFFERED_INPUT_STREAM (source);
+    GError *err = NULL;
+    gssize read = g_buffered_input_stream_fill_finish (buffered, res, &err);
+
+    if (read < 0) {
+        webkit_uri_scheme_request_finish_error (response->request, err);
+        g_error_free (err);
+        free_response (response);
+        return;
+    }
+
+    if (read) {
+        fill_response (response);
+        return;
+    }
+
+    /* The whole body is buffered. */
+    gsize size;
+    const void *buffer = g_buffered_input_stream_peek_buffer (buffered, &size);
+    GBytes *body = g_bytes_new (buffer, size);
+    const gchar *uri = webkit_uri_scheme_request_get_uri (response->request);
+
+    store_cache (uri, response->content_type, body, response->ttl);
+    finish_request (response->request, body, response->content_type);
+
+    g_bytes_unref (body);
+    free_response (response);
 }
 
 void
@@ -47,16 +399,33 @@ scheme_return (GObject *source, GAsyncResult *res, gpointer data)
     GError *err = NULL;
     GString *result = uzbl_io_command_finish (source, res, &err);
 
+    if (!result) {
+        if (!err) {
+            err = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED,
+                "scheme handler returned no result");
+        }
+        webkit_uri_scheme_request_finish_error (request, err);
+        g_error_free (err);
+        g_object_unref (request);
+        return;
+    }
+
     gchar *end = strchr (result->str, '\n');
-    size_t line_len = end ? (size_t)(end - result->str) : result->len;
+    gsize line_len = end ? (gsize)(end - result->str) : result->len;
+    gsize body_offset = end ? line_len + 1 : result->len;
+    gchar *content_type = g_strndup (result->str, line_len);
+    gint64 ttl = parse_header (content_type);
 
-    gint64 len = result->len - line_len - 1;
-    GInputStream *stream = g_memory_input_stream_new_from_data (
-        g_strdup (end + 1),
-        len, g_free);
-    *end = '\0';
+    /* Share the result's buffer with the stream rather than copying it. */
+    GBytes *bytes = g_string_free_to_bytes (result);
+    GBytes *body = g_bytes_new_from_bytes (bytes, body_offset,
+        g_bytes_get_size (bytes) - body_offset);
 
-    webkit_uri_scheme_request_finish (request, stream, len, result->str);
+    store_cache (webkit_uri_scheme_request_get_uri (request), content_type, body, ttl);
+    finish_request (request, body, content_type);
 
-    g_object_unref (stream);
+    g_bytes_unref (body);
+    g_bytes_unref (bytes);
+    g_free (content_type);
+    g_object_unref (request);
 }
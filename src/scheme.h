@@ -6,4 +6,10 @@
 void
 uzbl_scheme_add_handler (const gchar *scheme, const gchar *command);
 
+/* Drops cached responses until the cache fits in scheme_cache_size. */
+void
+uzbl_scheme_trim_cache ();
+void
+uzbl_scheme_clear_cache ();
+
 #endif
@@ -1,6 +1,16 @@
 #ifndef UZBL_SETUP_H
 #define UZBL_SETUP_H
 
+void
+uzbl_binds_init ();
+void
+uzbl_binds_free ();
+
+void
+uzbl_bookmarks_init ();
+void
+uzbl_bookmarks_free ();
+
 void
 uzbl_commands_init ();
 void
@@ -9,6 +19,11 @@ uzbl_commands_free ();
 void
 uzbl_commands_send_builtin_event ();
 
+void
+uzbl_cookies_init ();
+void
+uzbl_cookies_free ();
+
 void
 uzbl_events_init ();
 void
@@ -21,6 +36,11 @@ uzbl_gui_init (const gchar *cache_dir,
 void
 uzbl_gui_free ();
 
+void
+uzbl_history_init ();
+void
+uzbl_history_free ();
+
 void
 uzbl_inspector_init ();
 void
@@ -51,6 +71,26 @@ uzbl_requests_free ();
 void
 uzbl_requests_set_reply (const gchar *reply);
 
+void
+uzbl_rules_init ();
+void
+uzbl_rules_free ();
+
+void
+uzbl_scheme_init ();
+void
+uzbl_scheme_free ();
+
+void
+uzbl_sites_init ();
+void
+uzbl_sites_free ();
+
+void
+uzbl_snapshot_init ();
+void
+uzbl_snapshot_free ();
+
 void
 uzbl_variables_init ();
 void
@@ -0,0 +1,577 @@
+#include "sites.h"
+
+#include "commands.h"
+#include "util.h"
+#include "uzbl-core.h"
+#include "variables.h"
+
+#include <libsoup/soup.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <string.h>
+
+/* The settings file is a list of blocks of the form:
+ *
+ *   <host>
+ *     <path>
+ *       <command>
+ *
+ * Consecutive hosts or paths are alternatives. Literal hosts also match
+ * subdomains and literal paths are prefixes; anything else is a regular
+ * expression anchored at the start. A line containing only '@' ends the
+ * current block and '@@' ends the file. */
+
+typedef struct {
+    GPtrArray *prefixes;
+    GPtrArray *regexes;
+    GPtrArray *commands;
+} UzblSiteSection;
+
+typedef struct {
+    GRegex *regex;
+    GArray *sections;
+} UzblSiteRegex;
+
+struct _UzblSites {
+    gchar      *path;
+    gchar      *stamp;
+
+    GPtrArray  *sections;
+    /* Section indices for each literal host. */
+    GHashTable *hosts;
+    /* Sections for hosts which are regular expressions. */
+    GPtrArray  *regexes;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+static void
+clear_sites ();
+
+void
+uzbl_sites_init ()
+{
+    uzbl.sites = g_malloc0 (sizeof (UzblSites));
+}
+
+void
+uzbl_sites_free ()
+{
+    clear_sites ();
+
+    g_free (uzbl.sites);
+    uzbl.sites = NULL;
+}
+
+static gboolean
+load_sites (const gchar *path);
+static void
+match_host (const gchar *host, GArray *matches);
+static gboolean
+match_path (const UzblSiteSection *section, const gchar *path);
+static gint
+compare_index (gconstpointer a, gconstpointer b);
+static gboolean
+command_is_task (const gchar *command);
+static void
+site_command_done (GObject *source, GAsyncResult *res, gpointer data);
+
+void
+uzbl_sites_apply (const gchar *uri)
+{
+    gchar *path = uzbl_variables_get_string ("site_settings");
+
+    if (!*path || !uri || !load_sites (path) || !uzbl.sites->sections) {
+        g_free (path);
+        return;
+    }
+
+    g_free (path);
+
+    SoupURI *soup_uri = soup_uri_new (uri);
+
+    if (!soup_uri) {
+        return;
+    }
+
+    const gchar *host = soup_uri_get_host (soup_uri);
+    const gchar *uri_path = soup_uri_get_path (soup_uri);
+
+    if (!host || !*host) {
+        soup_uri_free (soup_uri);
+        return;
+    }
+
+    GArray *matches = g_array_new (FALSE, FALSE, sizeof (guint));
+
+    match_host (host, matches);
+
+    /* Commands run in the order they appear in the file. */
+    g_array_sort (matches, compare_index);
+
+    uzbl_variables_begin_batch ();
+
+    guint i;
+    guint last = G_MAXUINT;
+    for (i = 0; i < matches->len; ++i) {
+        guint index = g_array_index (matches, guint, i);
+        const UzblSiteSection *section;
+
+        if (index == last) {
+            continue;
+        }
+        last = index;
+
+        section = g_ptr_array_index (uzbl.sites->sections, index);
+
+        if (!match_path (section, uri_path ? uri_path : "/")) {
+            continue;
+        }
+
+        guint j;
+        for (j = 0; j < section->commands->len; ++j) {
+            const gchar *command = g_ptr_array_index (section->commands, j);
+
+            /* Tasks (e.g., js or chain) finish after the other commands. */
+            if (command_is_task (command)) {
+                /* The settings may be reloaded before the command is done. */
+                gchar *copy = g_strdup (command);
+
+                uzbl_commands_run_string_async (copy, FALSE, site_command_done, copy);
+            } else {
+                uzbl_commands_run (command, NULL);
+            }
+        }
+    }
+
+    uzbl_variables_end_batch ();
+
+    g_array_free (matches, TRUE);
+    soup_uri_free (soup_uri);
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+static void
+free_section (gpointer data);
+static void
+free_regex (gpointer data);
+static void
+free_index (gpointer data);
+
+void
+clear_sites ()
+{
+    g_free (uzbl.sites->path);
+    uzbl.sites->path = NULL;
+    g_free (uzbl.sites->stamp);
+    uzbl.sites->stamp = NULL;
+
+    if (uzbl.sites->sections) {
+        g_ptr_array_free (uzbl.sites->sections, TRUE);
+        g_hash_table_destroy (uzbl.sites->hosts);
+        g_ptr_array_free (uzbl.sites->regexes, TRUE);
+    }
+
+    uzbl.sites->sections = NULL;
+    uzbl.sites->hosts = NULL;
+    uzbl.sites->regexes = NULL;
+}
+
+void
+free_section (gpointer data)
+{
+    UzblSiteSection *section = (UzblSiteSection *)data;
+
+    g_ptr_array_free (section->prefixes, TRUE);
+    g_ptr_array_free (section->regexes, TRUE);
+    g_ptr_array_free (section->commands, TRUE);
+
+    g_free (section);
+}
+
+void
+free_regex (gpointer data)
+{
+    UzblSiteRegex *regex = (UzblSiteRegex *)data;
+
+    g_regex_unref (regex->regex);
+    g_array_free (regex->sections, TRUE);
+
+    g_free (regex);
+}
+
+void
+free_index (gpointer data)
+{
+    g_array_free ((GArray *)data, TRUE);
+}
+
+static GPtrArray *
+settings_files (const gchar *path);
+static gchar *
+settings_stamp (const gchar *path, GPtrArray *files);
+static void
+parse_sites (const gchar *contents);
+
+gboolean
+load_sites (const gchar *path)
+{
+    GPtrArray *files = settings_files (path);
+
+    if (!files) {
+        return FALSE;
+    }
+
+    /* Only re-read the settings when they have changed. */
+    gchar *stamp = settings_stamp (path, files);
+
+    if (!g_strcmp0 (path, uzbl.sites->path) && !g_strcmp0 (stamp, uzbl.sites->stamp)) {
+        g_free (stamp);
+        g_ptr_array_free (files, TRUE);
+        return TRUE;
+    }
+
+    clear_sites ();
+    uzbl.sites->path = g_strdup (path);
+    uzbl.sites->stamp = stamp;
+    uzbl.sites->sections = g_ptr_array_new_with_free_func (free_section);
+    uzbl.sites->hosts = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, free_index);
+    uzbl.sites->regexes = g_ptr_array_new_with_free_func (free_regex);
+
+    /* The files of a directory are read as if they were one file. */
+    GString *contents = g_string_new ("");
+
+    guint i;
+    for (i = 0; i < files->len; ++i) {
+        const gchar *file = g_ptr_array_index (files, i);
+        gchar *data = NULL;
+        GError *err = NULL;
+
+        if (!g_file_get_contents (file, &data, NULL, &err)) {
+            uzbl_debug ("Failed to read site settings: %s\n", err->message);
+            g_error_free (err);
+            continue;
+        }
+
+        g_string_append (contents, data);
+        g_string_append_c (contents, '\n');
+
+        g_free (data);
+    }
+
+    parse_sites (contents->str);
+
+    g_string_free (contents, TRUE);
+    g_ptr_array_free (files, TRUE);
+
+    return TRUE;
+}
+
+static gint
+compare_paths (gconstpointer a, gconstpointer b);
+
+GPtrArray *
+settings_files (const gchar *path)
+{
+    GPtrArray *files = g_ptr_array_new_with_free_func (g_free);
+
+    if (!g_file_test (path, G_FILE_TEST_IS_DIR)) {
+        if (!g_file_test (path, G_FILE_TEST_IS_REGULAR)) {
+            uzbl_debug ("Site settings not found: %s\n", path);
+            g_ptr_array_free (files, TRUE);
+            return NULL;
+        }
+
+        g_ptr_array_add (files, g_strdup (path));
+        return files;
+    }
+
+    GDir *dir = g_dir_open (path, 0, NULL);
+    const gchar *name;
+
+    if (!dir) {
+        g_ptr_array_free (files, TRUE);
+        return NULL;
+    }
+
+    while ((name = g_dir_read_name (dir))) {
+        if (g_pattern_match_simple ("*.pss", name)) {
+            g_ptr_array_add (files, g_build_filename (path, name, NULL));
+        }
+    }
+
+    g_dir_close (dir);
+
+    g_ptr_array_sort (files, compare_paths);
+
+    return files;
+}
+
+gint
+compare_paths (gconstpointer a, gconstpointer b)
+{
+    return strcmp (*(const gchar * const *)a, *(const gchar * const *)b);
+}
+
+gchar *
+settings_stamp (const gchar *path, GPtrArray *files)
+{
+    GString *stamp = g_string_new ("");
+    struct stat st;
+
+    if (!stat (path, &st)) {
+        g_string_append_printf (stamp, "%ld;", (long)st.st_mtime);
+    }
+
+    guint i;
+    for (i = 0; i < files->len; ++i) {
+        const gchar *file = g_ptr_array_index (files, i);
+
+        if (!stat (file, &st)) {
+            g_string_append_printf (stamp, "%s:%ld:%ld;",
+                file, (long)st.st_mtime, (long)st.st_size);
+        }
+    }
+
+    return g_string_free (stamp, FALSE);
+}
+
+static gboolean
+is_literal (const gchar *pattern);
+static GArray *
+host_sections (const gchar *pattern);
+
+void
+parse_sites (const gchar *contents)
+{
+    gchar **lines = g_strsplit (contents, "\n", 0);
+    /* Lists of sections for the hosts of the current block. */
+    GPtrArray *targets = g_ptr_array_new ();
+    UzblSiteSection *section = NULL;
+    gboolean in_hosts = FALSE;
+    gboolean in_paths = FALSE;
+    gboolean dead = FALSE;
+    gssize path_indent = -1;
+
+    gchar **line;
+    for (line = lines; *line; ++line) {
+        gchar *raw = g_strstrip (g_strdup (*line));
+        gssize indent = strspn (*line, " \t");
+
+        if (!*raw) {
+            g_free (raw);
+            continue;
+        }
+
+        if (!strcmp (raw, "@@")) {
+            g_free (raw);
+            break;
+        }
+
+        if (!strcmp (raw, "@")) {
+            dead = TRUE;
+            in_hosts = in_paths = FALSE;
+        } else if (!indent) {
+            if (!in_hosts) {
+                g_ptr_array_set_size (targets, 0);
+                section = NULL;
+                dead = FALSE;
+                path_indent = -1;
+            }
+
+            GArray *sections = host_sections (raw);
+            if (sections) {
+                g_ptr_array_add (targets, sections);
+            }
+
+            in_hosts = TRUE;
+            in_paths = FALSE;
+        } else if ((path_indent < 0) || (indent <= path_indent)) {
+            if (path_indent < 0) {
+                path_indent = indent;
+            }
+
+            if (!in_paths && !dead) {
+                guint index = uzbl.sites->sections->len;
+
+                section = g_malloc (sizeof (UzblSiteSection));
+                section->prefixes = g_ptr_array_new_with_free_func (g_free);
+                section->regexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_regex_unref);
+                section->commands = g_ptr_array_new_with_free_func (g_free);
+                g_ptr_array_add (uzbl.sites->sections, section);
+
+                guint i;
+                for (i = 0; i < targets->len; ++i) {
+                    g_array_append_val ((GArray *)g_ptr_array_index (targets, i), index);
+                }
+            }
+
+            if (section && !dead) {
+                if (is_literal (raw)) {
+                    g_ptr_array_add (section->prefixes, g_strdup (raw));
+                } else {
+                    GError *err = NULL;
+                    GRegex *regex = g_regex_new (raw, G_REGEX_ANCHORED | G_REGEX_OPTIMIZE, 0, &err);
+
+                    if (regex) {
+                        g_ptr_array_add (section->regexes, regex);
+                    } else {
+                        uzbl_debug ("Invalid site settings path: %s\n", err->message);
+                        g_error_free (err);
+                    }
+                }
+            }
+
+            in_hosts = FALSE;
+            in_paths = TRUE;
+        } else {
+            if (section && !dead) {
+                g_ptr_array_add (section->commands, g_strdup (raw));
+            }
+
+            in_hosts = in_paths = FALSE;
+        }
+
+        g_free (raw);
+    }
+
+    g_ptr_array_free (targets, TRUE);
+    g_strfreev (lines);
+}
+
+gboolean
+is_literal (const gchar *pattern)
+{
+    /* '.' is allowed since it is far more likely to be part of a name. */
+    return !pattern[strcspn (pattern, "\\^$*+?()[]{}|")];
+}
+
+GArray *
+host_sections (const gchar *pattern)
+{
+    if (is_literal (pattern)) {
+        gchar *host = g_ascii_strdown (*pattern == '.' ? pattern + 1 : pattern, -1);
+        GArray *sections = g_hash_table_lookup (uzbl.sites->hosts, host);
+
+        if (!sections) {
+            sections = g_array_new (FALSE, FALSE, sizeof (guint));
+            g_hash_table_insert (uzbl.sites->hosts, host, sections);
+        } else {
+            g_free (host);
+        }
+
+        return sections;
+    }
+
+    GError *err = NULL;
+    GRegex *regex = g_regex_new (pattern, G_REGEX_ANCHORED | G_REGEX_OPTIMIZE, 0, &err);
+
+    if (!regex) {
+        uzbl_debug ("Invalid site settings host: %s\n", err->message);
+        g_error_free (err);
+        return NULL;
+    }
+
+    UzblSiteRegex *entry = g_malloc (sizeof (UzblSiteRegex));
+    entry->regex = regex;
+    entry->sections = g_array_new (FALSE, FALSE, sizeof (guint));
+    g_ptr_array_add (uzbl.sites->regexes, entry);
+
+    return entry->sections;
+}
+
+void
+match_host (const gchar *host, GArray *matches)
+{
+    gchar *lower = g_ascii_strdown (host, -1);
+    const gchar *suffix = lower;
+
+    /* Check each suffix of the host, e.g. "www.example.com", "example.com"
+     * and "com". */
+    while (suffix) {
+        GArray *sections = g_hash_table_lookup (uzbl.sites->hosts, suffix);
+
+        if (sections) {
+            g_array_append_vals (matches, sections->data, sections->len);
+        }
+
+        suffix = strchr (suffix, '.');
+        if (suffix) {
+            ++suffix;
+        }
+    }
+
+    guint i;
+    for (i = 0; i < uzbl.sites->regexes->len; ++i) {
+        const UzblSiteRegex *entry = g_ptr_array_index (uzbl.sites->regexes, i);
+
+        if (g_regex_match (entry->regex, host, 0, NULL)) {
+            g_array_append_vals (matches, entry->sections->data, entry->sections->len);
+        }
+    }
+
+    g_free (lower);
+}
+
+gboolean
+match_path (const UzblSiteSection *section, const gchar *path)
+{
+    guint i;
+
+    for (i = 0; i < section->prefixes->len; ++i) {
+        if (g_str_has_prefix (path, g_ptr_array_index (section->prefixes, i))) {
+            return TRUE;
+        }
+    }
+
+    for (i = 0; i < section->regexes->len; ++i) {
+        if (g_regex_match (g_ptr_array_index (section->regexes, i), path, 0, NULL)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+gint
+compare_index (gconstpointer a, gconstpointer b)
+{
+    guint x = *(const guint *)a;
+    guint y = *(const guint *)b;
+
+    return (x > y) - (x < y);
+}
+
+gboolean
+command_is_task (const gchar *command)
+{
+    gsize len = strcspn (command, " ");
+    gchar *name = g_strndup (command, len);
+    gboolean task = uzbl_commands_is_task (uzbl_commands_lookup (name));
+
+    g_free (name);
+
+    return task;
+}
+
+void
+site_command_done (GObject *source, GAsyncResult *res, gpointer data)
+{
+    GError *err = NULL;
+    GString *result = uzbl_commands_run_finish (source, res, &err);
+
+    g_free (data);
+
+    if (err) {
+        uzbl_debug ("Failed to run site command: %s\n", err->message);
+        g_error_free (err);
+    }
+
+    if (result) {
+        g_string_free (result, TRUE);
+    }
+}
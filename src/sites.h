@@ -0,0 +1,10 @@
+#ifndef UZBL_SITES_H
+#define UZBL_SITES_H
+
+#include <glib.h>
+
+/* Runs the commands from the site_settings file which match the URI. */
+void
+uzbl_sites_apply (const gchar *uri);
+
+#endif
@@ -0,0 +1,561 @@
+#include "snapshot.h"
+
+#include "commands.h"
+#include "events.h"
+#include "type.h"
+#include "util.h"
+#include "uzbl-core.h"
+#include "variables.h"
+
+#include <glib/gstdio.h>
+
+#include <string.h>
+
+/* Bump whenever the layout below changes. */
+#define SNAPSHOT_VERSION 3
+/* (version, commit, config, [(path, mtime, size, exists)],
+ *  [(kind, line, path, [command, argument...])]) */
+#define SNAPSHOT_FORMAT "(ussa(sxxb)a(yssas))"
+
+/* Lines whose expansion only uses variables set by earlier such lines are
+ * stored parsed and run directly. Other lines are stored as read and are
+ * expanded again when replayed, so that values which depend on the instance
+ * or the environment stay current. */
+typedef enum {
+    /* A command line which is parsed again. */
+    SNAPSHOT_LINE = 'l',
+    /* A parsed command. */
+    SNAPSHOT_PARSED = 'p',
+    /* An include line and the file it resolved to; the lines of the file
+     * follow up to the matching SNAPSHOT_INCLUDE_END. The argument is stored
+     * if the line does not need to be expanded again. */
+    SNAPSHOT_INCLUDE = 'i',
+    SNAPSHOT_INCLUDE_END = 'e'
+} UzblSnapshotKind;
+
+struct _UzblSnapshot {
+    gboolean recording;
+
+    GVariantBuilder *files;
+    GVariantBuilder *commands;
+    GHashTable *seen_files;
+
+    /* Variables whose values do not depend on the instance. */
+    GHashTable *static_vars;
+    /* The variable set by the static set command being run. */
+    gchar *static_set;
+
+    /* The include line being run and its argument if it is static. */
+    gchar *include_line;
+    gchar *include_arg;
+    /* Depth of includes whose lines are not recorded because they were not
+     * run from an include line (e.g., from a chain). */
+    guint skip;
+};
+
+/* =========================== PUBLIC API =========================== */
+
+void
+uzbl_snapshot_init ()
+{
+    uzbl.snapshot = g_malloc (sizeof (UzblSnapshot));
+
+    uzbl.snapshot->recording = FALSE;
+    uzbl.snapshot->files = NULL;
+    uzbl.snapshot->commands = NULL;
+    uzbl.snapshot->seen_files = NULL;
+    uzbl.snapshot->static_vars = NULL;
+    uzbl.snapshot->static_set = NULL;
+    uzbl.snapshot->include_line = NULL;
+    uzbl.snapshot->include_arg = NULL;
+    uzbl.snapshot->skip = 0;
+}
+
+static void
+record_reset ();
+
+void
+uzbl_snapshot_free ()
+{
+    record_reset ();
+
+    g_free (uzbl.snapshot);
+    uzbl.snapshot = NULL;
+}
+
+static gboolean
+file_is_current (const gchar *path, gint64 mtime, gint64 size, gboolean exists);
+static void
+replay_commands (GVariantIter *commands, gboolean run);
+
+gboolean
+uzbl_snapshot_load (const gchar *snapshot_path, const gchar *config_path)
+{
+    gchar *contents = NULL;
+    gsize len = 0;
+
+    if (!g_file_get_contents (snapshot_path, &contents, &len, NULL)) {
+        return FALSE;
+    }
+
+    GBytes *bytes = g_bytes_new_take (contents, len);
+    GVariant *snapshot = g_variant_ref_sink (g_variant_new_from_bytes (
+        G_VARIANT_TYPE (SNAPSHOT_FORMAT), bytes, FALSE));
+    g_bytes_unref (bytes);
+
+    guint32 version;
+    const gchar *commit;
+    const gchar *config;
+    GVariantIter *files;
+    GVariantIter *commands;
+
+    g_variant_get (snapshot, "(u&s&sa(sxxb)a(yssas))",
+        &version, &commit, &config, &files, &commands);
+
+    gboolean current = ((version == SNAPSHOT_VERSION) &&
+                        !g_strcmp0 (commit, COMMIT) &&
+                        !g_strcmp0 (config, config_path));
+
+    const gchar *path;
+    gint64 mtime;
+    gint64 size;
+    gboolean exists;
+
+    while (current && g_variant_iter_next (files, "(&sxxb)", &path, &mtime, &size, &exists)) {
+        if (!file_is_current (path, mtime, size, exists)) {
+            uzbl_debug ("Config snapshot is stale: %s changed\n", path);
+            current = FALSE;
+        }
+    }
+
+    if (current) {
+        uzbl_variables_begin_batch ();
+        replay_commands (commands, TRUE);
+        uzbl_variables_end_batch ();
+    }
+
+    g_variant_iter_free (files);
+    g_variant_iter_free (commands);
+    g_variant_unref (snapshot);
+
+    return current;
+}
+
+void
+uzbl_snapshot_record_begin ()
+{
+    record_reset ();
+
+    uzbl.snapshot->recording = TRUE;
+    uzbl.snapshot->files = g_variant_builder_new (G_VARIANT_TYPE ("a(sxxb)"));
+    uzbl.snapshot->commands = g_variant_builder_new (G_VARIANT_TYPE ("a(yssas)"));
+    uzbl.snapshot->seen_files = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, NULL);
+    uzbl.snapshot->static_vars = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, NULL);
+}
+
+gboolean
+uzbl_snapshot_record_end (const gchar *snapshot_path, const gchar *config_path)
+{
+    if (!uzbl.snapshot->recording) {
+        return FALSE;
+    }
+
+    GVariant *snapshot = g_variant_ref_sink (g_variant_new (SNAPSHOT_FORMAT,
+        (guint32)SNAPSHOT_VERSION,
+        COMMIT,
+        config_path,
+        uzbl.snapshot->files,
+        uzbl.snapshot->commands));
+
+    record_reset ();
+
+    GError *err = NULL;
+    gchar *dir = g_path_get_dirname (snapshot_path);
+    gboolean written = FALSE;
+
+    if (g_mkdir_with_parents (dir, 0700)) {
+        g_warning ("Failed to create directory for config snapshot: %s", dir);
+    } else if (!g_file_set_contents (snapshot_path,
+                                     g_variant_get_data (snapshot),
+                                     g_variant_get_size (snapshot),
+                                     &err)) {
+        g_warning ("Failed to write config snapshot: %s", err->message);
+        g_error_free (err);
+    } else {
+        written = TRUE;
+    }
+
+    g_free (dir);
+    g_variant_unref (snapshot);
+
+    return written;
+}
+
+gboolean
+uzbl_snapshot_is_recording ()
+{
+    return (uzbl.snapshot && uzbl.snapshot->recording);
+}
+
+void
+uzbl_snapshot_record_file (const gchar *path)
+{
+    if (!uzbl_snapshot_is_recording ()) {
+        return;
+    }
+
+    if (g_hash_table_contains (uzbl.snapshot->seen_files, path)) {
+        return;
+    }
+    g_hash_table_add (uzbl.snapshot->seen_files, g_strdup (path));
+
+    GStatBuf buf;
+    gboolean exists = !g_stat (path, &buf);
+
+    g_variant_builder_add (uzbl.snapshot->files, "(sxxb)",
+        path,
+        (gint64)(exists ? buf.st_mtime : 0),
+        (gint64)(exists ? buf.st_size : 0),
+        exists);
+}
+
+static void
+record_entry (UzblSnapshotKind kind, const gchar *line, const gchar *path, const gchar *name, GArray *argv);
+static gboolean
+line_is_static (const gchar *line);
+
+void
+uzbl_snapshot_record_command (const gchar *name, const gchar *line, GArray *argv)
+{
+    if (!uzbl_snapshot_is_recording () || uzbl.snapshot->skip) {
+        return;
+    }
+
+    gboolean is_static = line_is_static (line);
+
+    g_free (uzbl.snapshot->static_set);
+    uzbl.snapshot->static_set = NULL;
+
+    /* Include lines are recorded once the file they name is known. */
+    if (!g_strcmp0 (name, "include")) {
+        g_free (uzbl.snapshot->include_line);
+        g_free (uzbl.snapshot->include_arg);
+        uzbl.snapshot->include_line = g_strdup (line);
+        uzbl.snapshot->include_arg = (is_static && argv->len) ?
+            g_strdup (argv_idx (argv, 0)) : NULL;
+        return;
+    }
+
+    if (!is_static) {
+        record_entry (SNAPSHOT_LINE, line, "", NULL, NULL);
+        return;
+    }
+
+    /* The variable keeps a static value unless something else sets it. */
+    if (!g_strcmp0 (name, "set") && argv->len) {
+        gchar **split = g_strsplit (argv_idx (argv, 0), " ", 2);
+
+        if (split[0]) {
+            uzbl.snapshot->static_set = g_strdup (g_strstrip (split[0]));
+        }
+
+        g_strfreev (split);
+    }
+
+    record_entry (SNAPSHOT_PARSED, line, "", name, argv);
+}
+
+void
+uzbl_snapshot_record_include_begin (const gchar *path)
+{
+    if (!uzbl_snapshot_is_recording ()) {
+        return;
+    }
+
+    if (uzbl.snapshot->skip || !uzbl.snapshot->include_line) {
+        ++uzbl.snapshot->skip;
+        return;
+    }
+
+    if (uzbl.snapshot->include_arg) {
+        GArray *argv = uzbl_commands_args_new ();
+
+        uzbl_commands_args_append (argv, g_strdup (uzbl.snapshot->include_arg));
+        record_entry (SNAPSHOT_INCLUDE, uzbl.snapshot->include_line, path, "include", argv);
+
+        uzbl_commands_args_free (argv);
+    } else {
+        record_entry (SNAPSHOT_INCLUDE, uzbl.snapshot->include_line, path, NULL, NULL);
+    }
+
+    g_free (uzbl.snapshot->include_line);
+    g_free (uzbl.snapshot->include_arg);
+    uzbl.snapshot->include_line = NULL;
+    uzbl.snapshot->include_arg = NULL;
+}
+
+void
+uzbl_snapshot_record_include_end ()
+{
+    if (!uzbl_snapshot_is_recording ()) {
+        return;
+    }
+
+    if (uzbl.snapshot->skip) {
+        --uzbl.snapshot->skip;
+        return;
+    }
+
+    record_entry (SNAPSHOT_INCLUDE_END, "", "", NULL, NULL);
+}
+
+void
+uzbl_snapshot_record_include_missing ()
+{
+    if (!uzbl_snapshot_is_recording () || !uzbl.snapshot->include_line) {
+        return;
+    }
+
+    /* The line may resolve to a file when it is replayed. */
+    record_entry (SNAPSHOT_LINE, uzbl.snapshot->include_line, "", NULL, NULL);
+
+    g_free (uzbl.snapshot->include_line);
+    g_free (uzbl.snapshot->include_arg);
+    uzbl.snapshot->include_line = NULL;
+    uzbl.snapshot->include_arg = NULL;
+}
+
+void
+uzbl_snapshot_variable_set (const gchar *name)
+{
+    if (!uzbl_snapshot_is_recording ()) {
+        return;
+    }
+
+    if (!g_strcmp0 (name, uzbl.snapshot->static_set)) {
+        g_hash_table_add (uzbl.snapshot->static_vars, g_strdup (name));
+    } else {
+        g_hash_table_remove (uzbl.snapshot->static_vars, name);
+    }
+}
+
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+void
+record_reset ()
+{
+    uzbl.snapshot->recording = FALSE;
+
+    if (uzbl.snapshot->files) {
+        g_variant_builder_unref (uzbl.snapshot->files);
+        uzbl.snapshot->files = NULL;
+    }
+    if (uzbl.snapshot->commands) {
+        g_variant_builder_unref (uzbl.snapshot->commands);
+        uzbl.snapshot->commands = NULL;
+    }
+    if (uzbl.snapshot->seen_files) {
+        g_hash_table_destroy (uzbl.snapshot->seen_files);
+        uzbl.snapshot->seen_files = NULL;
+    }
+    if (uzbl.snapshot->static_vars) {
+        g_hash_table_destroy (uzbl.snapshot->static_vars);
+        uzbl.snapshot->static_vars = NULL;
+    }
+
+    g_free (uzbl.snapshot->static_set);
+    g_free (uzbl.snapshot->include_line);
+    g_free (uzbl.snapshot->include_arg);
+    uzbl.snapshot->static_set = NULL;
+    uzbl.snapshot->include_line = NULL;
+    uzbl.snapshot->include_arg = NULL;
+    uzbl.snapshot->skip = 0;
+}
+
+void
+record_entry (UzblSnapshotKind kind, const gchar *line, const gchar *path, const gchar *name, GArray *argv)
+{
+    GVariantBuilder args;
+    guint i;
+
+    g_variant_builder_init (&args, G_VARIANT_TYPE ("as"));
+
+    if (name) {
+        g_variant_builder_add (&args, "s", name);
+
+        for (i = 0; i < argv->len; ++i) {
+            g_variant_builder_add (&args, "s", argv_idx (argv, i));
+        }
+    }
+
+    g_variant_builder_add (uzbl.snapshot->commands, "(yssas)",
+        (guchar)kind,
+        line,
+        path,
+        &args);
+}
+
+gboolean
+line_is_static (const gchar *line)
+{
+    static const gchar *name_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.";
+    const gchar *p = line;
+
+    while (*p) {
+        if ((*p == '\\') && p[1]) {
+            p += 2;
+            continue;
+        }
+
+        if (*p++ != '@') {
+            continue;
+        }
+
+        /* Command, JavaScript and shell expansions depend on the instance,
+         * as do variables which were not set by static lines. */
+        gchar *name;
+
+        if (*p == '{') {
+            const gchar *end = strchr (++p, '}');
+
+            if (!end) {
+                return FALSE;
+            }
+
+            name = g_strndup (p, end - p);
+            p = end + 1;
+        } else {
+            gsize len = strspn (p, name_chars);
+
+            name = g_strndup (p, len);
+            p += len;
+        }
+
+        gboolean known = (*name && g_hash_table_contains (uzbl.snapshot->static_vars, name));
+
+        g_free (name);
+
+        if (!known) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+gboolean
+file_is_current (const gchar *path, gint64 mtime, gint64 size, gboolean exists)
+{
+    GStatBuf buf;
+
+    if (g_stat (path, &buf)) {
+        return !exists;
+    }
+
+    return (exists &&
+            ((gint64)buf.st_mtime == mtime) &&
+            ((gint64)buf.st_size == size));
+}
+
+static gboolean
+include_resolves_to (const gchar *line, GVariantIter *args, const gchar *path);
+static void
+run_args (const gchar *line, GVariantIter *args);
+
+void
+replay_commands (GVariantIter *commands, gboolean run)
+{
+    guchar kind;
+    const gchar *line;
+    const gchar *path;
+    GVariantIter *args;
+
+    while (g_variant_iter_next (commands, "(y&s&sas)", &kind, &line, &path, &args)) {
+        switch (kind) {
+        case SNAPSHOT_LINE:
+            if (run) {
+                uzbl_commands_run (line, NULL);
+            }
+            break;
+        case SNAPSHOT_PARSED:
+            if (run) {
+                run_args (line, args);
+            }
+            break;
+        case SNAPSHOT_INCLUDE:
+            if (!run) {
+                replay_commands (commands, FALSE);
+            } else if (include_resolves_to (line, args, path)) {
+                replay_commands (commands, TRUE);
+                uzbl_events_send (FILE_INCLUDED, NULL,
+                    TYPE_STR, path,
+                    NULL);
+            } else {
+                /* The line names another file now; include it normally. */
+                replay_commands (commands, FALSE);
+                uzbl_commands_run (line, NULL);
+            }
+            break;
+        case SNAPSHOT_INCLUDE_END:
+            g_variant_iter_free (args);
+            return;
+        default:
+            break;
+        }
+
+        g_variant_iter_free (args);
+    }
+}
+
+gboolean
+include_resolves_to (const gchar *line, GVariantIter *args, const gchar *path)
+{
+    GArray *argv = uzbl_commands_args_new ();
+    const gchar *command;
+    const gchar *arg;
+    gchar *resolved = NULL;
+
+    /* Only a line which was not stored parsed is expanded again. */
+    if (g_variant_iter_next (args, "&s", &command) &&
+        g_variant_iter_next (args, "&s", &arg)) {
+        resolved = find_existing_file (arg);
+    } else if (uzbl_commands_parse (line, argv) && argv->len) {
+        resolved = find_existing_file (argv_idx (argv, 0));
+    }
+
+    gboolean same = !g_strcmp0 (resolved, path);
+
+    g_free (resolved);
+    uzbl_commands_args_free (argv);
+
+    return same;
+}
+
+void
+run_args (const gchar *line, GVariantIter *args)
+{
+    const gchar *name;
+    const gchar *arg;
+    const UzblCommand *info = NULL;
+
+    if (g_variant_iter_next (args, "&s", &name)) {
+        info = uzbl_commands_lookup (name);
+    }
+
+    if (!info) {
+        uzbl_commands_run (line, NULL);
+        return;
+    }
+
+    GArray *argv = uzbl_commands_args_new ();
+
+    while (g_variant_iter_next (args, "&s", &arg)) {
+        uzbl_commands_args_append (argv, g_strdup (arg));
+    }
+
+    uzbl_commands_run_parsed (info, argv, NULL);
+
+    uzbl_commands_args_free (argv);
+}
@@ -0,0 +1,32 @@
+#ifndef UZBL_SNAPSHOT_H
+#define UZBL_SNAPSHOT_H
+
+#include <glib.h>
+
+gboolean
+uzbl_snapshot_load (const gchar *snapshot_path, const gchar *config_path);
+
+void
+uzbl_snapshot_record_begin ();
+gboolean
+uzbl_snapshot_record_end (const gchar *snapshot_path, const gchar *config_path);
+
+gboolean
+uzbl_snapshot_is_recording ();
+void
+uzbl_snapshot_record_file (const gchar *path);
+void
+uzbl_snapshot_record_command (const gchar *name, const gchar *line, GArray *argv);
+void
+uzbl_snapshot_record_include_begin (const gchar *path);
+void
+uzbl_snapshot_record_include_end ();
+void
+uzbl_snapshot_record_include_missing ();
+
+/* Follows variables so that lines using ones set dynamically are expanded
+ * again when replayed. */
+void
+uzbl_snapshot_variable_set (const gchar *name);
+
+#endif
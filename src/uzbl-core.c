@@ -35,6 +35,7 @@
 #include "gui.h"
 #include "io.h"
 #include "setup.h"
+#include "snapshot.h"
 #include "type.h"
 #include "util.h"
 #include "variables.h"
@@ -68,7 +69,7 @@ static gchar *
 get_xdg_var (gboolean user, XdgDir type);
 
 static void
-read_config_file (const gchar *file);
+read_config_file (const gchar *file, const gchar *snapshot);
 
 /* Set up gtk, gobject, variable defaults and other things that tests and other
  * external applications need to do anyhow. */
@@ -80,6 +81,7 @@ uzbl_init (int *argc, char ***argv)
     gchar *uri = NULL;
     gboolean verbose = FALSE;
     gchar *config_file = NULL;
+    gchar *config_snapshot = NULL;
     gchar **connect_socket_names = NULL;
     gboolean print_events = FALSE;
     gchar *geometry = NULL;
@@ -95,6 +97,8 @@ uzbl_init (int *argc, char ***argv)
             "Name of the current instance (defaults to Xorg window id or random for GtkSocket mode)",        "NAME" },
         { "config",            'c', 0, G_OPTION_ARG_STRING,       &config_file,
             "Path to config file or '-' for stdin",                                                          "FILE" },
+        { "config-snapshot",    0,  0, G_OPTION_ARG_STRING,       &config_snapshot,
+            "Path to a snapshot of the loaded config, reused while the config is unchanged",                "FILE" },
         /* TODO: explain the difference between these two options */
         { "xembed-socket",     's', 0, G_OPTION_ARG_INT,          &uzbl.state.xembed_socket_id,
             "Xembed socket ID, this window should embed itself",                                             "SOCKET" },
@@ -207,8 +211,16 @@ uzbl_init (int *argc, char ***argv)
     uzbl_js_init ();
     uzbl_variables_init ();
     uzbl_commands_init ();
+    uzbl_bookmarks_init ();
+    uzbl_binds_init ();
+    uzbl_cookies_init ();
     uzbl_events_init ();
+    uzbl_history_init ();
     uzbl_requests_init ();
+    uzbl_rules_init ();
+    uzbl_scheme_init ();
+    uzbl_sites_init ();
+    uzbl_snapshot_init ();
 
     /* Initialize the GUI. */
     uzbl_gui_init (cache_dir, data_dir, uzbl.state.web_extensions_directory);
@@ -249,6 +261,8 @@ uzbl_init (int *argc, char ***argv)
         uzbl_variables_set ("print_events", "1");
     }
 
+    uzbl_variables_begin_batch ();
+
     /* Load default config. */
     const gchar * const *default_command = default_config;
     while (default_command && *default_command) {
@@ -256,7 +270,9 @@ uzbl_init (int *argc, char ***argv)
     }
 
     /* Load provided configuration file. */
-    read_config_file (config_file);
+    read_config_file (config_file, config_snapshot);
+
+    uzbl_variables_end_batch ();
 
 #ifdef GDK_WINDOWING_X11
     GdkDisplay *display = gdk_display_get_default ();
@@ -319,7 +335,15 @@ uzbl_free ()
 
     uzbl_inspector_free ();
     uzbl_gui_free ();
+    uzbl_snapshot_free ();
+    uzbl_sites_free ();
+    uzbl_scheme_free ();
+    uzbl_rules_free ();
     uzbl_requests_free ();
+    uzbl_history_free ();
+    uzbl_cookies_free ();
+    uzbl_binds_free ();
+    uzbl_bookmarks_free ();
     uzbl_commands_free ();
     uzbl_variables_free ();
     uzbl_io_free ();
@@ -423,7 +447,7 @@ static gchar *
 find_xdg_file (XdgDir dir, const char* basename);
 
 void
-read_config_file (const gchar *file)
+read_config_file (const gchar *file, const gchar *snapshot)
 {
     gchar *file_free = NULL;
 
@@ -437,7 +461,17 @@ read_config_file (const gchar *file)
 
     /* Load config file, if any. */
     if (file) {
-        uzbl_commands_load_file (file);
+        if (!snapshot || !uzbl_snapshot_load (snapshot, file)) {
+            if (snapshot) {
+                uzbl_snapshot_record_begin ();
+            }
+
+            uzbl_commands_load_file (file);
+
+            if (snapshot) {
+                uzbl_snapshot_record_end (snapshot, file);
+            }
+        }
         g_setenv ("UZBL_CONFIG", file, TRUE);
     } else {
         uzbl_debug ("No configuration file loaded.\n");
@@ -453,6 +487,9 @@ clean_up ()
     if (uzbl.state.jscontext) {
         JSGlobalContextRelease (uzbl.state.jscontext);
     }
+    if (uzbl.state.jscontext_group) {
+        JSContextGroupRelease (uzbl.state.jscontext_group);
+    }
 
     if (uzbl.net.soup_cookie_jar) {
         g_object_unref (uzbl.net.soup_cookie_jar);
@@ -43,6 +43,8 @@ typedef struct {
     gchar          *last_result;
     gboolean        plug_mode;
     JSGlobalContextRef jscontext;
+    /* Shared by all clean contexts so that they do not need a VM each. */
+    JSContextGroupRef jscontext_group;
 
     gboolean        started;
     gboolean        gtk_started;
@@ -60,12 +62,24 @@ typedef struct {
     UzblCookieJar  *soup_cookie_jar;
 } UzblNetwork;
 
+struct _UzblBinds;
+typedef struct _UzblBinds UzblBinds;
+
+struct _UzblBookmarks;
+typedef struct _UzblBookmarks UzblBookmarks;
+
 struct _UzblCommands;
 typedef struct _UzblCommands UzblCommands;
 
+struct _UzblCookies;
+typedef struct _UzblCookies UzblCookies;
+
 struct _UzblGui;
 typedef struct _UzblGui UzblGui;
 
+struct _UzblHistory;
+typedef struct _UzblHistory UzblHistory;
+
 struct _UzblInspector;
 typedef struct _UzblInspector UzblInspector;
 
@@ -75,6 +89,18 @@ typedef struct _UzblIO UzblIO;
 struct _UzblRequests;
 typedef struct _UzblRequests UzblRequests;
 
+struct _UzblRules;
+typedef struct _UzblRules UzblRules;
+
+struct _UzblScheme;
+typedef struct _UzblScheme UzblScheme;
+
+struct _UzblSites;
+typedef struct _UzblSites UzblSites;
+
+struct _UzblSnapshot;
+typedef struct _UzblSnapshot UzblSnapshot;
+
 struct _UzblVariables;
 typedef struct _UzblVariables UzblVariables;
 
@@ -84,11 +110,19 @@ typedef struct {
     UzblState         state;
     UzblNetwork       net;
 
+    UzblBinds        *binds;
+    UzblBookmarks    *bookmarks;
     UzblCommands     *commands;
+    UzblCookies      *cookies;
     UzblGui          *gui_;
+    UzblHistory      *history;
     UzblInspector    *inspector;
     UzblIO           *io;
     UzblRequests     *requests;
+    UzblRules        *rules;
+    UzblScheme       *scheme;
+    UzblSites        *sites;
+    UzblSnapshot     *snapshot;
     UzblVariables    *variables;
 } UzblCore;
 
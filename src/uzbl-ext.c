@@ -3,24 +3,71 @@
 #include <gio/gunixinputstream.h>
 #include <gio/gunixoutputstream.h>
 #include "uzbl-ext.h"
+#include "blocklist.h"
 #include "extio.h"
 #include "util.h"
 
+/* Elements worth a hint in each mode. These match the selectors in
+ * follow.js. */
+#define HINT_SELECTOR_CLICK "a, area, textarea, select, input:not([type=hidden]), button, *[onclick]"
+#define HINT_SELECTOR_URI   "a, area, frame, iframe"
+#define HINT_ATTRIBUTE      "data-uzbl-hint"
+
+/* Focus changes within this many milliseconds are folded together so that
+ * moving between two fields does not report a transition. */
+#define EDITABLE_DEBOUNCE_MS 50
+/* Blocked request counts are reported at most this often. */
+#define BLOCK_STATS_INTERVAL_MS 500
+
 struct _UzblExt {
     GIOStream *stream;
+    ExtIOReader *reader;
+
+    /* Pages in this process by page ID. */
+    GHashTable *pages;
+
+    /* Request blocking rules, shared by all pages. */
+    UzblBlocklist *blocklist;
 };
 
+/* Per-page state, owned by its WebKitWebPage. */
+typedef struct {
+    UzblExt *ext;
+    WebKitWebPage *web_page;
+    guint64 id;
+
+    /* Whether the focused element was editable when last reported. */
+    gboolean editable;
+    guint editable_timeout;
+
+    /* Request blocking counters. */
+    guint requests_checked;
+    guint requests_blocked;
+    guint block_stats_timeout;
+} UzblExtPage;
+
 UzblExt*
 uzbl_ext_new ()
 {
     UzblExt *ext = g_new (UzblExt, 1);
+    ext->pages = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                        NULL, NULL);
+    ext->blocklist = uzbl_blocklist_new ();
     return ext;
 }
 
-void
-read_message_cb (GObject *stream,
-                 GAsyncResult *res,
-                 gpointer user_data);
+static void
+read_message_cb (ExtIOMessageType  messagetype,
+                 guint64           page_id,
+                 GVariant         *message,
+                 const GError     *error,
+                 gpointer          user_data);
+static GVariant *
+collect_hints (WebKitWebPage *web_page, const gchar *mode);
+static void
+update_block_rules (UzblExt *ext, const gchar *command, const gchar *arg);
+static void
+preconnect (WebKitWebPage *web_page, const gchar *origin);
 
 void
 uzbl_ext_init_io (UzblExt *ext, int in, int out)
@@ -30,27 +77,69 @@ uzbl_ext_init_io (UzblExt *ext, int in, int out)
 
     ext->stream = g_simple_io_stream_new (input, output);
 
-    uzbl_extio_read_message_async (input, read_message_cb, ext);
+    ext->reader = uzbl_extio_reader_new (input, read_message_cb, ext);
 }
 
 void
-read_message_cb (GObject *source,
-                 GAsyncResult *res,
-                 gpointer user_data)
-{
-    UzblExt *ext = (UzblExt*) user_data;
-    GInputStream *stream = G_INPUT_STREAM (source);
-    GError *error = NULL;
-    GVariant *message;
-    ExtIOMessageType messagetype;
-
-    if (!(message = uzbl_extio_read_message_finish (stream, res, &messagetype, &error))) {
-        g_warning ("reading message from core: %s", error->message);
-        g_error_free (error);
+read_message_cb (ExtIOMessageType  messagetype,
+                 guint64           page_id,
+                 GVariant         *message,
+                 const GError     *error,
+                 gpointer          user_data)
+{
+    UzblExt *ext = (UzblExt*)user_data;
+
+    if (!message) {
+        g_warning ("reading message from core: %s",
+                   error ? error->message : "end of stream");
         return;
     }
 
+    WebKitWebPage *web_page = NULL;
+
+    if (page_id != EXTIO_NO_PAGE) {
+        web_page = g_hash_table_lookup (ext->pages, &page_id);
+        if (!web_page) {
+            g_debug ("got message for unknown page %" G_GUINT64_FORMAT, page_id);
+            return;
+        }
+    }
+
     switch (messagetype) {
+    case EXT_BLOCK_RULES:
+        {
+            const gchar *command;
+            const gchar *arg;
+
+            g_variant_get (message, "(&s&s)", &command, &arg);
+            update_block_rules (ext, command, arg);
+            break;
+        }
+    case EXT_COLLECT_HINTS:
+        {
+            guint32 serial;
+            const gchar *mode;
+
+            g_variant_get (message, "(u&s)", &serial, &mode);
+
+            GVariant *hints = collect_hints (web_page, mode);
+            GVariant *reply = g_variant_ref_sink (g_variant_new ("(u@a" EXTIO_HINT_FORMAT ")",
+                                                                 serial, hints));
+            uzbl_extio_send_message (g_io_stream_get_output_stream (ext->stream),
+                                     EXT_HINTS, page_id, reply);
+            g_variant_unref (reply);
+            break;
+        }
+    case EXT_PRECONNECT:
+        {
+            const gchar *origin;
+
+            g_variant_get (message, "(&s)", &origin);
+            if (web_page) {
+                preconnect (web_page, origin);
+            }
+            break;
+        }
     default:
         {
             gchar *pmsg = g_variant_print (message, TRUE);
@@ -59,9 +148,6 @@ read_message_cb (GObject *source,
             break;
         }
     }
-    g_variant_unref (message);
-
-    uzbl_extio_read_message_async (stream, read_message_cb, ext);
 }
 
 static void
@@ -70,16 +156,19 @@ web_page_created_callback (WebKitWebExtension *extension,
                            gpointer            user_data);
 
 static void
+page_destroyed (gpointer data);
+static gboolean
+send_request_callback (WebKitWebPage     *web_page,
+                       WebKitURIRequest  *request,
+                       WebKitURIResponse *redirected_response,
+                       gpointer           user_data);
+static void
 document_loaded_callback (WebKitWebPage *web_page,
                           gpointer       user_data);
 static void
-dom_focus_callback (WebKitDOMEventTarget *target,
-                    WebKitDOMEvent       *event,
-                    gpointer              user_data);
-static void
-dom_blur_callback (WebKitDOMEventTarget *target,
-                   WebKitDOMEvent       *event,
-                   gpointer              user_data);
+dom_focus_change_callback (WebKitDOMEventTarget *target,
+                           WebKitDOMEvent       *event,
+                           gpointer              user_data);
 
 
 G_MODULE_EXPORT void
@@ -99,7 +188,7 @@ webkit_web_extension_initialize_with_user_data (WebKitWebExtension *extension,
     uzbl_ext_init_io (ext, in, out);
 
     uzbl_extio_send_new_message (g_io_stream_get_output_stream (ext->stream),
-                                 EXT_HELO, EXTIO_PROTOCOL);
+                                 EXT_HELO, EXTIO_NO_PAGE, EXTIO_PROTOCOL);
 
     if (proto != EXTIO_PROTOCOL) {
         g_warning ("Extension loaded into incompatible version of uzbl (expected %d, was %d)", EXTIO_PROTOCOL, proto);
@@ -118,52 +207,460 @@ web_page_created_callback (WebKitWebExtension *extension,
 {
     UZBL_UNUSED (extension);
     UzblExt *ext = (UzblExt*)user_data;
+    UzblExtPage *page = g_new (UzblExtPage, 1);
 
-    g_debug ("Web page created");
+    page->ext = ext;
+    page->web_page = web_page;
+    page->id = webkit_web_page_get_id (web_page);
+    page->editable = FALSE;
+    page->editable_timeout = 0;
+    page->requests_checked = 0;
+    page->requests_blocked = 0;
+    page->block_stats_timeout = 0;
+
+    g_debug ("Web page %" G_GUINT64_FORMAT " created", page->id);
+
+    g_hash_table_insert (ext->pages, &page->id, web_page);
+    g_object_set_data_full (G_OBJECT (web_page), "uzbl-ext-page",
+                            page, page_destroyed);
 
     g_signal_connect (web_page, "document-loaded",
-                      G_CALLBACK (document_loaded_callback), ext);
+                      G_CALLBACK (document_loaded_callback), page);
+    g_signal_connect (web_page, "send-request",
+                      G_CALLBACK (send_request_callback), page);
+}
+
+void
+page_destroyed (gpointer data)
+{
+    UzblExtPage *page = (UzblExtPage*)data;
+
+    g_debug ("Web page %" G_GUINT64_FORMAT " destroyed", page->id);
+
+    if (page->editable_timeout) {
+        g_source_remove (page->editable_timeout);
+    }
+    if (page->block_stats_timeout) {
+        g_source_remove (page->block_stats_timeout);
+    }
+
+    g_hash_table_remove (page->ext->pages, &page->id);
+    g_free (page);
 }
 
 void
 document_loaded_callback (WebKitWebPage *web_page,
                           gpointer       user_data)
 {
-    UzblExt *ext = (UzblExt*)user_data;
+    UzblExtPage *page = (UzblExtPage*)user_data;
     WebKitDOMDocument *doc = webkit_web_page_get_dom_document (web_page);
 
+    /* A new document starts out with nothing editable focused. */
+    page->editable = FALSE;
+
     webkit_dom_event_target_add_event_listener (WEBKIT_DOM_EVENT_TARGET (doc),
-        "focus", G_CALLBACK (dom_focus_callback), TRUE, ext);
+        "focus", G_CALLBACK (dom_focus_change_callback), TRUE, page);
     webkit_dom_event_target_add_event_listener (WEBKIT_DOM_EVENT_TARGET (doc),
-        "blur",  G_CALLBACK (dom_blur_callback), TRUE, ext);
+        "blur",  G_CALLBACK (dom_focus_change_callback), TRUE, page);
+}
+
+static gboolean
+send_block_stats (gpointer data);
+
+gboolean
+send_request_callback (WebKitWebPage     *web_page,
+                       WebKitURIRequest  *request,
+                       WebKitURIResponse *redirected_response,
+                       gpointer           user_data)
+{
+    UZBL_UNUSED (web_page);
+    UZBL_UNUSED (redirected_response);
+
+    UzblExtPage *page = (UzblExtPage*)user_data;
+    const gchar *uri = webkit_uri_request_get_uri (request);
+
+    ++page->requests_checked;
+
+    if (!uzbl_blocklist_match (page->ext->blocklist, uri)) {
+        return FALSE;
+    }
+
+    g_debug ("Blocked request for %s", uri);
+
+    ++page->requests_blocked;
+    if (!page->block_stats_timeout) {
+        page->block_stats_timeout = g_timeout_add (BLOCK_STATS_INTERVAL_MS, send_block_stats, page);
+    }
+
+    /* Returning TRUE stops the request. */
+    return TRUE;
 }
 
+gboolean
+send_block_stats (gpointer data)
+{
+    UzblExtPage *page = (UzblExtPage*)data;
+
+    page->block_stats_timeout = 0;
+
+    uzbl_extio_send_new_message (g_io_stream_get_output_stream (page->ext->stream),
+                                 EXT_BLOCK_STATS, page->id,
+                                 page->requests_blocked, page->requests_checked);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+check_editable (gpointer data);
+
 void
-dom_focus_callback (WebKitDOMEventTarget *target,
-                    WebKitDOMEvent       *event,
-                    gpointer              user_data)
+dom_focus_change_callback (WebKitDOMEventTarget *target,
+                           WebKitDOMEvent       *event,
+                           gpointer              user_data)
 {
     UZBL_UNUSED (target);
+    UZBL_UNUSED (event);
 
-    UzblExt *ext = (UzblExt*)user_data;
-    WebKitDOMEventTarget *etarget = webkit_dom_event_get_target (event);
-    gchar *name = webkit_dom_node_get_node_name (WEBKIT_DOM_NODE (etarget));
+    UzblExtPage *page = (UzblExtPage*)user_data;
 
-    uzbl_extio_send_new_message (g_io_stream_get_output_stream (ext->stream),
-                                 EXT_FOCUS, name);
+    /* The focused element is looked at once things settle down. */
+    if (page->editable_timeout) {
+        g_source_remove (page->editable_timeout);
+    }
+    page->editable_timeout = g_timeout_add (EDITABLE_DEBOUNCE_MS, check_editable, page);
 }
 
+/* ===================== HELPER IMPLEMENTATIONS ===================== */
+
+typedef struct {
+    GVariantBuilder *builder;
+    const gchar *selector;
+    guint32 next_id;
+} HintCollector;
+
+static void
+collect_document_hints (HintCollector *collector, WebKitDOMDocument *doc);
+
+GVariant *
+collect_hints (WebKitWebPage *web_page, const gchar *mode)
+{
+    HintCollector collector;
+
+    collector.builder = g_variant_builder_new (G_VARIANT_TYPE ("a" EXTIO_HINT_FORMAT));
+    collector.selector = g_strcmp0 (mode, "uri") ? HINT_SELECTOR_CLICK : HINT_SELECTOR_URI;
+    collector.next_id = 0;
+
+    if (web_page) {
+        collect_document_hints (&collector, webkit_web_page_get_dom_document (web_page));
+    }
+
+    GVariant *hints = g_variant_builder_end (collector.builder);
+    g_variant_builder_unref (collector.builder);
+
+    return hints;
+}
+
+static WebKitDOMNodeList *
+query_all (WebKitDOMDocument *doc, const gchar *selector);
+static gboolean
+element_position (WebKitDOMElement *element, WebKitDOMDOMWindow *window, gint *rect);
+static gchar *
+element_href (WebKitDOMElement *element);
+static WebKitDOMDocument *
+frame_document (WebKitDOMElement *element);
+
 void
-dom_blur_callback (WebKitDOMEventTarget *target,
-                   WebKitDOMEvent       *event,
-                   gpointer user_data)
+collect_document_hints (HintCollector *collector, WebKitDOMDocument *doc)
 {
-    UZBL_UNUSED (target);
+    if (!doc) {
+        return;
+    }
 
-    UzblExt *ext = (UzblExt*)user_data;
-    WebKitDOMEventTarget *etarget = webkit_dom_event_get_target (event);
-    gchar *name = webkit_dom_node_get_node_name (WEBKIT_DOM_NODE (etarget));
+    WebKitDOMNodeList *nodes;
+    gulong len;
+    gulong i;
 
-    uzbl_extio_send_new_message (g_io_stream_get_output_stream (ext->stream),
-                                 EXT_BLUR, name);
+    /* Drop ids from an earlier collection so stale elements don't match. */
+    if ((nodes = query_all (doc, "[" HINT_ATTRIBUTE "]"))) {
+        len = webkit_dom_node_list_get_length (nodes);
+        for (i = 0; i < len; ++i) {
+            WebKitDOMNode *node = webkit_dom_node_list_item (nodes, i);
+            webkit_dom_element_remove_attribute (WEBKIT_DOM_ELEMENT (node), HINT_ATTRIBUTE);
+        }
+        g_object_unref (nodes);
+    }
+
+    WebKitDOMDOMWindow *window = webkit_dom_document_get_default_view (doc);
+
+    if (window && (nodes = query_all (doc, collector->selector))) {
+        len = webkit_dom_node_list_get_length (nodes);
+        for (i = 0; i < len; ++i) {
+            WebKitDOMElement *element = WEBKIT_DOM_ELEMENT (webkit_dom_node_list_item (nodes, i));
+            gint rect[4];
+
+            if (!element_position (element, window, rect)) {
+                continue;
+            }
+
+            guint32 id = collector->next_id++;
+            gchar *id_str = g_strdup_printf ("%u", id);
+            gchar *href = element_href (element);
+
+            webkit_dom_element_set_attribute (element, HINT_ATTRIBUTE, id_str, NULL);
+            g_variant_builder_add (collector->builder, EXTIO_HINT_FORMAT,
+                                   id, rect[0], rect[1], rect[2], rect[3],
+                                   href ? href : "");
+
+            g_free (href);
+            g_free (id_str);
+        }
+        g_object_unref (nodes);
+    }
+
+    if (window) {
+        g_object_unref (window);
+    }
+
+    /* Recurse into frames. */
+    if ((nodes = query_all (doc, "frame, iframe"))) {
+        len = webkit_dom_node_list_get_length (nodes);
+        for (i = 0; i < len; ++i) {
+            WebKitDOMNode *node = webkit_dom_node_list_item (nodes, i);
+            collect_document_hints (collector, frame_document (WEBKIT_DOM_ELEMENT (node)));
+        }
+        g_object_unref (nodes);
+    }
+}
+
+WebKitDOMNodeList *
+query_all (WebKitDOMDocument *doc, const gchar *selector)
+{
+    GError *err = NULL;
+    WebKitDOMNodeList *nodes = webkit_dom_document_query_selector_all (doc, selector, &err);
+
+    if (err) {
+        g_debug ("failed to query '%s': %s", selector, err->message);
+        g_error_free (err);
+        return NULL;
+    }
+
+    return nodes;
+}
+
+gboolean
+element_position (WebKitDOMElement *element, WebKitDOMDOMWindow *window, gint *rect)
+{
+    /* Like follow.js, use the offset chain rather than the bounding box so
+     * that hints for wrapped links sit at the start of the link. */
+    gdouble width = webkit_dom_element_get_offset_width (element);
+    gdouble height = webkit_dom_element_get_offset_height (element);
+
+    /* Hidden elements have no layout box. */
+    if ((width <= 0) || (height <= 0)) {
+        return FALSE;
+    }
+
+    gdouble x = 0;
+    gdouble y = 0;
+    WebKitDOMElement *el;
+
+    for (el = element; el; el = webkit_dom_element_get_offset_parent (el)) {
+        x += webkit_dom_element_get_offset_left (el);
+        y += webkit_dom_element_get_offset_top (el);
+    }
+
+    glong view_x = webkit_dom_dom_window_get_page_x_offset (window);
+    glong view_y = webkit_dom_dom_window_get_page_y_offset (window);
+    glong view_width = webkit_dom_dom_window_get_inner_width (window);
+    glong view_height = webkit_dom_dom_window_get_inner_height (window);
+
+    if ((x >= view_x + view_width) || (y >= view_y + view_height) ||
+        (x + width <= view_x) || (y + height <= view_y)) {
+        return FALSE;
+    }
+
+    rect[0] = (gint)x;
+    rect[1] = (gint)y;
+    rect[2] = (gint)width;
+    rect[3] = (gint)height;
+
+    return TRUE;
+}
+
+gchar *
+element_href (WebKitDOMElement *element)
+{
+    if (WEBKIT_DOM_IS_HTML_ANCHOR_ELEMENT (element)) {
+        return webkit_dom_html_anchor_element_get_href (WEBKIT_DOM_HTML_ANCHOR_ELEMENT (element));
+    }
+    if (WEBKIT_DOM_IS_HTML_AREA_ELEMENT (element)) {
+        return webkit_dom_html_area_element_get_href (WEBKIT_DOM_HTML_AREA_ELEMENT (element));
+    }
+    if (WEBKIT_DOM_IS_HTML_IFRAME_ELEMENT (element)) {
+        return webkit_dom_html_iframe_element_get_src (WEBKIT_DOM_HTML_IFRAME_ELEMENT (element));
+    }
+    if (WEBKIT_DOM_IS_HTML_FRAME_ELEMENT (element)) {
+        return webkit_dom_html_frame_element_get_src (WEBKIT_DOM_HTML_FRAME_ELEMENT (element));
+    }
+
+    return NULL;
+}
+
+WebKitDOMDocument *
+frame_document (WebKitDOMElement *element)
+{
+    if (WEBKIT_DOM_IS_HTML_IFRAME_ELEMENT (element)) {
+        return webkit_dom_html_iframe_element_get_content_document (WEBKIT_DOM_HTML_IFRAME_ELEMENT (element));
+    }
+    if (WEBKIT_DOM_IS_HTML_FRAME_ELEMENT (element)) {
+        return webkit_dom_html_frame_element_get_content_document (WEBKIT_DOM_HTML_FRAME_ELEMENT (element));
+    }
+
+    return NULL;
+}
+
+static WebKitDOMElement *
+focused_element (WebKitDOMDocument *doc);
+static gboolean
+element_is_editable (WebKitDOMElement *element);
+
+gboolean
+check_editable (gpointer data)
+{
+    UzblExtPage *page = (UzblExtPage*)data;
+
+    page->editable_timeout = 0;
+
+    WebKitDOMDocument *doc = webkit_web_page_get_dom_document (page->web_page);
+    WebKitDOMElement *element = focused_element (doc);
+    gboolean editable = (element && element_is_editable (element));
+
+    if (editable != page->editable) {
+        gchar *name = element ? webkit_dom_element_get_tag_name (element) : NULL;
+
+        page->editable = editable;
+        uzbl_extio_send_new_message (g_io_stream_get_output_stream (page->ext->stream),
+                                     EXT_EDITABLE, page->id, editable, name ? name : "");
+
+        g_free (name);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+WebKitDOMElement *
+focused_element (WebKitDOMDocument *doc)
+{
+    WebKitDOMElement *element = doc ? webkit_dom_document_get_active_element (doc) : NULL;
+
+    /* Focus inside a frame shows up as the frame element in the parent. */
+    while (element) {
+        WebKitDOMDocument *frame_doc = frame_document (element);
+        WebKitDOMElement *frame_element;
+
+        if (!frame_doc || !(frame_element = webkit_dom_document_get_active_element (frame_doc))) {
+            break;
+        }
+
+        element = frame_element;
+    }
+
+    return element;
+}
+
+/* Input types which take text. This matches the list in follow.js. */
+static const gchar *
+text_input_types[] = {
+    "color", "date", "datetime", "datetime-local", "email", "month", "number",
+    "password", "range", "search", "text", "time", "url", "week",
+    NULL
+};
+
+gboolean
+element_is_editable (WebKitDOMElement *element)
+{
+    if (WEBKIT_DOM_IS_HTML_TEXT_AREA_ELEMENT (element) ||
+        WEBKIT_DOM_IS_HTML_SELECT_ELEMENT (element)) {
+        return TRUE;
+    }
+
+    if (WEBKIT_DOM_IS_HTML_INPUT_ELEMENT (element)) {
+        gchar *type = webkit_dom_html_input_element_get_input_type (WEBKIT_DOM_HTML_INPUT_ELEMENT (element));
+        gboolean text = (!type || !*type);
+        const gchar **text_type;
+
+        for (text_type = text_input_types; !text && *text_type; ++text_type) {
+            text = !g_strcmp0 (type, *text_type);
+        }
+
+        g_free (type);
+        return text;
+    }
+
+    return (WEBKIT_DOM_IS_HTML_ELEMENT (element) &&
+            webkit_dom_html_element_get_is_content_editable (WEBKIT_DOM_HTML_ELEMENT (element)));
+}
+
+void
+update_block_rules (UzblExt *ext, const gchar *command, const gchar *arg)
+{
+    if (!g_strcmp0 (command, "load")) {
+        GError *err = NULL;
+        guint before = uzbl_blocklist_size (ext->blocklist);
+
+        if (!uzbl_blocklist_load_file (ext->blocklist, arg, &err)) {
+            g_warning ("failed to load block rules: %s", err->message);
+            g_error_free (err);
+            return;
+        }
+
+        g_debug ("Loaded %u block rules from %s",
+                 uzbl_blocklist_size (ext->blocklist) - before, arg);
+    } else if (!g_strcmp0 (command, "add")) {
+        uzbl_blocklist_add_rule (ext->blocklist, arg);
+    } else if (!g_strcmp0 (command, "clear")) {
+        uzbl_blocklist_clear (ext->blocklist);
+    } else {
+        g_debug ("unrecognised block rule command %s", command);
+    }
+}
+
+void
+preconnect (WebKitWebPage *web_page, const gchar *origin)
+{
+    WebKitDOMDocument *doc = webkit_web_page_get_dom_document (web_page);
+    WebKitDOMHTMLHeadElement *head = doc ? webkit_dom_document_get_head (doc) : NULL;
+
+    if (!head) {
+        return;
+    }
+
+    /* Origins already connected to from this document. It goes away with
+     * the document, as do the connections. */
+    GHashTable *connected = g_object_get_data (G_OBJECT (doc), "uzbl-preconnected");
+
+    if (!connected) {
+        connected = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        g_object_set_data_full (G_OBJECT (doc), "uzbl-preconnected",
+                                connected, (GDestroyNotify)g_hash_table_destroy);
+    }
+
+    if (g_hash_table_contains (connected, origin)) {
+        return;
+    }
+
+    WebKitDOMElement *link = webkit_dom_document_create_element (doc, "link", NULL);
+
+    if (!link) {
+        return;
+    }
+
+    g_hash_table_add (connected, g_strdup (origin));
+
+    /* WebKit opens the connection as soon as the hint is inserted, so it
+     * doesn't need to stay in the page. */
+    webkit_dom_element_set_attribute (link, "rel", "preconnect", NULL);
+    webkit_dom_element_set_attribute (link, "href", origin, NULL);
+    webkit_dom_node_append_child (WEBKIT_DOM_NODE (head), WEBKIT_DOM_NODE (link), NULL);
+    webkit_dom_node_remove_child (WEBKIT_DOM_NODE (head), WEBKIT_DOM_NODE (link), NULL);
 }
@@ -1,10 +1,15 @@
 #include "variables.h"
 
+#include "binds.h"
 #include "commands.h"
+#include "cookies.h"
 #include "events.h"
 #include "gui.h"
+#include "history.h"
 #include "io.h"
 #include "js.h"
+#include "scheme.h"
+#include "snapshot.h"
 #include "sync.h"
 #include "type.h"
 #include "util.h"
@@ -12,11 +17,13 @@
 #include "uzbl-core.h"
 
 #include <JavaScriptCore/JavaScript.h>
+#include <glib/gstdio.h>
 
 #include <assert.h>
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 /* TODO: (WebKit2)
  *
@@ -62,6 +69,12 @@ struct _UzblVariables {
 
     /* All builtin variable storage is in here. */
     UzblVariablesPrivate *priv;
+
+    /* Batch state. */
+    guint batch_depth;
+    GPtrArray *batch_pending;
+    GHashTable *batch_seen;
+    GObject *batch_settings;
 };
 
 /* =========================== PUBLIC API =========================== */
@@ -85,12 +98,23 @@ uzbl_variables_init ()
 
     uzbl.variables->priv = uzbl_variables_private_new (uzbl.variables->table);
 
+    uzbl.variables->batch_depth = 0;
+    uzbl.variables->batch_pending = g_ptr_array_new_with_free_func (g_free);
+    uzbl.variables->batch_seen = g_hash_table_new (g_str_hash, g_str_equal);
+    uzbl.variables->batch_settings = NULL;
+
     init_js_variables_api ();
 }
 
 void
 uzbl_variables_free ()
 {
+    g_hash_table_destroy (uzbl.variables->batch_seen);
+    g_ptr_array_free (uzbl.variables->batch_pending, TRUE);
+    if (uzbl.variables->batch_settings) {
+        g_object_unref (uzbl.variables->batch_settings);
+    }
+
     g_hash_table_destroy (uzbl.variables->table);
 
     uzbl_variables_private_free (uzbl.variables->priv);
@@ -199,6 +223,9 @@ uzbl_variables_set (const gchar *name, gchar *val)
         send_variable_event (name, var);
     }
 
+    uzbl_binds_variable_set (name);
+    uzbl_snapshot_variable_set (name);
+
     return TRUE;
 }
 
@@ -364,6 +391,64 @@ uzbl_variables_toggle (const gchar *name, GArray *values)
     return sendev;
 }
 
+void
+uzbl_variables_begin_batch ()
+{
+    ++uzbl.variables->batch_depth;
+}
+
+static void
+emit_variable_event (const gchar *name, const UzblVariable *var);
+
+gboolean
+uzbl_variables_end_batch ()
+{
+    if (!uzbl.variables->batch_depth) {
+        uzbl_debug ("end_batch called without a matching begin_batch\n");
+        return FALSE;
+    }
+
+    if (--uzbl.variables->batch_depth) {
+        return TRUE;
+    }
+
+    /* Hand all deferred WebKit settings changes over in one go. */
+    if (uzbl.variables->batch_settings) {
+        GObject *settings = uzbl.variables->batch_settings;
+        uzbl.variables->batch_settings = NULL;
+
+        if (uzbl.gui.web_view) {
+            webkit_web_view_set_settings (uzbl.gui.web_view, WEBKIT_SETTINGS (settings));
+        }
+
+        g_object_unref (settings);
+    }
+
+    GPtrArray *pending = uzbl.variables->batch_pending;
+    gboolean changed = (pending->len > 0);
+
+    uzbl.variables->batch_pending = g_ptr_array_new_with_free_func (g_free);
+    g_hash_table_remove_all (uzbl.variables->batch_seen);
+
+    guint i;
+    for (i = 0; i < pending->len; ++i) {
+        const gchar *name = g_ptr_array_index (pending, i);
+        UzblVariable *var = get_variable (name);
+
+        if (var) {
+            emit_variable_event (name, var);
+        }
+    }
+
+    g_ptr_array_free (pending, TRUE);
+
+    if (changed) {
+        uzbl_gui_update_title ();
+    }
+
+    return TRUE;
+}
+
 typedef enum {
     EXPAND_INITIAL,
     EXPAND_IGNORE_SHELL,
@@ -379,6 +464,11 @@ struct _ExpandContext {
     GString         *buf;
     GArray          *argv;
     GTask           *task;
+
+    /* The contents of the expansion being run asynchronously. */
+    gchar           *pending;
+    const gchar     *js_ctx;
+    const gchar     *js_source;
 };
 typedef struct _ExpandContext ExpandContext;
 
@@ -388,12 +478,19 @@ expand_context_free (ExpandContext *ctx)
     if (ctx->buf) {
         g_string_free (ctx->buf, TRUE);
     }
+    g_free (ctx->pending);
     g_free (ctx);
 }
 
 static gchar *
 expand_impl (const gchar *str, UzblExpandStage stage);
 
+static void
+expand_impl_async (const gchar         *str,
+                   UzblExpandStage      stage,
+                   GAsyncReadyCallback  callback,
+                   gpointer             data);
+
 static void
 expand_process (ExpandContext *ctx);
 
@@ -408,20 +505,7 @@ uzbl_variables_expand_async (const gchar         *str,
                              GAsyncReadyCallback  callback,
                              gpointer             data)
 {
-    GTask *task = g_task_new (NULL, NULL, callback, data);
-    if (!str) {
-        g_task_return_pointer (task, g_strdup (""), g_free);
-        g_object_unref (task);
-        return;
-    }
-
-    ExpandContext *ctx = g_new (ExpandContext, 1);
-    ctx->stage = EXPAND_INITIAL;
-    ctx->p = str;
-    ctx->task = task;
-    ctx->buf = g_string_new ("");
-    g_task_set_task_data (task, ctx, (GDestroyNotify) expand_context_free);
-    expand_process (ctx);
+    expand_impl_async (str, EXPAND_INITIAL, callback, data);
 }
 
 gchar*
@@ -572,6 +656,26 @@ variable_expand (const UzblVariable *var, GString *buf);
 
 void
 send_variable_event (const gchar *name, const UzblVariable *var)
+{
+    if (uzbl.variables->batch_depth) {
+        /* Only the final value of a variable matters once the batch ends. */
+        if (!g_hash_table_contains (uzbl.variables->batch_seen, name)) {
+            gchar *pending_name = g_strdup (name);
+
+            g_ptr_array_add (uzbl.variables->batch_pending, pending_name);
+            g_hash_table_add (uzbl.variables->batch_seen, pending_name);
+        }
+
+        return;
+    }
+
+    emit_variable_event (name, var);
+
+    uzbl_gui_update_title ();
+}
+
+void
+emit_variable_event (const gchar *name, const UzblVariable *var)
 {
     GString *str = g_string_new ("");
 
@@ -604,8 +708,6 @@ send_variable_event (const gchar *name, const UzblVariable *var)
         NULL);
 
     g_string_free (str, TRUE);
-
-    uzbl_gui_update_title ();
 }
 
 gchar *
@@ -670,7 +772,7 @@ expand_impl (const gchar *str, UzblExpandStage stage)
         return g_strdup ("");
     }
 
-    ExpandContext *ctx = g_new (ExpandContext, 1);
+    ExpandContext *ctx = g_new0 (ExpandContext, 1);
     ctx->stage = stage;
     ctx->p = str;
     ctx->task = NULL;
@@ -681,10 +783,40 @@ expand_impl (const gchar *str, UzblExpandStage stage)
     return g_string_free (buf, FALSE);
 }
 
+void
+expand_impl_async (const gchar         *str,
+                   UzblExpandStage      stage,
+                   GAsyncReadyCallback  callback,
+                   gpointer             data)
+{
+    GTask *task = g_task_new (NULL, NULL, callback, data);
+    if (!str) {
+        g_task_return_pointer (task, g_strdup (""), g_free);
+        g_object_unref (task);
+        return;
+    }
+
+    ExpandContext *ctx = g_new0 (ExpandContext, 1);
+    ctx->stage = stage;
+    ctx->p = str;
+    ctx->task = task;
+    ctx->buf = g_string_new ("");
+    g_task_set_task_data (task, ctx, (GDestroyNotify) expand_context_free);
+    expand_process (ctx);
+}
+
 static void
 expand_run_command_cb (GObject      *source,
                        GAsyncResult *res,
                        gpointer      data);
+static void
+expand_uzbl_cb (GObject      *source,
+                GAsyncResult *res,
+                gpointer      data);
+static void
+expand_js_cb (GObject      *source,
+              GAsyncResult *res,
+              gpointer      data);
 
 void expand_process (ExpandContext *ctx)
 {
@@ -814,6 +946,14 @@ void expand_process (ExpandContext *ctx)
                     break;
                 }
 
+                if (ctx->task && (*ret != '+')) {
+                    /* Commands may be tasks, which only run asynchronously. */
+                    ctx->pending = ret;
+                    ctx->p = vend + 2;
+                    expand_impl_async (ctx->pending, EXPAND_IGNORE_UZBL, expand_uzbl_cb, ctx);
+                    return;
+                }
+
                 GString *uzbl_ret = g_string_new ("");
 
                 GArray *tmp = uzbl_commands_args_new ();
@@ -865,28 +1005,23 @@ void expand_process (ExpandContext *ctx)
                    break;
                 }
 
-                ctx->argv = uzbl_commands_args_new ();
-                uzbl_commands_args_append (ctx->argv, g_strdup (js_ctx));
-                const gchar *source = NULL;
-                gchar *cmd = ret;
+                const gchar *cmd = ret;
 
+                ctx->js_ctx = js_ctx;
                 if (*ret == '+') {
                     /* Read JS from file. */
-                    source = "file";
+                    ctx->js_source = "file";
                     ++cmd;
                 } else {
                     /* JS from string. */
-                    source = "string";
+                    ctx->js_source = "string";
                 }
 
-                uzbl_commands_args_append (ctx->argv, g_strdup (source));
-
-                gchar *exp_cmd = expand_impl (cmd, ignore);
-                g_array_append_val (ctx->argv, exp_cmd);
-
-                const UzblCommand *info = uzbl_commands_lookup ("js");
-                uzbl_commands_run_async (info, ctx->argv, TRUE, expand_run_command_cb, ctx);
+                /* The script may itself contain commands to expand which
+                 * are tasks. */
+                ctx->pending = ret;
                 ctx->p = vend + 2;
+                expand_impl_async (cmd, ignore, expand_js_cb, ctx);
                 return;
             }
             case EXPAND_ESCAPE:
@@ -937,8 +1072,16 @@ expand_run_command_cb (GObject      *source,
     GError *err = NULL;
     GString *ret = uzbl_commands_run_finish (source, res, &err);
     uzbl_commands_args_free (ctx->argv);
+    ctx->argv = NULL;
+    g_free (ctx->pending);
+    ctx->pending = NULL;
 
-    if (ret->str) {
+    if (err) {
+        uzbl_debug ("Failed to expand: %s\n", err->message);
+        g_error_free (err);
+    }
+
+    if (ret) {
         g_string_append (ctx->buf, ret->str);
         g_string_free (ret, TRUE);
     }
@@ -946,6 +1089,38 @@ expand_run_command_cb (GObject      *source,
     expand_process (ctx);
 }
 
+void
+expand_uzbl_cb (GObject      *source,
+                GAsyncResult *res,
+                gpointer      data)
+{
+    ExpandContext *ctx = (ExpandContext*) data;
+    gchar *cmd = uzbl_variables_expand_finish (source, res, NULL);
+
+    /* The command string must outlive its own expansion. */
+    g_free (ctx->pending);
+    ctx->pending = cmd;
+
+    uzbl_commands_run_string_async (ctx->pending, TRUE, expand_run_command_cb, ctx);
+}
+
+void
+expand_js_cb (GObject      *source,
+              GAsyncResult *res,
+              gpointer      data)
+{
+    ExpandContext *ctx = (ExpandContext*) data;
+    gchar *script = uzbl_variables_expand_finish (source, res, NULL);
+
+    ctx->argv = uzbl_commands_args_new ();
+    uzbl_commands_args_append (ctx->argv, g_strdup (ctx->js_ctx));
+    uzbl_commands_args_append (ctx->argv, g_strdup (ctx->js_source));
+    g_array_append_val (ctx->argv, script);
+
+    const UzblCommand *info = uzbl_commands_lookup ("js");
+    uzbl_commands_run_async (info, ctx->argv, TRUE, expand_run_command_cb, ctx);
+}
+
 void
 dump_variable (gpointer key, gpointer value, gpointer data)
 {
@@ -1209,14 +1384,22 @@ DECLARE_GETSET (gchar *, cache_model);
 DECLARE_GETSET (int, enable_private);
 DECLARE_GETSET (int, enable_hyperlink_auditing);
 DECLARE_GETSET (int, enable_xss_auditing);
-/*DECLARE_GETSET (gchar *, cookie_location);*/
-/*DECLARE_GETSET (gchar *, cookie_store);*/
+DECLARE_SETTER (gchar *, cookie_location);
+DECLARE_SETTER (gchar *, cookie_store);
 DECLARE_GETSET (gchar *, cookie_policy);
 DECLARE_GETSET (int, enable_dns_prefetch);
 #if WEBKIT_CHECK_VERSION (2, 9, 1)
 DECLARE_GETSET (int, allow_file_to_file_access);
 #endif
 
+/* Scheme variables */
+DECLARE_SETTER (int, scheme_cache_size);
+DECLARE_SETTER (int, scheme_cache_ttl);
+
+/* History variables */
+DECLARE_SETTER (gchar *, history_file);
+DECLARE_SETTER (int, history_flush_interval);
+
 /* Page variables */
 DECLARE_GETSET (gchar *, useragent);
 DECLARE_SETTER (gchar *, accept_languages);
@@ -1354,10 +1537,33 @@ struct _UzblVariablesPrivate {
 
     /* Security variables */
     gboolean permissive;
+    gchar *cookie_location;
+    gchar *cookie_store;
+    gchar *private_cookie_location;
+
+    /* Network variables */
+    gboolean prefetch_on_hover;
+    gboolean preconnect_on_hover;
+    int prefetch_budget;
+    int prefetch_window;
+
+    /* Scheme variables */
+    int scheme_cache_size;
+    int scheme_cache_ttl;
+
+    /* Bookmark variables */
+    gchar *bookmarks_file;
+
+    /* History variables */
+    gchar *history_file;
+    int history_flush_interval;
+    gboolean history_fsync;
 
     /* Page variables */
     gboolean forward_keys;
+    gboolean core_binds;
     gchar *accept_languages;
+    gchar *site_settings;
     gdouble zoom_step;
 
     /* HTML5 Database variables */
@@ -1409,6 +1615,10 @@ uzbl_variables_private_new (GHashTable *table)
         /* Network variables */
         { "ssl_policy",                   UZBL_V_FUNC (ssl_policy,                             STR)},
         { "cache_model",                  UZBL_V_FUNC (cache_model,                            STR)},
+        { "prefetch_on_hover",            UZBL_V_INT (priv->prefetch_on_hover,                 NULL)},
+        { "preconnect_on_hover",          UZBL_V_INT (priv->preconnect_on_hover,               NULL)},
+        { "prefetch_budget",              UZBL_V_INT (priv->prefetch_budget,                   NULL)},
+        { "prefetch_window",              UZBL_V_INT (priv->prefetch_window,                   NULL)},
 
         /* Security variables */
         { "enable_private",               UZBL_V_FUNC (enable_private,                         INT)},
@@ -1416,15 +1626,31 @@ uzbl_variables_private_new (GHashTable *table)
         { "enable_hyperlink_auditing",    UZBL_V_FUNC (enable_hyperlink_auditing,              INT)},
         { "enable_xss_auditing",          UZBL_V_FUNC (enable_xss_auditing,                    INT)},
         { "cookie_policy",                UZBL_V_FUNC (cookie_policy,                          STR)},
+        { "cookie_location",              UZBL_V_STRING (priv->cookie_location,                set_cookie_location)},
+        { "cookie_store",                 UZBL_V_STRING (priv->cookie_store,                   set_cookie_store)},
         { "enable_dns_prefetch",          UZBL_V_FUNC (enable_dns_prefetch,                    INT)},
 #if WEBKIT_CHECK_VERSION (2, 9, 1)
         { "allow_file_to_file_access",    UZBL_V_FUNC (allow_file_to_file_access,              INT)},
 #endif
 
+        /* Scheme variables */
+        { "scheme_cache_size",            UZBL_V_INT (priv->scheme_cache_size,                 set_scheme_cache_size)},
+        { "scheme_cache_ttl",             UZBL_V_INT (priv->scheme_cache_ttl,                  set_scheme_cache_ttl)},
+
+        /* Bookmark variables */
+        { "bookmarks_file",               UZBL_V_STRING (priv->bookmarks_file,                 NULL)},
+
+        /* History variables */
+        { "history_file",                 UZBL_V_STRING (priv->history_file,                   set_history_file)},
+        { "history_flush_interval",       UZBL_V_INT (priv->history_flush_interval,            set_history_flush_interval)},
+        { "history_fsync",                UZBL_V_INT (priv->history_fsync,                     NULL)},
+
         /* Page variables */
         { "forward_keys",                 UZBL_V_INT (priv->forward_keys,                      NULL)},
+        { "core_binds",                   UZBL_V_INT (priv->core_binds,                        NULL)},
         { "useragent",                    UZBL_V_FUNC (useragent,                              STR)},
         { "accept_languages",             UZBL_V_STRING (priv->accept_languages,               set_accept_languages)},
+        { "site_settings",                UZBL_V_STRING (priv->site_settings,                  NULL)},
         { "zoom_level",                   UZBL_V_FUNC (zoom_level,                             DOUBLE)},
         { "zoom_step",                    UZBL_V_DOUBLE (priv->zoom_step,                      set_zoom_step)},
         { "zoom_text_only",               UZBL_V_FUNC (zoom_text_only,                         INT)},
@@ -1545,6 +1771,13 @@ uzbl_variables_private_new (GHashTable *table)
         { NULL,                           UZBL_SETTING (INT, { .i = NULL }, 0, NULL, NULL)}
     };
 
+    priv->cookie_store = g_strdup ("sqlite");
+    priv->prefetch_budget = 32;
+    priv->prefetch_window = 60;
+    priv->scheme_cache_ttl = 300;
+    priv->history_flush_interval = 5;
+    priv->core_binds = TRUE;
+
     const UzblVariableEntry *entry = builtin_variable_table;
     while (entry->name) {
         UzblVariable *value = g_malloc (sizeof (UzblVariable));
@@ -1569,6 +1802,11 @@ uzbl_variables_private_free (UzblVariablesPrivate *priv)
     }
 #endif
 
+    if (priv->private_cookie_location) {
+        g_unlink (priv->private_cookie_location);
+        g_free (priv->private_cookie_location);
+    }
+
     /* All other members are deleted by the table's free function. */
     g_free (priv);
 }
@@ -1950,6 +2188,9 @@ CHOICE_GETSET (WebKitCacheModel, cache_model,
 /* Security variables */
 DECLARE_GETSET (int, enable_private_webkit);
 
+static void
+update_cookie_storage ();
+
 IMPLEMENT_GETTER (int, enable_private)
 {
     return get_enable_private_webkit ();
@@ -1965,14 +2206,15 @@ IMPLEMENT_SETTER (int, enable_private)
         g_unsetenv (priv_envvar);
     }
 
-    if (get_enable_private_webkit () != enable_private) {
-        WebKitWebContext *context = webkit_web_view_get_context (uzbl.gui.web_view);
-        WebKitCookieManager *manager = webkit_web_context_get_cookie_manager (context);
-        webkit_cookie_manager_delete_all_cookies (manager);
-    }
+    gboolean changed = (get_enable_private_webkit () != enable_private);
 
     set_enable_private_webkit (enable_private);
 
+    /* Swap stores rather than clearing cookies which may be shared. */
+    if (changed) {
+        update_cookie_storage ();
+    }
+
     return TRUE;
 }
 
@@ -2005,6 +2247,30 @@ CHOICE_GETSET (WebKitCookieAcceptPolicy, cookie_policy,
 
 #undef cookie_policy_choices
 
+IMPLEMENT_SETTER (gchar *, cookie_location)
+{
+    g_free (uzbl.variables->priv->cookie_location);
+    uzbl.variables->priv->cookie_location = g_strdup (cookie_location);
+
+    update_cookie_storage ();
+
+    return TRUE;
+}
+
+IMPLEMENT_SETTER (gchar *, cookie_store)
+{
+    if (g_strcmp0 (cookie_store, "text") && g_strcmp0 (cookie_store, "sqlite")) {
+        return FALSE;
+    }
+
+    g_free (uzbl.variables->priv->cookie_store);
+    uzbl.variables->priv->cookie_store = g_strdup (cookie_store);
+
+    update_cookie_storage ();
+
+    return TRUE;
+}
+
 GOBJECT_GETSET2 (int, enable_dns_prefetch,
                  gboolean, webkit_settings (), "enable-dns-prefetching")
 
@@ -2013,6 +2279,56 @@ GOBJECT_GETSET2 (int, allow_file_to_file_access,
                  gboolean, webkit_settings (), "allow-file-access-from-file-urls");
 #endif
 
+/* Scheme variables */
+IMPLEMENT_SETTER (int, scheme_cache_size)
+{
+    if (scheme_cache_size < 0) {
+        return FALSE;
+    }
+
+    uzbl.variables->priv->scheme_cache_size = scheme_cache_size;
+
+    uzbl_scheme_trim_cache ();
+
+    return TRUE;
+}
+
+IMPLEMENT_SETTER (int, scheme_cache_ttl)
+{
+    if (scheme_cache_ttl < 0) {
+        return FALSE;
+    }
+
+    uzbl.variables->priv->scheme_cache_ttl = scheme_cache_ttl;
+
+    return TRUE;
+}
+
+/* History variables */
+IMPLEMENT_SETTER (gchar *, history_file)
+{
+    /* Buffered records belong to the old file. */
+    if (uzbl.history) {
+        uzbl_history_flush ();
+    }
+
+    g_free (uzbl.variables->priv->history_file);
+    uzbl.variables->priv->history_file = g_strdup (history_file);
+
+    return TRUE;
+}
+
+IMPLEMENT_SETTER (int, history_flush_interval)
+{
+    if (history_flush_interval < 0) {
+        return FALSE;
+    }
+
+    uzbl.variables->priv->history_flush_interval = history_flush_interval;
+
+    return TRUE;
+}
+
 /* Page variables */
 IMPLEMENT_GETTER (gchar *, useragent)
 {
@@ -2604,10 +2920,25 @@ webkit_data_manager ()
 }
 #endif
 
+static GObject *
+copy_webkit_settings (GObject *settings);
+
 GObject *
 webkit_settings ()
 {
-    return G_OBJECT (webkit_web_view_get_settings (uzbl.gui.web_view));
+    GObject *settings = G_OBJECT (webkit_web_view_get_settings (uzbl.gui.web_view));
+
+    if (!uzbl.variables->batch_depth) {
+        return settings;
+    }
+
+    /* Collect changes on a private copy which is applied when the batch
+     * ends. */
+    if (!uzbl.variables->batch_settings) {
+        uzbl.variables->batch_settings = copy_webkit_settings (settings);
+    }
+
+    return uzbl.variables->batch_settings;
 }
 
 GObject *
@@ -2616,6 +2947,37 @@ webkit_view ()
     return G_OBJECT (uzbl.gui.web_view);
 }
 
+GObject *
+copy_webkit_settings (GObject *settings)
+{
+    GObject *copy = G_OBJECT (webkit_settings_new ());
+    guint n_props = 0;
+    GParamSpec **props = g_object_class_list_properties (G_OBJECT_GET_CLASS (settings), &n_props);
+
+    g_object_freeze_notify (copy);
+
+    guint i;
+    for (i = 0; i < n_props; ++i) {
+        GParamSpec *spec = props[i];
+        GValue value = G_VALUE_INIT;
+
+        if (((spec->flags & G_PARAM_READWRITE) != G_PARAM_READWRITE) ||
+            (spec->flags & G_PARAM_CONSTRUCT_ONLY)) {
+            continue;
+        }
+
+        g_value_init (&value, spec->value_type);
+        g_object_get_property (settings, spec->name, &value);
+        g_object_set_property (copy, spec->name, &value);
+        g_value_unset (&value);
+    }
+
+    g_object_thaw_notify (copy);
+    g_free (props);
+
+    return copy;
+}
+
 
 WebKitCookieAcceptPolicy
 cookie_policy ()
@@ -2639,3 +3001,64 @@ cookie_policy ()
 
     return policy;
 }
+
+void
+update_cookie_storage ()
+{
+    UzblVariablesPrivate *priv = uzbl.variables->priv;
+    const gchar *location = priv->cookie_location;
+    gchar *old_private = priv->private_cookie_location;
+
+    if (!uzbl.gui.web_view) {
+        return;
+    }
+
+    WebKitCookiePersistentStorage storage = WEBKIT_COOKIE_PERSISTENT_STORAGE_SQLITE;
+
+    gboolean has_location = (location && *location);
+    gboolean is_private = get_enable_private_webkit ();
+
+    if (!has_location && !is_private && !old_private) {
+        return;
+    }
+
+    /* The configured store is picked up again when leaving private mode. */
+    if (is_private && old_private) {
+        return;
+    }
+
+    priv->private_cookie_location = NULL;
+    if (is_private || !has_location) {
+        /* Private cookies go to a throwaway store so that the configured one
+         * is left untouched. WebKit cannot go back to keeping cookies in
+         * memory, so a fresh one is also used when leaving private mode
+         * without a configured store. */
+        static guint serial = 0;
+        gchar *name = g_strdup_printf ("uzbl-cookies-%d-%u.sqlite", getpid (), serial++);
+        priv->private_cookie_location = g_build_filename (g_get_user_runtime_dir (), name, NULL);
+        g_free (name);
+
+        location = priv->private_cookie_location;
+        g_unlink (location);
+    } else if (!g_strcmp0 (priv->cookie_store, "text")) {
+        storage = WEBKIT_COOKIE_PERSISTENT_STORAGE_TEXT;
+    }
+
+    gchar *dir = g_path_get_dirname (location);
+    g_mkdir_with_parents (dir, 0700);
+    g_free (dir);
+
+    /* Instances using the same location share the stored cookies across
+     * restarts; running instances do not see each other's changes. */
+    WebKitWebContext *context = webkit_web_view_get_context (uzbl.gui.web_view);
+    WebKitCookieManager *manager = webkit_web_context_get_cookie_manager (context);
+    webkit_cookie_manager_set_persistent_storage (manager, location, storage);
+
+    if (old_private) {
+        g_unlink (old_private);
+        g_free (old_private);
+    }
+
+    /* The stored cookies were not changed by anyone. */
+    uzbl_cookies_reset ();
+}
@@ -12,6 +12,11 @@ uzbl_variables_set (const gchar *name, gchar *val);
 gboolean
 uzbl_variables_toggle (const gchar *name, GArray *values);
 
+void
+uzbl_variables_begin_batch ();
+gboolean
+uzbl_variables_end_batch ();
+
 gchar *
 uzbl_variables_expand (const gchar *str);
 void
@@ -3,7 +3,13 @@
 #include "../src/uzbl-core.h"
 
 #include "../src/setup.h"
+#include "../src/binds.h"
+#include "../src/blocklist.h"
 #include "../src/commands.h"
+#include "../src/events.h"
+#include "../src/rules.h"
+#include "../src/type.h"
+#include "../src/variables.h"
 
 UzblCore uzbl;
 
@@ -139,6 +145,345 @@ test_commands_chain_js ()
     g_main_loop_run (loop);
 }
 
+static void
+test_blocklist_domain ()
+{
+    UzblBlocklist *blocklist = uzbl_blocklist_new ();
+
+    g_assert_true (uzbl_blocklist_add_rule (blocklist, "||ads.example.com^"));
+    g_assert_true (uzbl_blocklist_match (blocklist, "http://ads.example.com/banner.png"));
+    g_assert_true (uzbl_blocklist_match (blocklist, "https://cdn.ads.example.com:8080/"));
+    g_assert_true (uzbl_blocklist_match (blocklist, "https://user@ADS.example.com/"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://example.com/"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://badads.example.com/"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://www.example.org/ads.example.com"));
+
+    uzbl_blocklist_free (blocklist);
+}
+
+static void
+test_blocklist_substring ()
+{
+    UzblBlocklist *blocklist = uzbl_blocklist_new ();
+
+    g_assert_true (uzbl_blocklist_add_rule (blocklist, "*/banner/*"));
+    g_assert_true (uzbl_blocklist_add_rule (blocklist, "tracker.js"));
+    g_assert_true (uzbl_blocklist_match (blocklist, "http://example.com/img/Banner/1.png"));
+    g_assert_true (uzbl_blocklist_match (blocklist, "http://example.com/js/tracker.js?v=2"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://example.com/banners/1.png"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://example.com/tracker.min.js"));
+
+    uzbl_blocklist_free (blocklist);
+}
+
+static void
+test_blocklist_regex ()
+{
+    UzblBlocklist *blocklist = uzbl_blocklist_new ();
+
+    g_assert_true (uzbl_blocklist_add_rule (blocklist, "/\\/ad[0-9]+\\.js$/"));
+    g_assert_false (uzbl_blocklist_add_rule (blocklist, "/(/"));
+    g_assert_cmpuint (1, ==, uzbl_blocklist_size (blocklist));
+    g_assert_true (uzbl_blocklist_match (blocklist, "http://example.com/AD42.js"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://example.com/ad.js"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://example.com/ad42.js?x"));
+
+    uzbl_blocklist_free (blocklist);
+}
+
+static void
+test_blocklist_regex_many ()
+{
+    UzblBlocklist *blocklist = uzbl_blocklist_new ();
+    guint i;
+
+    /* Enough rules to need several alternations. */
+    for (i = 0; i < 1000; ++i) {
+        gchar *rule = g_strdup_printf ("/^https?://host%u\\.example\\.com/", i);
+        g_assert_true (uzbl_blocklist_add_rule (blocklist, rule));
+        g_free (rule);
+    }
+
+    g_assert_true (uzbl_blocklist_match (blocklist, "http://host0.example.com/"));
+    g_assert_true (uzbl_blocklist_match (blocklist, "https://host999.example.com/"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "https://host1000.example.com/"));
+
+    uzbl_blocklist_free (blocklist);
+}
+
+static void
+test_blocklist_wildcard ()
+{
+    UzblBlocklist *blocklist = uzbl_blocklist_new ();
+
+    g_assert_true (uzbl_blocklist_add_rule (blocklist, "/ads/*/track^"));
+    g_assert_true (uzbl_blocklist_add_rule (blocklist, "|http://plain.example.com/*.gif|"));
+    g_assert_true (uzbl_blocklist_match (blocklist, "http://example.com/ads/1/track?id=2"));
+    g_assert_true (uzbl_blocklist_match (blocklist, "http://example.com/ads/1/2/track"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://example.com/ads/1/tracking"));
+    g_assert_true (uzbl_blocklist_match (blocklist, "http://plain.example.com/a/b.gif"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "https://plain.example.com/a/b.gif"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://plain.example.com/a/b.gif?x"));
+
+    uzbl_blocklist_free (blocklist);
+}
+
+static void
+test_blocklist_exception ()
+{
+    UzblBlocklist *blocklist = uzbl_blocklist_new ();
+
+    g_assert_true (uzbl_blocklist_add_rule (blocklist, "||example.com^"));
+    g_assert_true (uzbl_blocklist_add_rule (blocklist, "@@||good.example.com^"));
+    g_assert_true (uzbl_blocklist_add_rule (blocklist, "@@/allowed/"));
+    g_assert_true (uzbl_blocklist_add_rule (blocklist, "@@/\\?keep=[0-9]+$/"));
+    g_assert_false (uzbl_blocklist_add_rule (blocklist, "@@||example.com^$script"));
+
+    g_assert_true (uzbl_blocklist_match (blocklist, "http://example.com/"));
+    g_assert_true (uzbl_blocklist_match (blocklist, "http://bad.example.com/"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://good.example.com/"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://a.good.example.com/"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://example.com/allowed/x.js"));
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://example.com/?keep=1"));
+
+    /* Exceptions alone never block anything. */
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://example.org/allowed/"));
+
+    uzbl_blocklist_clear (blocklist);
+    g_assert_false (uzbl_blocklist_match (blocklist, "http://example.com/"));
+
+    uzbl_blocklist_free (blocklist);
+}
+
+static UzblRuleAction
+rules_match (UzblRuleTable table, const gchar *uri)
+{
+    gchar *argument = NULL;
+    UzblRuleAction action = uzbl_rules_match (table, uri, &argument);
+
+    g_free (argument);
+
+    return action;
+}
+
+static void
+test_rules_host ()
+{
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION, "*.example.com", "ignore", NULL));
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION, ".example.net", "download", NULL));
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION, "example.org", "allow", NULL));
+
+    g_assert_cmpint (UZBL_RULE_IGNORE, ==, rules_match (UZBL_RULES_NAVIGATION, "http://www.example.com/"));
+    g_assert_cmpint (UZBL_RULE_IGNORE, ==, rules_match (UZBL_RULES_NAVIGATION, "https://a.b.EXAMPLE.com:8080/x"));
+    g_assert_cmpint (UZBL_RULE_IGNORE, ==, rules_match (UZBL_RULES_NAVIGATION, "http://example.com/"));
+    g_assert_cmpint (UZBL_RULE_NONE, ==, rules_match (UZBL_RULES_NAVIGATION, "http://notexample.com/"));
+    g_assert_cmpint (UZBL_RULE_DOWNLOAD, ==, rules_match (UZBL_RULES_NAVIGATION, "ftp://files.example.net/a"));
+    g_assert_cmpint (UZBL_RULE_ALLOW, ==, rules_match (UZBL_RULES_NAVIGATION, "http://example.org/x"));
+    g_assert_cmpint (UZBL_RULE_NONE, ==, rules_match (UZBL_RULES_NAVIGATION, "http://www.example.org/x"));
+    g_assert_cmpint (UZBL_RULE_NONE, ==, rules_match (UZBL_RULES_REQUEST, "http://example.org/x"));
+
+    uzbl_rules_clear (UZBL_RULES_NAVIGATION);
+    g_assert_cmpint (UZBL_RULE_NONE, ==, rules_match (UZBL_RULES_NAVIGATION, "http://example.org/x"));
+}
+
+static void
+test_rules_path ()
+{
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION, "https://example.com/docs", "allow", NULL));
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION, "*/api/*", "ignore", NULL));
+
+    g_assert_cmpint (UZBL_RULE_ALLOW, ==, rules_match (UZBL_RULES_NAVIGATION, "https://example.com/docs"));
+    g_assert_cmpint (UZBL_RULE_ALLOW, ==, rules_match (UZBL_RULES_NAVIGATION, "https://example.com/docs/a?b"));
+    g_assert_cmpint (UZBL_RULE_NONE, ==, rules_match (UZBL_RULES_NAVIGATION, "http://example.com/docs"));
+    g_assert_cmpint (UZBL_RULE_NONE, ==, rules_match (UZBL_RULES_NAVIGATION, "https://example.com/other"));
+    g_assert_cmpint (UZBL_RULE_IGNORE, ==, rules_match (UZBL_RULES_NAVIGATION, "http://example.org/api/v1"));
+    g_assert_cmpint (UZBL_RULE_NONE, ==, rules_match (UZBL_RULES_NAVIGATION, "http://example.org/apis"));
+
+    uzbl_rules_clear (UZBL_RULES_NAVIGATION);
+}
+
+static void
+test_rules_order ()
+{
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION, "example.com/private", "ignore", NULL));
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION, "~^https?://example\\.com/", "allow", NULL));
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION, "example.com", "download", NULL));
+
+    g_assert_cmpint (UZBL_RULE_IGNORE, ==, rules_match (UZBL_RULES_NAVIGATION, "http://example.com/private/x"));
+    g_assert_cmpint (UZBL_RULE_ALLOW, ==, rules_match (UZBL_RULES_NAVIGATION, "http://example.com/public"));
+    g_assert_cmpint (UZBL_RULE_DOWNLOAD, ==, rules_match (UZBL_RULES_NAVIGATION, "file://example.com/public"));
+
+    uzbl_rules_clear (UZBL_RULES_NAVIGATION);
+
+    /* The same rules the other way round. */
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION, "example.com", "download", NULL));
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION, "~^https?://example\\.com/", "allow", NULL));
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION, "example.com/private", "ignore", NULL));
+
+    g_assert_cmpint (UZBL_RULE_DOWNLOAD, ==, rules_match (UZBL_RULES_NAVIGATION, "http://example.com/private/x"));
+
+    uzbl_rules_clear (UZBL_RULES_NAVIGATION);
+}
+
+static void
+test_rules_rewrite ()
+{
+    gchar *argument = NULL;
+
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION,
+        "~^http://(www\\.)?example\\.com/(.*)$", "rewrite", "https://example.com/\\2"));
+    g_assert_true (uzbl_rules_add (UZBL_RULES_NAVIGATION,
+        "old.example.org", "rewrite", "https://new.example.org/"));
+    g_assert_false (uzbl_rules_add (UZBL_RULES_NAVIGATION, "example.net", "rewrite", NULL));
+    g_assert_false (uzbl_rules_add (UZBL_RULES_REQUEST, "example.net", "rewrite", "https://example.net/"));
+
+    g_assert_cmpint (UZBL_RULE_REWRITE, ==,
+        uzbl_rules_match (UZBL_RULES_NAVIGATION, "http://www.example.com/a?b=c", &argument));
+    g_assert_cmpstr (argument, ==, "https://example.com/a?b=c");
+    g_free (argument);
+
+    g_assert_cmpint (UZBL_RULE_REWRITE, ==,
+        uzbl_rules_match (UZBL_RULES_NAVIGATION, "http://old.example.org/page", &argument));
+    g_assert_cmpstr (argument, ==, "https://new.example.org/");
+    g_free (argument);
+
+    g_assert_cmpint (UZBL_RULE_NONE, ==,
+        uzbl_rules_match (UZBL_RULES_NAVIGATION, "https://example.com/a", &argument));
+    g_assert_null (argument);
+
+    uzbl_rules_clear (UZBL_RULES_NAVIGATION);
+}
+
+static void
+reset_binds ()
+{
+    uzbl_variables_set ("mode", "");
+    uzbl_variables_set ("keycmd", "");
+
+    uzbl_binds_free ();
+    uzbl_binds_init ();
+}
+
+/* Does what the key press handler does with a printable key. */
+static void
+press_keys (const gchar *keys)
+{
+    const gchar *p;
+
+    for (p = keys; *p; ++p) {
+        gchar key[2] = { *p, '\0' };
+
+        if (!uzbl_binds_key_press ("", key)) {
+            uzbl_events_send (KEY_PRESS, NULL,
+                TYPE_STR, "",
+                TYPE_STR, key,
+                NULL);
+        }
+    }
+}
+
+static void
+wait_for_variable (const gchar *name, const gchar *expected)
+{
+    gint64 deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+    gchar *value = uzbl_variables_get_string (name);
+
+    /* Binds run asynchronously. */
+    while (g_strcmp0 (value, expected) && (g_get_monotonic_time () < deadline)) {
+        if (!g_main_context_iteration (NULL, FALSE)) {
+            g_usleep (1000);
+        }
+
+        g_free (value);
+        value = uzbl_variables_get_string (name);
+    }
+
+    g_assert_cmpstr (value, ==, expected);
+    g_free (value);
+}
+
+static void
+test_binds_run ()
+{
+    reset_binds ();
+
+    uzbl_binds_event ("BIND", "gh = set bind_ran home");
+
+    g_assert_true (uzbl_binds_key_press ("", "g"));
+    g_assert_true (uzbl_binds_key_press ("", "h"));
+    wait_for_variable ("bind_ran", "home");
+}
+
+static void
+test_binds_forward_order ()
+{
+    if (g_test_subprocess ()) {
+        reset_binds ();
+        uzbl_variables_set ("print_events", "1");
+
+        uzbl_binds_event ("BIND", "gh = set bind_ran home");
+
+        /* "g" is held back for the bind until "x" shows it can't match. */
+        press_keys ("gxy");
+        return;
+    }
+
+    g_test_trap_subprocess (NULL, 0, 0);
+    g_test_trap_assert_passed ();
+    g_test_trap_assert_stdout ("*KEY_PRESS '' 'g'\n*KEY_PRESS '' 'x'\n*KEY_PRESS '' 'y'\n*");
+    g_test_trap_assert_stdout_unmatched ("*KEY_PRESS '' 'x'\n*KEY_PRESS '' 'g'\n*");
+}
+
+static void
+test_binds_defer ()
+{
+    reset_binds ();
+
+    uzbl_binds_event ("BIND", "gh = set bind_ran defer");
+    uzbl_binds_event ("BIND", "o_ = uri %s");
+
+    /* A bind with a prompt is the event manager's, and so are the keys
+     * after it until it clears the keycmd. */
+    g_assert_false (uzbl_binds_key_press ("", "o"));
+    g_assert_false (uzbl_binds_key_press ("", "g"));
+
+    uzbl_variables_set ("keycmd", "og");
+    g_assert_false (uzbl_binds_key_press ("", "h"));
+
+    uzbl_variables_set ("keycmd", "");
+    g_assert_true (uzbl_binds_key_press ("", "g"));
+    g_assert_true (uzbl_binds_key_press ("", "h"));
+    wait_for_variable ("bind_ran", "defer");
+
+    /* Keys with modifiers which aren't ignored go to the event manager. */
+    g_assert_false (uzbl_binds_key_press ("Ctrl", "g"));
+    uzbl_variables_set ("keycmd", "");
+
+    uzbl_binds_event ("IGNORE_KEY", "<Shift>");
+    g_assert_true (uzbl_binds_key_press ("Shift", "g"));
+}
+
+static void
+test_binds_mode ()
+{
+    reset_binds ();
+
+    uzbl_binds_event ("MODE_BIND", "global gm = set bind_mode global");
+    uzbl_binds_event ("MODE_BIND", "command gm = set bind_mode command");
+
+    uzbl_variables_set ("mode", "command");
+    press_keys ("gm");
+    wait_for_variable ("bind_mode", "command");
+
+    uzbl_variables_set ("mode", "insert");
+    press_keys ("gm");
+    wait_for_variable ("bind_mode", "global");
+
+    /* Stack binds are left to the event manager. */
+    uzbl_variables_set ("mode", "stack");
+    g_assert_false (uzbl_binds_key_press ("", "g"));
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -147,6 +492,8 @@ main (int argc, char *argv[])
     uzbl_commands_init ();
     uzbl_variables_init ();
     uzbl_io_init ();
+    uzbl_rules_init ();
+    uzbl_binds_init ();
 
     g_test_add_func ("/uzbl/commands/parse_simple", test_parse_simple);
     g_test_add_func ("/uzbl/commands/parse_quoted", test_parse_quoted);
@@ -156,5 +503,22 @@ main (int argc, char *argv[])
     g_test_add_func ("/uzbl/commands/js", test_commands_js);
     g_test_add_func ("/uzbl/commands/chain_js", test_commands_chain_js);
 
+    g_test_add_func ("/uzbl/binds/run", test_binds_run);
+    g_test_add_func ("/uzbl/binds/forward_order", test_binds_forward_order);
+    g_test_add_func ("/uzbl/binds/defer", test_binds_defer);
+    g_test_add_func ("/uzbl/binds/mode", test_binds_mode);
+
+    g_test_add_func ("/uzbl/rules/host", test_rules_host);
+    g_test_add_func ("/uzbl/rules/path", test_rules_path);
+    g_test_add_func ("/uzbl/rules/order", test_rules_order);
+    g_test_add_func ("/uzbl/rules/rewrite", test_rules_rewrite);
+
+    g_test_add_func ("/uzbl/blocklist/domain", test_blocklist_domain);
+    g_test_add_func ("/uzbl/blocklist/substring", test_blocklist_substring);
+    g_test_add_func ("/uzbl/blocklist/regex", test_blocklist_regex);
+    g_test_add_func ("/uzbl/blocklist/regex_many", test_blocklist_regex_many);
+    g_test_add_func ("/uzbl/blocklist/wildcard", test_blocklist_wildcard);
+    g_test_add_func ("/uzbl/blocklist/exception", test_blocklist_exception);
+
     return g_test_run ();
 }
@@ -5,7 +5,7 @@
 from emtest import EventManagerMock
 from uzbl.plugins.config import Config
 from uzbl.plugins.keycmd import KeyCmd
-from uzbl.plugins.completion import CompletionPlugin
+from uzbl.plugins.completion import CompletionPlugin, Completions, common_prefix
 
 
 class DummyFormatter(object):
@@ -33,6 +33,38 @@ def test_config(self):
         self.assertIn('@spam', c.completion)
 
 
+class TestCompletions(unittest.TestCase):
+    def test_prefixed(self):
+        c = Completions()
+        c.update(['spam', 'egg', 'bar', 'baz'])
+        c.add_var('spam')
+        c.add('ba')
+        self.assertEqual(c.prefixed('ba'), ['ba', 'bar', 'baz'])
+        self.assertEqual(c.prefixed('bar'), ['bar'])
+        self.assertEqual(c.prefixed('@'), ['@spam'])
+        self.assertEqual(c.prefixed('x'), [])
+        self.assertEqual(c.prefixed(''), sorted(c))
+
+    def test_incremental(self):
+        c = Completions()
+        c.add('spam')
+        c.add('spam')
+        c.update(['egg'], ['spam', 'eggs'])
+        self.assertEqual(c.sorted, ['egg', 'eggs', 'spam'])
+        c.discard('eggs')
+        c.discard('missing')
+        self.assertEqual(c.sorted, ['egg', 'spam'])
+        self.assertRaises(KeyError, c.remove, 'eggs')
+        c.clear()
+        self.assertEqual(c.prefixed(''), [])
+
+    def test_common_prefix(self):
+        self.assertEqual(common_prefix(['bar', 'baz']), 'ba')
+        self.assertEqual(common_prefix(['ba', 'bar', 'baz']), 'ba')
+        self.assertEqual(common_prefix(['spam']), 'spam')
+        self.assertEqual(common_prefix(['egg', 'spam']), '')
+
+
 class TestCompletion(unittest.TestCase):
     def setUp(self):
         self.event_manager = EventManagerMock(
@@ -5,10 +5,15 @@
 if '' not in sys.path:
     sys.path.insert(0, '')
 
+import os
+import shutil
+import stat
+import tempfile
 import unittest
 from emtest import EventManagerMock
 
-from uzbl.plugins.cookies import Cookies
+from uzbl.arguments import splitquoted
+from uzbl.plugins.cookies import Cookies, CookieMatchers, TextStore
 from uzbl.plugins.config import Config
 
 cookies = (
@@ -73,6 +78,128 @@ def test_filter_numeric(self):
             'cookie delete ' + cookies[1])
 
 
+class CookieMatchersTest(unittest.TestCase):
+    def setUp(self):
+        self.matchers = CookieMatchers()
+
+    def matches(self, cookie):
+        return self.matchers.match(splitquoted(cookie))
+
+    def test_empty(self):
+        self.assertFalse(self.matchers)
+        self.assertFalse(self.matches(cookies[0]))
+
+    def test_domain_suffix(self):
+        self.matchers.add(r'domain "nyan\.cat$"')
+        self.assertTrue(self.matches(cookies[0]))
+        self.assertTrue(self.matches(r'"xnyan.cat" "/" "a" "b" "http" ""'))
+        self.assertFalse(self.matches(cookies[1]))
+
+    def test_domain_exact(self):
+        self.matchers.add(r'domain "^\.twitter\.com$"')
+        self.assertTrue(self.matches(cookies[1]))
+        self.assertFalse(self.matches(r'"a.twitter.com" "/" "a" "b" "http" ""'))
+
+    def test_joined_regex(self):
+        self.matchers.add(r'name "^__utm"')
+        self.matchers.add(r'name "^guest_"')
+        self.assertTrue(self.matches(cookies[0]))
+        self.assertTrue(self.matches(cookies[1]))
+        self.assertFalse(self.matches(r'"a.com" "/" "sid" "b" "http" ""'))
+
+    def test_backreference(self):
+        self.matchers.add(r'name "(a)\\1"')
+        self.matchers.add(r'name "(b)\\1"')
+        self.assertTrue(self.matches(r'"a.com" "/" "xbb" "b" "http" ""'))
+        self.assertFalse(self.matches(r'"a.com" "/" "ab" "b" "http" ""'))
+
+    def test_all_components(self):
+        self.matchers.add(r'domain "nyan\.cat$" scheme "^https"')
+        self.assertFalse(self.matches(cookies[0]))
+        self.assertTrue(self.matches(
+            r'".nyan.cat" "/" "a" "b" "https" ""'))
+
+    def test_clear(self):
+        self.matchers.add(r'domain "nyan\.cat$"')
+        self.assertTrue(self.matches(cookies[0]))
+        self.matchers.clear()
+        self.assertFalse(self.matches(cookies[0]))
+
+
+class TextStoreTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.path = os.path.join(self.dir, 'cookies.txt')
+
+    def tearDown(self):
+        shutil.rmtree(self.dir)
+
+    def rows(self):
+        with open(self.path) as f:
+            return [l.rstrip('\n').split('\t') for l in f
+                    if not l.startswith('# ')]
+
+    def test_write_behind(self):
+        store = TextStore(self.path)
+        cookie = splitquoted(cookies[0])
+        store.add_cookie(cookie.raw(), cookie)
+        self.assertFalse(os.path.exists(self.path))
+
+        store.flush()
+        self.assertEqual(self.rows(), [
+            ['.nyan.cat', 'TRUE', '/', 'FALSE', '1313992440', '__utmb',
+             '183192761.1.10.1313990640']
+        ])
+        mode = stat.S_IMODE(os.stat(self.path).st_mode)
+        self.assertEqual(mode & (stat.S_IRWXG | stat.S_IRWXO), 0)
+        self.assertEqual(os.listdir(self.dir), ['cookies.txt'])
+
+    def test_replace(self):
+        store = TextStore(self.path)
+        for value in ('a', 'b'):
+            cookie = splitquoted(
+                r'"a.com" "/" "sid" "%s" "httpsOnly" "1377104460"' % value)
+            store.add_cookie(cookie.raw(), cookie)
+        store.flush()
+        self.assertEqual(self.rows(), [
+            ['#HttpOnly_a.com', 'FALSE', '/', 'TRUE', '1377104460', 'sid', 'b']
+        ])
+
+    def test_delete(self):
+        store = TextStore(self.path)
+        for raw in cookies:
+            cookie = splitquoted(raw)
+            store.add_cookie(cookie.raw(), cookie)
+
+        cookie = splitquoted(cookies[0])
+        store.delete_cookie(cookie.raw(), cookie)
+        store.delete_cookie(None, ('.twitter.com',))
+        store.flush()
+        self.assertEqual(self.rows(), [])
+
+    def test_delete_other_value(self):
+        store = TextStore(self.path)
+        cookie = splitquoted(cookies[0])
+        store.add_cookie(cookie.raw(), cookie)
+
+        other = splitquoted(
+            r'".nyan.cat" "/" "__utmb" "other" "http" "1313992440"')
+        store.delete_cookie(other.raw(), other)
+        store.flush()
+        self.assertEqual(len(self.rows()), 1)
+
+    def test_reload(self):
+        store = TextStore(self.path)
+        for raw in cookies:
+            cookie = splitquoted(raw)
+            store.add_cookie(cookie.raw(), cookie)
+        store.flush()
+
+        store = TextStore(self.path)
+        self.assertEqual(list(store.cookies.values()),
+                         [tuple(splitquoted(raw)) for raw in cookies])
+
+
 class PrivateCookieTest(unittest.TestCase):
     def setUp(self):
         self.event_manager = EventManagerMock(
@@ -6,6 +6,9 @@
 if '' not in sys.path:
     sys.path.insert(0, '')
 
+import os
+import shutil
+import tempfile
 import unittest
 from emtest import EventManagerMock
 from six import next
@@ -18,7 +21,8 @@
 
 class SharedHistoryTest(unittest.TestCase):
     def setUp(self):
-        self.event_manager = EventManagerMock((SharedHistory,), ())
+        self.event_manager = EventManagerMock((SharedHistory,), (),
+            plugin_config={'history': {'path': ''}})
         self.uzbl = self.event_manager.add()
         self.other = self.event_manager.add()
 
@@ -50,12 +54,86 @@ def test_get_missing_prompt(self):
         s.addline('foo', 'bar')
         self.assertRaises(IndexError, s.getline, 'bar', 0)
 
+    def test_duplicate_moves_to_end(self):
+        s = SharedHistory[self.uzbl]
+        s.addline('foo', 'bar')
+        s.addline('foo', 'baz')
+        s.addline('foo', 'bar')
+        self.assertEqual(s.get_line_number('foo'), 2)
+        self.assertEqual(s.getline('foo', 0), 'baz')
+        self.assertEqual(s.getline('foo', 1), 'bar')
+
+    def test_find(self):
+        s = SharedHistory[self.uzbl]
+        for line in ('spam', 'eggs', 'spammer', 'ham', 'sp'):
+            s.addline('foo', line)
+        self.assertEqual(s.find_prev('foo', 'spam', 4), 2)
+        self.assertEqual(s.find_prev('foo', 'spam', 1), 0)
+        self.assertEqual(s.find_prev('foo', 'spam', -1), -1)
+        self.assertEqual(s.find_next('foo', 'spam', 1), 2)
+        self.assertEqual(s.find_next('foo', 'spam', 3), 5)
+        self.assertEqual(s.find_prev('foo', 'sp', 4), 4)
+        self.assertEqual(s.find_prev('foo', 'xyz', 4), -1)
+        self.assertEqual(s.find_prev('bar', 'spam', 4), -1)
+        s.addline('foo', 'spam')
+        self.assertEqual(s.find_prev('foo', 'spam', 4), 4)
+        self.assertEqual(s.find_prev('foo', 'spam', 3), 1)
+
+
+class SharedHistoryLimitTest(unittest.TestCase):
+    def test_size(self):
+        event_manager = EventManagerMock((SharedHistory,), (),
+            plugin_config={'history': {'path': '', 'size': '2'}})
+        s = SharedHistory[event_manager.add()]
+        s.addline('foo', 'one')
+        s.addline('foo', 'two')
+        s.addline('foo', 'three')
+        self.assertEqual(s.get_line_number('foo'), 2)
+        self.assertEqual(s.getline('foo', 0), 'two')
+        self.assertEqual(s.find_prev('foo', 'one', 1), -1)
+
+
+class SharedHistoryFileTest(unittest.TestCase):
+    def setUp(self):
+        self.dir = tempfile.mkdtemp()
+        self.path = os.path.join(self.dir, 'prompt_history')
+
+    def tearDown(self):
+        shutil.rmtree(self.dir)
+
+    def make(self):
+        event_manager = EventManagerMock((SharedHistory,), (),
+            plugin_config={'history': {'path': self.path}})
+        return SharedHistory[event_manager.add()]
+
+    def test_save_and_load(self):
+        s = self.make()
+        s.addline('', 'uri example.com')
+        s.addline('git', 'tab\there')
+        s.addline('git', 'back\\slash\nnewline')
+        s.addline('', 'uri example.com')
+        s.flush()
+        self.assertIsNone(s.writer.timer)
+
+        s = self.make()
+        self.assertEqual(s.get_line_number(''), 1)
+        self.assertEqual(s.getline('', 0), 'uri example.com')
+        self.assertEqual(s.getline('git', 0), 'tab\there')
+        self.assertEqual(s.getline('git', 1), 'back\\slash\nnewline')
+
+    def test_no_file(self):
+        s = self.make()
+        self.assertEqual(s.get_line_number(''), 0)
+        s.flush()
+        self.assertFalse(os.path.exists(self.path))
+
 
 class HistoryTest(unittest.TestCase):
     def setUp(self):
         self.event_manager = EventManagerMock(
             (SharedHistory,),
-            (OnSetPlugin, KeyCmd, Config, History)
+            (OnSetPlugin, KeyCmd, Config, History),
+            plugin_config={'history': {'path': ''}}
         )
         self.uzbl = self.event_manager.add()
         self.other = self.event_manager.add()
@@ -125,8 +203,6 @@ def test_exec_from_history(self):
         self.assertEqual('doop', h.prev())
         self.assertEqual('foo', h.prev())
         self.assertEqual('bar', h.prev())
-        # do we really want this one here ?
-        self.assertEqual('doop', h.prev())
         self.assertEqual('woop', h.prev())
 
     def test_search(self):
@@ -1,5 +1,6 @@
 '''Keycmd completion.'''
 
+from bisect import bisect_left, insort
 import json
 import re
 
@@ -20,8 +21,12 @@ def escape(str):
 
 
 class Completions(set):
+    '''The completion candidates, also kept in a sorted list so the ones
+    starting with a prefix are a contiguous run found by bisection.'''
+
     def __init__(self):
         set.__init__(self)
+        self.sorted = []
         self.locked = False
         self.level = NONE
 
@@ -31,9 +36,57 @@ def lock(self):
     def unlock(self):
         self.locked = False
 
+    def add(self, item):
+        if item not in self:
+            set.add(self, item)
+            insort(self.sorted, item)
+
+    def update(self, *iterables):
+        new = set().union(*iterables) - self
+        if not new:
+            return
+        set.update(self, new)
+        if len(new) == 1:
+            insort(self.sorted, next(iter(new)))
+        else:
+            self.sorted = sorted(self.sorted + list(new))
+
+    def discard(self, item):
+        if item in self:
+            set.discard(self, item)
+            del self.sorted[bisect_left(self.sorted, item)]
+
+    def remove(self, item):
+        if item not in self:
+            raise KeyError(item)
+        self.discard(item)
+
+    def clear(self):
+        set.clear(self)
+        self.sorted = []
+
     def add_var(self, var):
         self.add('@' + var)
 
+    def prefixed(self, partial):
+        '''The sorted candidates starting with partial.'''
+
+        start = end = bisect_left(self.sorted, partial)
+        while end < len(self.sorted) and self.sorted[end].startswith(partial):
+            end += 1
+        return self.sorted[start:end]
+
+
+def common_prefix(hints):
+    '''The longest prefix shared by sorted hints; it is the one shared by
+    the first and the last.'''
+
+    first, last = hints[0], hints[-1]
+    i = 0
+    while i < min(len(first), len(last)) and first[i] == last[i]:
+        i += 1
+    return first[:i]
+
 
 class CompletionListFormatter(object):
     LIST_FORMAT = "<span> %s </span>"
@@ -115,7 +168,7 @@ def update_completion_list(self, *args):
 
         config = Config[self.uzbl]
 
-        hints = [h for h in self.completion if h.startswith(partial)]
+        hints = self.completion.prefixed(partial)
         if not hints:
             del config['completion_list']
             return
@@ -133,7 +186,7 @@ def start_completion(self, *args):
         if self.completion.level < COMPLETE:
             self.completion.level += 1
 
-        hints = [h for h in self.completion if h.startswith(partial)]
+        hints = self.completion.prefixed(partial)
         if not hints:
             return
 
@@ -143,26 +196,13 @@ def start_completion(self, *args):
             self.completion.unlock()
             return
 
-        elif partial in hints and self.completion.level == COMPLETE:
+        elif partial in self.completion and self.completion.level == COMPLETE:
             self.completion.lock()
             self.complete_completion(partial, partial)
             self.completion.unlock()
             return
 
-        smalllen, smallest = sorted([(len(h), h) for h in hints])[0]
-        common = ''
-        for i in range(len(partial), smalllen):
-            char, same = smallest[i], True
-            for hint in hints:
-                if hint[i] != char:
-                    same = False
-                    break
-
-            if not same:
-                break
-
-            common += char
-
+        common = common_prefix(hints)[len(partial):]
         if common:
             self.completion.lock()
             self.partial_completion(partial, partial + common)
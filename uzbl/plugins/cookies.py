@@ -2,13 +2,15 @@
     forwards cookies to all other instances connected to the event manager"""
 
 from __future__ import print_function
-from collections import defaultdict
+from collections import defaultdict, OrderedDict
+import atexit
 import os
 import re
 import stat
 
 from uzbl.arguments import splitquoted
 from uzbl.ext import GlobalPlugin, PerInstancePlugin
+from uzbl.writebehind import WriteBehind
 from uzbl.xdg import xdg_data_home
 from .config import Config
 
@@ -32,34 +34,104 @@ def match(key, cookie):
     return True
 
 
-def match_list(_list, cookie):
-    for matcher in _list:
-        for component, match in matcher:
-            if match(cookie[component]) is None:
-                break
-        else:
-            return True
-    return False
-
-
-def add_cookie_matcher(_list, arg):
-    ''' add a cookie matcher to a whitelist or a blacklist.
+class CookieMatchers(object):
+    ''' a cookie whitelist or blacklist.
         a matcher is a list of (component, re) tuples that matches a cookie
         when the "component" part of the cookie matches the regular expression
         "re". "component" is one of the keys defined in the variable
         "symbolic" above, or the index of a component of a cookie tuple.
+
+        the list is compiled when it is first used after a change: literal
+        domain suffixes such as "example.com$" go into a set, other
+        single-component matchers are joined into one regular expression per
+        component, so checking a cookie does not depend on the list length.
     '''
 
-    args = splitquoted(arg)
-    mlist = []
-    for (component, regexp) in zip(args[0::2], args[1::2]):
-        try:
-            component = symbolic[component]
-        except KeyError:
-            component = int(component)
-        assert component <= 5
-        mlist.append((component, re.compile(regexp).search))
-    _list.append(mlist)
+    # a literal domain, optionally anchored at the start. dots are taken to
+    # mean dots, which is what they are meant to be in a domain.
+    LITERAL_DOMAIN = re.compile(r'^(\^?)((?:[\w.-]|\\[^0-9A-Za-z])+)\$$')
+    # patterns whose meaning changes when they are joined with others
+    UNJOINABLE = re.compile(r'\\[1-9]|\(\?P=|\(\?[aiLmsux]')
+
+    def __init__(self):
+        self.matchers = []
+        self.compiled = None
+
+    def __len__(self):
+        return len(self.matchers)
+
+    def add(self, arg):
+        args = splitquoted(arg)
+        mlist = []
+        for (component, regexp) in zip(args[0::2], args[1::2]):
+            try:
+                component = symbolic[component]
+            except KeyError:
+                component = int(component)
+            assert component <= 5
+            re.compile(regexp)
+            mlist.append((component, regexp))
+        self.matchers.append(mlist)
+        self.compiled = None
+
+    def clear(self):
+        self.matchers = []
+        self.compiled = None
+
+    def match(self, cookie):
+        if self.compiled is None:
+            self.compiled = self._compile()
+        exact, suffixes, joined, rest = self.compiled
+
+        domain = cookie[0]
+        if domain in exact:
+            return True
+        if suffixes:
+            for i in range(len(domain) + 1):
+                if domain[i:] in suffixes:
+                    return True
+        for component, regex in joined:
+            if regex.search(cookie[component]) is not None:
+                return True
+        for matcher in rest:
+            for component, regex in matcher:
+                if regex.search(cookie[component]) is None:
+                    break
+            else:
+                return True
+        return False
+
+    def _compile(self):
+        exact, suffixes = set(), set()
+        single = defaultdict(list)
+        rest = []
+
+        for matcher in self.matchers:
+            if len(matcher) != 1:
+                rest.append(matcher)
+                continue
+            component, regexp = matcher[0]
+            literal = self.LITERAL_DOMAIN.match(regexp)
+            if component == symbolic['domain'] and literal:
+                domain = re.sub(r'\\(.)', r'\1', literal.group(2))
+                (exact if literal.group(1) else suffixes).add(domain)
+            elif self.UNJOINABLE.search(regexp):
+                rest.append(matcher)
+            else:
+                single[component].append(regexp)
+
+        joined = []
+        for component, regexps in sorted(single.items()):
+            try:
+                regex = re.compile('|'.join('(?:%s)' % r for r in regexps))
+            except re.error:
+                # e.g. a group name used twice; check them one by one
+                rest.extend([(component, r)] for r in regexps)
+            else:
+                joined.append((component, regex))
+
+        rest = [[(c, re.compile(r)) for c, r in m] for m in rest]
+        return exact, suffixes, joined, rest
 
 
 class NullStore(object):
@@ -85,6 +157,11 @@ def delete_cookie(self, rkey, key):
 
 
 class TextStore(object):
+    ''' a cookies.txt file, kept in memory and keyed by (domain, path, name).
+        changes are written back in the background by replacing the file, so
+        it is never seen half-written. comments and malformed rows are not
+        kept. '''
+
     def __init__(self, filename):
         self.filename = filename
         try:
@@ -97,6 +174,21 @@ def __init__(self, filename):
         except OSError:
             pass
 
+        self.cookies = OrderedDict()
+        self.writer = WriteBehind(self.filename, self._lines)
+        self.lock = self.writer.lock
+
+        try:
+            with open(self.filename, 'r') as f:
+                for line in f:
+                    cookie = self.as_event(line.rstrip('\n').split('\t'))
+                    if cookie is not None:
+                        self.cookies[cookie[:3]] = cookie
+        except (IOError, OSError):
+            pass
+
+        atexit.register(self.flush)
+
     def as_event(self, cookie):
         """Convert cookie.txt row to uzbls cookie event format"""
         scheme = {
@@ -147,39 +239,37 @@ def as_file(self, cookie):
 
     def add_cookie(self, rawcookie, cookie):
         assert len(cookie) == 6
+        cookie = tuple(cookie)
 
-        # delete equal cookies (ignoring expire time, value and secure flag)
-        self.delete_cookie(None, cookie[:-3])
-
-        # restrict umask before creating the cookie jar
-        curmask = os.umask(0)
-        os.umask(curmask | stat.S_IRWXO | stat.S_IRWXG)
-
-        first = not os.path.exists(self.filename)
-        with open(self.filename, 'a') as f:
-            if first:
-                print("# HTTP Cookie File", file=f)
-            print('\t'.join(self.as_file(cookie)), file=f)
+        # replace equal cookies (ignoring expire time, value and secure flag)
+        with self.lock:
+            self.cookies.pop(cookie[:3], None)
+            self.cookies[cookie[:3]] = cookie
+            self._changed()
 
     def delete_cookie(self, rkey, key):
-        if not os.path.exists(self.filename):
-            return
-
-        # restrict umask before creating the cookie jar
-        curmask = os.umask(0)
-        os.umask(curmask | stat.S_IRWXO | stat.S_IRWXG)
-
-        # read all cookies
-        with open(self.filename, 'r') as f:
-            cookies = f.readlines()
-
-        # write those that don't match the cookie to delete
-        with open(self.filename, 'w') as f:
-            for l in cookies:
-                c = self.as_event(l.split('\t'))
-                if c is None or not match(key, c):
-                    print(l, end='', file=f)
-        os.umask(curmask)
+        key = tuple(key)
+        with self.lock:
+            if len(key) >= 3:
+                cookie = self.cookies.get(key[:3])
+                victims = [key[:3]] if cookie and match(key, cookie) else []
+            else:
+                victims = [k for k, cookie in self.cookies.items()
+                           if match(key, cookie)]
+            for k in victims:
+                del self.cookies[k]
+            if victims:
+                self._changed()
+
+    def _changed(self):
+        self.writer.changed()
+
+    def _lines(self):
+        return (['# HTTP Cookie File'] +
+                ['\t'.join(self.as_file(c)) for c in self.cookies.values()])
+
+    def flush(self):
+        self.writer.flush()
 
 
 DEFAULT_STORE = None
@@ -198,9 +288,9 @@ class Cookies(PerInstancePlugin):
     def __init__(self, uzbl):
         super(Cookies, self).__init__(uzbl)
 
-        self.secure = []
-        self.whitelist = []
-        self.blacklist = []
+        self.secure = CookieMatchers()
+        self.whitelist = CookieMatchers()
+        self.blacklist = CookieMatchers()
 
         uzbl.connect('ADD_COOKIE', self.add_cookie)
         uzbl.connect('DELETE_COOKIE', self.delete_cookie)
@@ -216,11 +306,11 @@ def __init__(self, uzbl):
     # b. the cookie is in the whitelist and not in the blacklist
     def accept_cookie(self, cookie):
         if self.whitelist:
-            if match_list(self.whitelist, cookie):
-                return not match_list(self.blacklist, cookie)
+            if self.whitelist.match(cookie):
+                return not self.blacklist.match(cookie)
             return False
 
-        return not match_list(self.blacklist, cookie)
+        return not self.blacklist.match(cookie)
 
     def expires_with_session(self, cookie):
         return cookie[5] == ''
@@ -279,7 +369,7 @@ def add_cookie(self, cookie):
         cookie = splitquoted(cookie)
 
         if self.secure:
-            if match_list(self.secure, cookie):
+            if self.secure.match(cookie):
                 make_secure = {
                     'http': 'https',
                     'httpOnly': 'httpsOnly'
@@ -318,13 +408,13 @@ def delete_cookie(self, cookie):
                 store.delete_cookie(cookie.raw(), cookie)
 
     def blacklist_cookie(self, arg):
-        add_cookie_matcher(self.blacklist, arg)
+        self.blacklist.add(arg)
 
     def whitelist_cookie(self, arg):
-        add_cookie_matcher(self.whitelist, arg)
+        self.whitelist.add(arg)
 
     def secure_cookie(self, arg):
-        add_cookie_matcher(self.secure, arg)
+        self.secure.add(arg)
 
     def clear_secure_cookies(self, arg):
-        self.secure = []
+        self.secure.clear()
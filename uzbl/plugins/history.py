@@ -1,16 +1,113 @@
+from __future__ import print_function
+from bisect import bisect_left, bisect_right
+from collections import OrderedDict
+import atexit
+import os
 import random
 
 from .on_set import OnSetPlugin
 from .keycmd import KeyCmd
 from .config import Config
 from uzbl.ext import GlobalPlugin, PerInstancePlugin
+from uzbl.writebehind import WriteBehind
+from uzbl.xdg import xdg_data_home
+
+
+def trigrams(text):
+    return set(text[i:i + 3] for i in range(len(text) - 2))
+
+
+class PromptHistory(object):
+    ''' the lines entered at one prompt, oldest first and without
+        duplicates. lines are indexed by their trigrams so searches only
+        look at lines which can contain the key. '''
+
+    def __init__(self, size):
+        self.size = size
+        self.entries = OrderedDict()
+        self.index = {}
+        self._lines = None
+        self._positions = None
+        self._matches = {}
+
+    def __len__(self):
+        return len(self.entries)
+
+    @property
+    def lines(self):
+        if self._lines is None:
+            self._lines = list(self.entries)
+        return self._lines
+
+    def add(self, line):
+        if line in self.entries:
+            # entering a line again moves it to the end
+            del self.entries[line]
+        else:
+            for trigram in trigrams(line):
+                self.index.setdefault(trigram, set()).add(line)
+        self.entries[line] = None
+
+        while len(self.entries) > self.size:
+            old, _ = self.entries.popitem(last=False)
+            for trigram in trigrams(old):
+                lines = self.index[trigram]
+                lines.discard(old)
+                if not lines:
+                    del self.index[trigram]
+
+        self._lines = None
+        self._positions = None
+        self._matches = {}
+
+    def matches(self, key):
+        ''' the sorted positions of the lines containing key '''
+        positions = self._matches.get(key)
+        if positions is not None:
+            return positions
+
+        keys = trigrams(key)
+        if keys:
+            candidates = None
+            for trigram in sorted(keys, key=lambda t: len(self.index.get(t, ()))):
+                lines = self.index.get(trigram, set())
+                candidates = lines if candidates is None else candidates & lines
+                if not candidates:
+                    break
+        else:
+            candidates = self.entries
+
+        if self._positions is None:
+            self._positions = dict((line, i) for i, line in enumerate(self.lines))
+        positions = sorted(self._positions[line] for line in candidates
+                           if key in line)
+
+        self._matches[key] = positions
+        return positions
+
 
 class SharedHistory(GlobalPlugin):
+    ''' prompt histories shared by all instances. each prompt keeps its last
+        "size" distinct lines. they are read from "path" at startup and
+        written back in the background by replacing the file, so an event
+        manager started later (or after a crash) never sees it half-written.
+        an empty path keeps the histories in memory only. '''
+
     CONFIG_SECTION = 'history'
 
     def __init__(self, event_manager):
         super(SharedHistory, self).__init__(event_manager)
-        self.history = {}  #TODO(tailhook) save and load from file
+        self.size = int(self.plugin_config.get('size', 1000))
+        default_path = os.path.join(xdg_data_home, 'uzbl', 'prompt_history')
+        self.path = self.plugin_config.get('path', default_path)
+
+        self.history = {}
+        self.writer = WriteBehind(self.path, self._lines, self.logger)
+        self.lock = self.writer.lock
+
+        if self.path:
+            self.load()
+            atexit.register(self.flush)
 
     def get_line_number(self, prompt):
         try:
@@ -19,19 +116,76 @@ def get_line_number(self, prompt):
             return 0
 
     def addline(self, prompt, entry):
-        lst = self.history.get(prompt)
-        if lst is None:
-            self.history[prompt] = [entry]
-        else:
-            lst.append(entry)
+        with self.lock:
+            self._addline(prompt, entry)
+            if self.path:
+                self._changed()
+
+    def _addline(self, prompt, entry):
+        history = self.history.get(prompt)
+        if history is None:
+            history = self.history[prompt] = PromptHistory(self.size)
+        history.add(entry)
 
     def getline(self, prompt, index):
         try:
-            return self.history[prompt][index]
+            return self.history[prompt].lines[index]
         except KeyError:
             # not existent list is same as empty one
             raise IndexError()
 
+    def find_prev(self, prompt, key, index):
+        ''' the position of the last line at or before index containing key,
+            or -1 '''
+        try:
+            positions = self.history[prompt].matches(key)
+        except KeyError:
+            return -1
+        i = bisect_right(positions, index)
+        return positions[i - 1] if i else -1
+
+    def find_next(self, prompt, key, index):
+        ''' the position of the first line at or after index containing key,
+            or the number of lines '''
+        try:
+            history = self.history[prompt]
+        except KeyError:
+            return 0
+        positions = history.matches(key)
+        i = bisect_left(positions, index)
+        return positions[i] if i < len(positions) else len(history)
+
+    @staticmethod
+    def escape(text):
+        return text.replace('\\', '\\\\').replace('\t', '\\t').replace('\n', '\\n')
+
+    @staticmethod
+    def unescape(text):
+        parts = text.split('\\\\')
+        return '\\'.join(p.replace('\\t', '\t').replace('\\n', '\n') for p in parts)
+
+    def load(self):
+        try:
+            with open(self.path, 'r') as f:
+                for line in f:
+                    fields = line.rstrip('\n').split('\t')
+                    if len(fields) == 2:
+                        prompt, entry = map(self.unescape, fields)
+                        self._addline(prompt, entry)
+        except (IOError, OSError):
+            pass
+
+    def _changed(self):
+        self.writer.changed()
+
+    def _lines(self):
+        return ['\t'.join((self.escape(prompt), self.escape(line)))
+                for prompt, history in self.history.items()
+                for line in history.lines]
+
+    def flush(self):
+        self.writer.flush()
+
 
 class History(PerInstancePlugin):
     CONFIG_SECTION = 'history'
@@ -57,11 +211,8 @@ def prev(self):
             self.cursor -= 1
 
         if self.search_key:
-            while self.cursor >= 0:
-                line = shared.getline(self.prompt, self.cursor)
-                if self.search_key in line:
-                    return line
-                self.cursor -= 1
+            self.cursor = shared.find_prev(self.prompt, self.search_key,
+                                           self.cursor)
 
         if self.cursor >= 0:
             return shared.getline(self.prompt, self.cursor)
@@ -80,11 +231,8 @@ def __next__(self):
 
         num = shared.get_line_number(self.prompt)
         if self.search_key:
-            while self.cursor < num:
-                line = shared.getline(self.prompt, self.cursor)
-                if self.search_key in line:
-                    return line
-                self.cursor += 1
+            self.cursor = shared.find_next(self.prompt, self.search_key,
+                                           self.cursor)
 
         if self.cursor >= num:
             self.cursor = None
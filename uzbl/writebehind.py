@@ -0,0 +1,79 @@
+'''
+Write-behind files
+
+keeps a file up to date with data held in memory without writing it on
+every change
+'''
+
+from __future__ import print_function
+import logging
+import os
+import tempfile
+import threading
+
+__all__ = ('WriteBehind',)
+
+
+class WriteBehind(object):
+    ''' writes a file in the background FLUSH_DELAY seconds after the first
+        of a burst of changes. the file is replaced in one go, so it is never
+        seen half-written, and is created readable by its owner only.
+
+        the owner changes its data while holding lock and calls changed()
+        afterwards. snapshot is called with lock held and returns the lines
+        to write. '''
+
+    # seconds to wait for more changes before writing the file
+    FLUSH_DELAY = 2.0
+
+    def __init__(self, path, snapshot, logger=None):
+        self.path = path
+        self.snapshot = snapshot
+        self.logger = logger or logging.getLogger(__name__)
+        self.lock = threading.Lock()
+        self.flush_lock = threading.Lock()
+        self.timer = None
+        self.dirty = False
+
+    def changed(self):
+        self.dirty = True
+        if self.timer is None:
+            self.timer = threading.Timer(self.FLUSH_DELAY, self.flush)
+            self.timer.daemon = True
+            self.timer.start()
+
+    def flush(self):
+        # writes happen in the order their contents were taken
+        with self.flush_lock:
+            with self.lock:
+                if self.timer is not None:
+                    self.timer.cancel()
+                    self.timer = None
+                if not self.dirty:
+                    return
+                lines = self.snapshot()
+                self.dirty = False
+
+            # mkstemp creates the file readable by the owner only
+            dirname = os.path.dirname(os.path.abspath(self.path))
+            prefix = '.' + os.path.basename(self.path)
+            try:
+                if not os.path.isdir(dirname):
+                    os.makedirs(dirname)
+                fd, tmpname = tempfile.mkstemp(dir=dirname, prefix=prefix)
+            except OSError:
+                self.logger.error('failed to write %s', self.path,
+                                  exc_info=True)
+                with self.lock:
+                    self.dirty = True
+                return
+            try:
+                with os.fdopen(fd, 'w') as f:
+                    for line in lines:
+                        print(line, file=f)
+                os.rename(tmpname, self.path)
+            except:
+                os.unlink(tmpname)
+                with self.lock:
+                    self.dirty = True
+                raise